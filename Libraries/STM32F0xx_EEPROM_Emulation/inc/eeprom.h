@@ -33,6 +33,7 @@
 /* Includes ------------------------------------------------------------------*/
 #include "stm32f0xx.h"
 #include "eeprom_conf.h"
+#include "stdbool.h"
 
 
 /* Type definitions ---------------------------------------------------------*/
@@ -46,66 +47,117 @@
   #error("Unsupported emulation data width!")
 #endif
 
+/* EEPROM allocation type definition */
+typedef struct{
+  uint32_t      start_addr;         // EEPROM emulation start address
+  uint16_t      page_num;           // number of pages allocated for this EEPROM
+  uint16_t      var_num;            // number of variables support
+  ee_data_t*    var_addr_tab;       // point to variable virtual address table
+}ee_alloc_t;
+
+/* Variable virtual address and value pair */
+typedef struct{
+  ee_data_t     addr;               // variable virtual address
+  ee_data_t     data;               // variable value
+}ee_var_t;
+
+/* Write statistics */
+typedef struct{
+  uint32_t      write_count;        // variable and blob writes which reached the Flash write path
+  uint32_t      elided_count;       // writes skipped because the value was unchanged
+}ee_stats_t;
+
+/* Bitmaps of one bit per variable */
+#define VAR_BITMAP_SIZE       ((EE_VAR_MAX + 7) / 8)
+
+/* EEPROM instance: the allocation it is bound to and its cached state. The 
+   application sets alloc, the state is loaded by EE_Init() */
+typedef struct{
+  const ee_alloc_t* alloc;          // pages and variable table of this EEPROM
+  uint16_t      read_page;          // page holding the valid data, the head of the ring with EE_LOG_ENABLE
+  uint16_t      write_page;         // page records are appended to
+  uint32_t      write_address;      // next free slot in write_page
+  uint16_t      var_order[EE_VAR_MAX];        // positions in alloc->var_addr_tab sorted by virtual 
+                                              // address, set by EE_Init()
+#ifdef EE_INDEX_ENABLE
+  uint16_t      index_offset[EE_VAR_MAX];     // number of the newest record of each variable counted 
+                                              // from alloc->start_addr, 0 if none (record 0 is a header),
+                                              // at most 0xFFFF records per allocation
+#endif
+#ifdef EE_INCREMENTAL_ENABLE
+  uint16_t      transfer_page;      // page the variables are migrated from, NO_VALID_PAGE if none
+  uint32_t      transfer_address;   // next record of transfer_page to migrate, newest first
+  uint8_t       transfer_seen[VAR_BITMAP_SIZE]; // variables with a record in write_page
+#endif
+#ifdef EE_MAINTENANCE_ENABLE
+  uint16_t      erase_page;         // page superseded by the last transfer, left to EE_Maintenance()
+#endif
+#ifdef EE_ISR_RING_ENABLE
+  struct{
+    __IO ee_data_t addr;
+    __IO ee_data_t data;
+  }             isr_ring[EE_ISR_RING_SIZE];   // writes queued by EE_WriteVariableFromISR()
+  __IO uint16_t isr_head;           // next entry written by the interrupts
+  __IO uint16_t isr_tail;           // oldest entry not written to the Flash yet
+#endif
+#ifdef EE_ISR_READ_ENABLE
+  __IO uint32_t isr_seq;            // bumped before each copy of isr_value is updated
+  __IO ee_data_t isr_value[2][EE_VAR_MAX];    // newest values of the variables, copy isr_seq & 1 is 
+                                              // the one read by EE_ReadVariableFromISR()
+  __IO uint8_t  isr_known[VAR_BITMAP_SIZE];   // variables with a value in isr_value
+#endif
+#ifdef EE_CRC_ENABLE
+  uint32_t      sealed_start;       // records vouched for by the seal of their page, 
+  uint32_t      sealed_end;         // their CRC is not checked again
+#endif
+  uint32_t      write_count;        // see ee_stats_t
+  uint32_t      elided_count;       // see ee_stats_t
+#ifdef EE_WRITEBACK_ENABLE
+  ee_data_t     cache_data[EE_VAR_MAX];       // write-back cache, only dirty entries are newer 
+  uint8_t       cache_dirty[VAR_BITMAP_SIZE]; // than the Flash
+  uint16_t      cache_dirty_count;
+#ifdef EE_GET_TICK
+  uint32_t      cache_dirty_since;  // tick of the oldest dirty entry
+#endif
+#endif
+}ee_handle_t;
+
+/* The public functions take the instance first when multiple EEPROMs are used */
+#ifdef EE_MULT_ENABLE
+  #define EE_HANDLE_ONLY      ee_handle_t* Handle
+  #define EE_HANDLE_FIRST     ee_handle_t* Handle,
+#else
+  #define EE_HANDLE_ONLY      void
+  #define EE_HANDLE_FIRST
+#endif
+
 /* EEPROM Emulation operation status */
 typedef enum{
   EE_SUCCESS = FLASH_COMPLETE
 }ee_status_t;       
 
+/* Asynchronous write completion callback */
+typedef void (*ee_callback_t)(ee_data_t VirtAddress, ee_status_t Status);
+
 /* Exported constants --------------------------------------------------------*/
 
 /* assume the EEPROM memory allocation is consecutive */
-#define PAGE_BASE_ADDRESS(pg) ((uint32_t)(EEPROM_START_ADDRESS + (pg * PAGE_SIZE)))
-#define PAGE_END_ADDRESS(pg)  ((uint32_t)(EEPROM_START_ADDRESS + ((pg + 1) * PAGE_SIZE - 1)))
+#define PAGE_BASE_ADDRESS(pg) ((uint32_t)(EEPROM_START_ADDRESS + ((pg) * PAGE_SIZE)))
+#define PAGE_END_ADDRESS(pg)  ((uint32_t)(EEPROM_START_ADDRESS + (((pg) + 1) * PAGE_SIZE - 1)))
 
-/* Number of pages supported */
+/* Number of pages supported, any count from PAGE_NUM_MIN, the pages are 
+   numbered 0 to PAGE_NUM - 1 */
 #define PAGE_NUM_MIN          2
-#define PAGE_NUM_MAX          6
 
 #ifndef PAGE_NUM
   #define PAGE_NUM            3
 #endif
 
-#if (PAGE_NUM < PAGE_NUM_MIN) || (PAGE_NUM > PAGE_NUM_MAX)
+/* page indexes stay below NO_VALID_PAGE */
+#if (PAGE_NUM < PAGE_NUM_MIN) || (PAGE_NUM >= 0x00AB)
   #error ("Invalid Page Number configuration!")  
 #endif
 
-/* Pages 0 and 1 base and end addresses and used Flash pages for EEPROM emulation */
-#define PAGE0_BASE_ADDRESS    PAGE_BASE_ADDRESS(0) //((uint32_t)(EEPROM_START_ADDRESS + 0x0000))
-#define PAGE0_END_ADDRESS     PAGE_END_ADDRESS(0)  //((uint32_t)(EEPROM_START_ADDRESS + (PAGE_SIZE - 1)))
-
-#define PAGE0                 ((uint16_t)0x0000)
-
-#define PAGE1_BASE_ADDRESS    PAGE_BASE_ADDRESS(1) //((uint32_t)(EEPROM_START_ADDRESS + 0x0400))
-#define PAGE1_END_ADDRESS     PAGE_END_ADDRESS(1)  //((uint32_t)(EEPROM_START_ADDRESS + (2 * PAGE_SIZE - 1)))
-
-
-#define PAGE1                 ((uint16_t)0x0001)
-
-#if (PAGE_NUM > 2)
-#define PAGE2_BASE_ADDRESS    PAGE_BASE_ADDRESS(2) 
-#define PAGE2_END_ADDRESS     PAGE_END_ADDRESS(2)  
-#define PAGE2                 ((uint16_t)0x0002)
-#endif 
-
-#if (PAGE_NUM > 3)
-#define PAGE3_BASE_ADDRESS    PAGE_BASE_ADDRESS(3) 
-#define PAGE3_END_ADDRESS     PAGE_END_ADDRESS(3)  
-#define PAGE3                 ((uint16_t)0x0003)
-#endif 
-
-#if (PAGE_NUM > 4)
-#define PAGE4_BASE_ADDRESS    PAGE_BASE_ADDRESS(4) 
-#define PAGE4_END_ADDRESS     PAGE_END_ADDRESS(4)  
-#define PAGE4                 ((uint16_t)0x0004)
-#endif 
-
-#if (PAGE_NUM > 5)
-#define PAGE5_BASE_ADDRESS    PAGE_BASE_ADDRESS(5) 
-#define PAGE5_END_ADDRESS     PAGE_END_ADDRESS(5)  
-#define PAGE5                 ((uint16_t)0x0005)
-#endif 
-
-
 /* No valid page define */
 #define NO_VALID_PAGE         ((uint16_t)0x00AB)
 
@@ -120,22 +172,101 @@ typedef enum{
   PAGE_UNKNOWN   =       ((uint16_t)0x0006)      /* Page with unknown status */
 }ee_page_status_t;
 
-/* Valid pages in read and write defines */
-#define READ_FROM_VALID_PAGE  ((uint8_t)0x00)
-#define WRITE_IN_VALID_PAGE   ((uint8_t)0x01)
-
 /* Page full define */
 #define PAGE_FULL             ((uint8_t)0x80)
 
+/* Asynchronous queue full define */
+#define QUEUE_FULL            ((uint8_t)0x81)
+
+/* Read buffer too small define */
+#define BUFFER_TOO_SMALL      ((uint8_t)0x82)
+
+/* Allocation beyond the reach of the RAM index define */
+#define ALLOC_TOO_LARGE       ((uint8_t)0x83)
+
+/* RTOS objects not created define */
+#define NO_RTOS               ((uint8_t)0x84)
+
+/* Service thread not running define */
+#define NO_SERVICE            ((uint8_t)0x85)
+
+/* Priority levels of the requests to the service thread */
+#define EE_SERVICE_URGENT     0
+#define EE_SERVICE_NORMAL     1
+
+/* Virtual addresses of the blob records, prohibited for the variables */
+#define EE_BLOB_TAG_DATA      ((ee_data_t)~1)        /* payload */
+#define EE_BLOB_TAG_LENGTH    ((ee_data_t)~2)        /* length in bytes */
+#define EE_BLOB_TAG_CRC       ((ee_data_t)~3)        /* CRC-16/CCITT of the payload, of the CRC unit with EE_CRC_ENABLE */
+#define EE_BLOB_TAG_KEY       ((ee_data_t)~4)        /* blob key, commits the blob */
+
 /* Check whether a page index is valid */
 #define IS_VALID_PAGE_INDEX(page)   ((page) < PAGE_NUM)
 
 /* Exported types ------------------------------------------------------------*/
 /* Exported macro ------------------------------------------------------------*/
+
+#ifdef EE_RAMFUNC_ENABLE
+/* Functions run from SRAM, the .ramfunc section must be copied there by the 
+   startup code like .data. Calls from the Flash need long branches */
+#if defined(__ICCARM__)
+  #define EE_RAMFUNC          __ramfunc
+  #define EE_RAM_VECTORS      @ ".ram_vectors"
+#elif defined(__GNUC__)
+  #define EE_RAMFUNC          __attribute__((section(".ramfunc"), long_call, noinline))
+  #define EE_RAM_VECTORS      __attribute__((section(".ram_vectors")))
+#else
+  #define EE_RAMFUNC          __attribute__((section(".ramfunc"), noinline))
+  #define EE_RAM_VECTORS      __attribute__((section(".ram_vectors"), zero_init))
+#endif
+#endif
+
 /* Exported functions ------------------------------------------------------- */
-ee_status_t EE_Init(void);
-ee_status_t EE_ReadVariable(ee_data_t VirtAddress, ee_data_t* Data);
-ee_status_t EE_WriteVariable(ee_data_t VirtAddress, ee_data_t Data);
+ee_status_t EE_Init(EE_HANDLE_ONLY);
+ee_status_t EE_ReadVariable(EE_HANDLE_FIRST ee_data_t VirtAddress, ee_data_t* Data);
+ee_status_t EE_ReadVariables(EE_HANDLE_FIRST const ee_data_t* VirtAddress, ee_data_t* Data, uint8_t* Found, uint16_t Count);
+ee_status_t EE_WriteVariable(EE_HANDLE_FIRST ee_data_t VirtAddress, ee_data_t Data);
+ee_status_t EE_WriteVariables(EE_HANDLE_FIRST const ee_var_t* Vars, uint16_t Count);
+ee_status_t EE_Flush(EE_HANDLE_ONLY);
+ee_status_t EE_FlushIfDue(EE_HANDLE_ONLY);
+void EE_GetStats(EE_HANDLE_FIRST ee_stats_t* Stats);
+ee_status_t EE_GetWearInfo(EE_HANDLE_FIRST uint16_t* EraseCount, uint16_t Count);
+#ifdef EE_INCREMENTAL_ENABLE
+ee_status_t EE_Step(EE_HANDLE_FIRST uint16_t Budget);
+#endif
+#ifdef EE_MAINTENANCE_ENABLE
+ee_status_t EE_Maintenance(EE_HANDLE_FIRST uint16_t* Work);
+#endif
+#ifdef EE_ASYNC_ENABLE
+ee_status_t EE_WriteVariableAsync(EE_HANDLE_FIRST ee_data_t VirtAddress, ee_data_t Data, ee_callback_t Callback);
+bool EE_Busy(void);
+#endif
+#if defined(EE_ASYNC_ENABLE) || defined(EE_RTOS_ENABLE)
+void EE_FLASH_IRQHandler(void);
+#endif
+#ifdef EE_RTOS_ENABLE
+ee_status_t EE_RtosInit(void);
+#endif
+#ifdef EE_ISR_RING_ENABLE
+ee_status_t EE_WriteVariableFromISR(EE_HANDLE_FIRST ee_data_t VirtAddress, ee_data_t Data);
+ee_status_t EE_DrainISRWrites(EE_HANDLE_ONLY);
+#endif
+#ifdef EE_ISR_READ_ENABLE
+ee_status_t EE_ReadVariableFromISR(EE_HANDLE_FIRST ee_data_t VirtAddress, ee_data_t* Data);
+#endif
+#ifdef EE_RAMFUNC_ENABLE
+void EE_RelocateVectorTable(void);
+#endif
+#ifdef EE_SERVICE_ENABLE
+ee_status_t EE_ServiceStart(void);
+ee_status_t EE_ServiceWrite(EE_HANDLE_FIRST ee_data_t VirtAddress, ee_data_t Data, uint8_t Priority, ee_callback_t Callback);
+ee_status_t EE_ServiceRead(EE_HANDLE_FIRST ee_data_t VirtAddress, ee_data_t* Data, uint8_t Priority);
+#endif
+#ifdef EE_BLOB_ENABLE
+ee_status_t EE_BlobWrite(EE_HANDLE_FIRST ee_data_t Key, const void* Buffer, uint16_t Length);
+ee_status_t EE_BlobRead(EE_HANDLE_FIRST ee_data_t Key, void* Buffer, uint16_t Capacity);
+ee_status_t EE_BlobSize(EE_HANDLE_FIRST ee_data_t Key, uint16_t* Length);
+#endif
 
 #endif /* __EEPROM_H */
 
@@ -17,13 +17,16 @@
 
 #include "stdint.h"
 
-/* Define if we need multi-EEPROM support */
+/* Define if we need multi-EEPROM support, a build defining EE_MULT_DISABLE 
+   gets the single EEPROM API, whose functions take no handle */
+#ifndef EE_MULT_DISABLE
 #define EE_MULT_ENABLE
+#endif
 
 /* Number of EEPROMs will be used */
 #define EE_NUM                2
 
-/* Number of pages will be used */
+/* Number of pages will be used, 2 or more */
 #define PAGE_NUM              6
 
 /* Define the size of the sectors to be used */
@@ -37,19 +40,161 @@
 /* Variables' number */
 #define NB_OF_VAR             ((uint8_t)22)
 
+/* Largest number of variables of an EEPROM, sizes the RAM state of each one */
+#define EE_VAR_MAX            NB_OF_VAR
+
+/* Define if we need a RAM index of the newest record of each variable, 
+   costs 2 bytes of RAM per variable. The records are numbered on 16 bits: 
+   an allocation holds at most 0xFFFF records, EE_Init() rejects larger ones */
+//#define EE_INDEX_ENABLE
+
+/* Define if writes of a value equal to the stored one should not reach the Flash */
+//#define EE_SKIP_UNCHANGED_ENABLE
+
+/* Define if we need write-back caching of the variables: writes are kept in RAM 
+   and only reach the Flash on EE_Flush(), which must be called before a reset, 
+   or when one of the thresholds below is hit */
+//#define EE_WRITEBACK_ENABLE
+
+/* Number of dirty variables which triggers a flush */
+#define EE_WRITEBACK_MAX_DIRTY  8
+
+/* Age in ticks of the oldest dirty variable which triggers a flush, 
+   only applied when EE_GET_TICK is defined */
+#define EE_WRITEBACK_MAX_AGE    1000
+
+/* Define if we need the interrupt driven asynchronous write engine */
+//#define EE_ASYNC_ENABLE
+
+/* Number of entries of the asynchronous write queue, one is kept free */
+#define EE_ASYNC_QUEUE_SIZE     8
+
+/* Millisecond time base of the application, e.g. a SysTick counter */
+//#define EE_GET_TICK()         (SysTickCounter)
+
+/* Define if we need blob records: byte strings stored under a key, written 
+   and read in one call, see EE_BlobWrite() */
+//#define EE_BLOB_ENABLE
+
+/* Longest blob in bytes. Each record of a blob holds EE_DATA_WIDTH bits of 
+   payload and three more hold its length, CRC and key, so a blob takes twice 
+   its length in Flash, four times with EE_CRC_ENABLE. The build fails if such 
+   a blob does not fit in a page next to a record of each of EE_VAR_MAX 
+   variables: with 1 KByte pages, 16 bit data and 22 variables, 456 bytes at 
+   most, 202 with EE_CRC_ENABLE. The newest version of every blob must also fit 
+   in a page with the variables, or the transfers return PAGE_FULL */
+#define EE_BLOB_MAX_LENGTH      128
+
+/* Blob keys a page transfer keeps track of on the stack, the ones past it are 
+   searched for in the new page, which makes the transfer slower */
+#ifndef EE_BLOB_KEYS_MAX
+#define EE_BLOB_KEYS_MAX        8
+#endif
+
+/* Define if we need the log-structured page ring: records are appended across 
+   all the pages and, once a single page is left erased, only the oldest page 
+   is reclaimed by moving its live records to the newest one. Not supported 
+   with EE_ASYNC_ENABLE nor EE_BLOB_ENABLE */
+//#define EE_LOG_ENABLE
+
+/* Define if we need incremental page transfers: a write to a full page only 
+   opens the new page, the variables are then migrated a few records at a time 
+   by the following writes and EE_Step(). Not supported with EE_ASYNC_ENABLE, 
+   EE_BLOB_ENABLE nor EE_LOG_ENABLE */
+//#define EE_INCREMENTAL_ENABLE
+
+/* Flash operations of the pending transfer run after each write, the erase of 
+   the old page is left to EE_Step(). The migration is completed in one go by 
+   the write which leaves the new page with room for just every variable */
+#define EE_WRITE_STEP_BUDGET    1
+
+/* Define if the application calls EE_Maintenance() from its idle time: the 
+   page erases and the compactions are done there rather than in the writes. 
+   Not supported with EE_ASYNC_ENABLE */
+//#define EE_MAINTENANCE_ENABLE
+
+/* Fill percentage of the page written to from which EE_Maintenance() compacts */
+#define EE_MAINTENANCE_THRESHOLD  75
 
-/* Emulated data and virtual address bits */
+/* Define if the EEPROMs are shared by CMSIS-RTOS threads: a mutex serializes 
+   the Flash work, the variables found in the RAM index are read without it, 
+   and the programs and page erases sleep on a semaphore released by 
+   EE_FLASH_IRQHandler(), which must be called from FLASH_IRQHandler(). 
+   EE_RtosInit() creates both and must be called before the threads using the 
+   EEPROMs start, the mutex is never taken twice by a thread. Needs 
+   EE_INDEX_ENABLE, not supported with EE_ASYNC_ENABLE nor EE_WRITEBACK_ENABLE */
+//#define EE_RTOS_ENABLE
+
+/* Define if variables are written from interrupts with EE_WriteVariableFromISR(): 
+   the writes are queued in a lock-free ring of each instance and written to 
+   the Flash by EE_DrainISRWrites(), EE_Flush() or the next write, from thread 
+   context. EE_Flush() must then be called before a reset */
+//#define EE_ISR_RING_ENABLE
+
+/* Number of entries of the ring of each instance, one is kept free */
+#define EE_ISR_RING_SIZE            16
+
+/* Define if variables are read from interrupts with EE_ReadVariableFromISR(): 
+   each instance keeps the values of its variable table in RAM, twice, and the 
+   interrupts read them without locking nor depending on the Flash state. 
+   Not compatible with EE_ASYNC_ENABLE */
+//#define EE_ISR_READ_ENABLE
+
+/* Define if the Flash programs and erases run from SRAM, so that the 
+   interrupts declared EE_RAMFUNC keep running meanwhile, see 
+   EE_RelocateVectorTable(). The linker script must load the .ramfunc section 
+   to SRAM like .data, and place .ram_vectors at the start of the SRAM. Not 
+   supported with EE_ASYNC_ENABLE nor EE_RTOS_ENABLE */
+//#define EE_RAMFUNC_ENABLE
+
+/* Number of vectors copied to SRAM, 16 system and 32 peripheral on the STM32F0 */
+#define EE_VECTOR_NUM               48
+
+/* Define if the page erases sleep in WFE until the Flash end of operation 
+   instead of polling the busy flag. Needs EE_RAMFUNC_ENABLE and EE_GET_TICK, 
+   which must then only read RAM, and FLASH_IRQn disabled in the NVIC */
+//#define EE_LOWPOWER_ENABLE
+
+/* Milliseconds after which a sleeping page erase, or a program polling the 
+   busy flag, returns FLASH_TIMEOUT with EE_LOWPOWER_ENABLE */
+#define EE_ERASE_TIMEOUT_MS         100
+
+/* Define if the records carry a CRC-32 of the CRC unit, the ones failing it 
+   are skipped in favour of the previous version, and each page is sealed with 
+   the CRC of its records once a transfer completes, so that EE_Init() checks 
+   them in one pass. Doubles the record size and changes the page layout, the 
+   pages must be erased when it is switched. The CRC unit must not be used by 
+   interrupts meanwhile. Not supported with EE_ASYNC_ENABLE, EE_LOG_ENABLE nor 
+   EE_INCREMENTAL_ENABLE */
+//#define EE_CRC_ENABLE
+
+/* Define if a service thread owns the Flash: the other threads mail their 
+   requests to it with EE_ServiceWrite() and EE_ServiceRead(), see 
+   EE_ServiceStart(). Needs EE_RTOS_ENABLE */
+//#define EE_SERVICE_ENABLE
+
+/* Number of requests the service queue holds, and served in one batch */
+#define EE_SERVICE_QUEUE_SIZE       8
+
+/* Milliseconds without requests after which the service thread runs 
+   EE_Maintenance() */
+#define EE_SERVICE_IDLE_MS          50
+
+/* Priority and stack size in bytes of the service thread, 0 for the default stack */
+#define EE_SERVICE_THREAD_PRIORITY  osPriorityBelowNormal
+#define EE_SERVICE_STACK_SIZE       0
+
+/* Signal flag set to the thread waiting in EE_ServiceRead() */
+#define EE_SERVICE_SIGNAL           0x4000
+
+
+/* Emulated data and virtual address bits, a record holds both so it takes 
+   4 bytes with 16 bit data and 8 bytes with 32 bit data */
 #define EE_DATA_16BIT         16
 #define EE_DATA_32BIT         32
+#ifndef EE_DATA_WIDTH
 #define EE_DATA_WIDTH         EE_DATA_16BIT
+#endif
 
 
-/* EEPROM allocation type definition */
-typedef struct{
-  uint32_t      start_addr;         // EEPROM emulation start address
-  uint16_t      page_num;           // number of pages allocated for this EEPROM
-  uint16_t      var_num;            // number of variables support
-  uint16_t*     var_addr_tab;       // point to variable virtual address table
-}ee_alloc_t;
-
 #endif
@@ -33,14 +33,302 @@
 #include "eeprom.h"
 #include "stdbool.h"
 #include "stm32f0xx_conf.h"
+#ifdef EE_RTOS_ENABLE
+#include "cmsis_os.h"
+#endif
 
 /* Private typedef -----------------------------------------------------------*/
+
+#if defined(EE_BLOB_ENABLE) && defined(EE_ASYNC_ENABLE)
+  #error("Blob records are not transferred by the asynchronous engine!")
+#endif
+
+#if defined(EE_LOG_ENABLE) && (defined(EE_ASYNC_ENABLE) || defined(EE_BLOB_ENABLE))
+  #error("The page ring is not supported by the asynchronous engine nor by blob records!")
+#endif
+
+#if defined(EE_INCREMENTAL_ENABLE) && (defined(EE_ASYNC_ENABLE) || defined(EE_BLOB_ENABLE) || defined(EE_LOG_ENABLE))
+  #error("Incremental transfers are not supported by the asynchronous engine, blob records nor the page ring!")
+#endif
+
+#if defined(EE_MAINTENANCE_ENABLE) && defined(EE_ASYNC_ENABLE)
+  #error("The asynchronous engine erases from its interrupt, it needs no maintenance!")
+#endif
+
+#if defined(EE_RTOS_ENABLE) && (defined(EE_ASYNC_ENABLE) || !defined(EE_INDEX_ENABLE))
+  #error("The RTOS layer needs the RAM index and does not support the asynchronous engine!")
+#endif
+
+#if defined(EE_RTOS_ENABLE) && defined(EE_WRITEBACK_ENABLE)
+  #error("The write-back cache is read without the lock, the RTOS layer does not support it!")
+#endif
+
+#if defined(EE_ISR_READ_ENABLE) && defined(EE_ASYNC_ENABLE)
+  #error("EE_ISR_READ_ENABLE and EE_ASYNC_ENABLE cannot be defined together!")
+#endif
+
+#if defined(EE_RAMFUNC_ENABLE) && (defined(EE_ASYNC_ENABLE) || defined(EE_RTOS_ENABLE))
+  #error("EE_RAMFUNC_ENABLE does not support EE_ASYNC_ENABLE nor EE_RTOS_ENABLE!")
+#endif
+
+#if defined(EE_LOWPOWER_ENABLE) && (!defined(EE_RAMFUNC_ENABLE) || !defined(EE_GET_TICK))
+  #error("EE_LOWPOWER_ENABLE needs EE_RAMFUNC_ENABLE and EE_GET_TICK!")
+#endif
+
+#if defined(EE_CRC_ENABLE) && (defined(EE_ASYNC_ENABLE) || defined(EE_LOG_ENABLE) || defined(EE_INCREMENTAL_ENABLE))
+  #error("EE_CRC_ENABLE does not support EE_ASYNC_ENABLE, EE_LOG_ENABLE nor EE_INCREMENTAL_ENABLE!")
+#endif
+
+#if defined(EE_SERVICE_ENABLE) && !defined(EE_RTOS_ENABLE)
+  #error("The service thread is part of the RTOS layer!")
+#endif
+
+#ifdef EE_ASYNC_ENABLE
+/* Asynchronous engine states, the ones but ASYNC_IDLE, ASYNC_DISPATCH and 
+   ASYNC_COPY_NEXT name the Flash operation in progress */
+typedef enum{
+  ASYNC_IDLE,                   /* no request queued, Flash interrupts disabled */
+  ASYNC_DISPATCH,               /* start the request at the head of the queue */
+  ASYNC_PROGRAM_DATA,           /* programming the data of the head request */
+  ASYNC_PROGRAM_ADDRESS,        /* programming the virtual address of the head request */
+  ASYNC_GENERATION,             /* programming the generation of the new page */
+  ASYNC_RECEIVE_HEADER,         /* marking the new page RECEIVE_DATA */
+  ASYNC_COPY_NEXT,              /* find the next variable to transfer */
+  ASYNC_COPY_DATA,              /* programming the data of a transferred variable */
+  ASYNC_COPY_ADDRESS,           /* programming the virtual address of a transferred variable */
+  ASYNC_VALID_HEADER,           /* marking the new page VALID_PAGE */
+  ASYNC_COMMIT,                 /* programming the commit halfword of the new page */
+  ASYNC_ERASE,                  /* erasing the old page */
+  ASYNC_ERASE_COUNT,            /* programming the erase count of the old page */
+  ASYNC_ERASE_CHECK             /* programming the complement of the erase count */
+}ee_async_state_t;
+
+/* Queued write request */
+typedef struct{
+  ee_handle_t*  handle;
+  ee_var_t      var;
+  ee_callback_t callback;
+}ee_async_req_t;
+#endif
+
+#ifdef EE_SERVICE_ENABLE
+/* Request mailed to the service thread */
+typedef struct{
+#ifdef EE_MULT_ENABLE
+  ee_handle_t*  handle;
+#endif
+  ee_var_t      var;                /* variable to write, or address of the one to read */
+  uint8_t       priority;           /* EE_SERVICE_URGENT or EE_SERVICE_NORMAL */
+  bool          read;
+  ee_callback_t callback;           /* write completion, may be NULL */
+  ee_data_t*    data;               /* read: receives the value */
+  ee_status_t*  status;             /* read: receives the status */
+  osThreadId    thread;             /* read: signaled with EE_SERVICE_SIGNAL once answered */
+}ee_service_req_t;
+#endif
+
 /* Private define ------------------------------------------------------------*/
 /* Private macro -------------------------------------------------------------*/
-/* Private variables ---------------------------------------------------------*/
 
-/* Global variable used to store variable value in read sequence */
-ee_data_t DataVar = 0;
+/* Page addresses and ring order of the EEPROM instance h */
+#define EE_PAGE_BASE(h, pg)   ((h)->alloc->start_addr + ((uint32_t)(pg) * PAGE_SIZE))
+#define EE_PAGE_END(h, pg)    (EE_PAGE_BASE(h, pg) + PAGE_SIZE - 1)
+#define EE_PAGE_NEXT(h, pg)   (((pg) + 1) % (h)->alloc->page_num)
+
+/* Page header, the first EE_HEADER_SIZE bytes of each page, records follow it:
+   - the page status halfword, see ee_page_status_t
+   - the erase count halfword, programmed right after each erase, then the 
+     check halfword, the complement of the count plus one, which never reads 
+     erased. A count cut by a power loss fails the check: the page is erased 
+     again and the count is not taken as wear data
+   - the generation halfword, one more than the one of the page the variables 
+     came from, programmed before the page is marked RECEIVE_DATA. With 
+     EE_LOG_ENABLE, one more than the one of the previous page of the ring, and 
+     zeroed to retire the oldest page before its erase
+   - the commit halfword, the complement of the generation, programmed after 
+     VALID_PAGE once the page holds every variable. A commit cut by a power 
+     loss is zeroed by the recovery, zero commits any generation but zero
+   - with EE_CRC_ENABLE, the seal: the CRC word of the records programmed up 
+     to the transfer end, then the offset of that end, programmed last
+   The check halfword follows the other fields, the header is padded to whole 
+   record slots */
+#ifdef EE_CRC_ENABLE
+#define EE_HEADER_SIZE          16
+#define EE_ERASE_CHECK_OFFSET   14
+#else
+#if (EE_DATA_32BIT == EE_DATA_WIDTH)
+#define EE_HEADER_SIZE          16
+#else
+#define EE_HEADER_SIZE          12
+#endif
+#define EE_ERASE_CHECK_OFFSET   8
+#endif
+#define EE_ERASE_COUNT_OFFSET   2
+#define EE_GENERATION_OFFSET    4
+#define EE_COMMIT_OFFSET        6
+#define EE_SEAL_CRC_OFFSET      8
+#define EE_SEAL_END_OFFSET      12
+#define EE_ERASE_COUNT_UNKNOWN  ((uint16_t)0xFFFF)
+#define EE_ERASE_COUNT_MAX      ((uint16_t)0xFFFE)
+#define EE_PAGE_STATUS(h, pg)       (*(__IO uint16_t*)EE_PAGE_BASE(h, pg))
+#define EE_PAGE_ERASE_COUNT(h, pg)  (*(__IO uint16_t*)(EE_PAGE_BASE(h, pg) + EE_ERASE_COUNT_OFFSET))
+#define EE_PAGE_ERASE_CHECK(h, pg)  (*(__IO uint16_t*)(EE_PAGE_BASE(h, pg) + EE_ERASE_CHECK_OFFSET))
+
+/* Check halfword of an erase count, and an erase count programmed in full 
+   along with its check */
+#define EE_ERASE_CHECK(count)                 ((uint16_t)~((count) + 1))
+#define EE_ERASE_COUNT_CHECKED(count, check)  (((count) != EE_ERASE_COUNT_UNKNOWN) && \
+                                               ((check) == EE_ERASE_CHECK(count)))
+#define EE_PAGE_GENERATION(h, pg)   (*(__IO uint16_t*)(EE_PAGE_BASE(h, pg) + EE_GENERATION_OFFSET))
+#define EE_PAGE_COMMIT(h, pg)       (*(__IO uint16_t*)(EE_PAGE_BASE(h, pg) + EE_COMMIT_OFFSET))
+#define EE_PAGE_SEAL_CRC(h, pg)     (*(__IO uint32_t*)(EE_PAGE_BASE(h, pg) + EE_SEAL_CRC_OFFSET))
+#define EE_PAGE_SEAL_END(h, pg)     (*(__IO uint16_t*)(EE_PAGE_BASE(h, pg) + EE_SEAL_END_OFFSET))
+
+/* Generations run from 1 to 0xFFFE so that neither field of a committed page 
+   reads erased, and compare with serial number arithmetic across the wrap */
+#define EE_GENERATION_NEXT(gen)       (((gen) >= 0xFFFE) ? 1 : ((gen) + 1))
+#define EE_GENERATION_PREV(gen)       (((gen) <= 1) ? 0xFFFE : ((gen) - 1))
+
+/* Budget of a transfer step which runs the transfer to its end */
+#define EE_STEP_UNBOUNDED     ((uint16_t)0xFFFF)
+
+/* Page transfers run by the writes leave the erase of the old page to 
+   EE_Maintenance(), the page ring and incremental transfers have their own */
+#if defined(EE_MAINTENANCE_ENABLE) && !defined(EE_LOG_ENABLE) && !defined(EE_INCREMENTAL_ENABLE)
+#define EE_DEFERRED_ERASE
+#endif
+
+/* The page written to is filled up to EE_MAINTENANCE_THRESHOLD percent, with more 
+   records than variables so that a compaction frees some room */
+#define EE_FILL_REACHED(h)    ((((h)->write_address - EE_PAGE_BASE(h, (h)->write_page)) * 100 >= \
+                                (uint32_t)PAGE_SIZE * EE_MAINTENANCE_THRESHOLD) && \
+                               (((h)->write_address - EE_PAGE_BASE(h, (h)->write_page) - EE_HEADER_SIZE) > \
+                                ((uint32_t)(h)->alloc->var_num * EE_RECORD_SIZE)))
+#define EE_GENERATION_NEWER(a, b)     (((int16_t)(uint16_t)((a) - (b))) > 0)
+#define EE_PAGE_COMMITTED(h, pg)      ((EE_PAGE_STATUS(h, pg) == VALID_PAGE) && \
+                                       (((uint16_t)(EE_PAGE_COMMIT(h, pg) ^ EE_PAGE_GENERATION(h, pg)) == 0xFFFF) || \
+                                        ((EE_PAGE_COMMIT(h, pg) == 0) && (EE_PAGE_GENERATION(h, pg) != 0))))
+
+/* A page receiving a transfer: RECEIVE_DATA, or VALID_PAGE without its commit. 
+   VALID_PAGE cut by a power loss over RECEIVE_DATA leaves part of its bits */
+#define EE_STATUS_RECEIVING(status)   (((status) & (uint16_t)~RECEIVE_DATA) == 0)
+
+/* Pages written before the page header: the status halfword, then records of a 
+   data halfword and a virtual address halfword. The erase count is programmed 
+   on every page before it is used since, a page in use without one is legacy */
+#define EE_LEGACY_HEADER_SIZE   4
+#define EE_LEGACY_RECORD_SIZE   4
+#define EE_PAGE_LEGACY(h, pg)   (((EE_PAGE_STATUS(h, pg) == VALID_PAGE) || (EE_PAGE_STATUS(h, pg) == RECEIVE_DATA)) && \
+                                 (EE_PAGE_ERASE_COUNT(h, pg) == EE_ERASE_COUNT_UNKNOWN))
+
+/* Record layout: the variable data then its virtual address, both ee_data_t 
+   wide. With EE_CRC_ENABLE, the CRC word of both follows them, programmed 
+   last, and pads the record to four ee_data_t. The first record slots of each 
+   page hold the page header */
+#define EE_DATA_SIZE          (EE_DATA_WIDTH / 8)
+#ifdef EE_CRC_ENABLE
+#define EE_RECORD_SIZE        (4 * EE_DATA_SIZE)
+#define EE_CRC_OFFSET         (2 * EE_DATA_SIZE)
+#define EE_RECORD_VALID(h, addr)  EE_RecordCheck((h), (addr))
+#else
+#define EE_RECORD_SIZE        (2 * EE_DATA_SIZE)
+#define EE_RECORD_VALID(h, addr)  (true)
+#endif
+#define EE_READ_DATA(addr)    (*(__IO ee_data_t*)(addr))
+
+/* Flash operations, run from SRAM with EE_RAMFUNC_ENABLE, waited for on a 
+   semaphore with EE_RTOS_ENABLE */
+#ifdef EE_RAMFUNC_ENABLE
+#define EE_PROGRAM_HALFWORD(addr, data)   EE_RamProgram((addr), (data), 1)
+#define EE_PROGRAM_WORD(addr, data)       EE_RamProgram((addr), (data), 2)
+#define EE_ERASE_PAGE(addr)               EE_RamErasePage(addr)
+#elif defined(EE_RTOS_ENABLE)
+#define EE_PROGRAM_HALFWORD(addr, data)   EE_FlashProgram((addr), (data), 1)
+#define EE_PROGRAM_WORD(addr, data)       EE_FlashProgram((addr), (data), 2)
+#define EE_ERASE_PAGE(addr)               EE_FlashErasePage(addr)
+#else
+#define EE_PROGRAM_HALFWORD(addr, data)   FLASH_ProgramHalfWord((addr), (data))
+#define EE_PROGRAM_WORD(addr, data)       FLASH_ProgramWord((addr), (data))
+#define EE_ERASE_PAGE(addr)               FLASH_ErasePage(addr)
+#endif
+
+#if (EE_DATA_16BIT == EE_DATA_WIDTH)
+#define EE_RECORD_ERASED(addr)        ((*(__IO uint32_t*)(addr)) == 0xFFFFFFFF)
+#define EE_PROGRAM_DATA(addr, data)   EE_PROGRAM_HALFWORD((addr), (data))
+#else
+#define EE_RECORD_ERASED(addr)        (((*(__IO uint32_t*)(addr)) & (*(__IO uint32_t*)((addr) + 4))) == 0xFFFFFFFF)
+#define EE_PROGRAM_DATA(addr, data)   EE_PROGRAM_WORD((addr), (data))
+#endif
+
+/* RAM index entries: the number of the newest record of a variable counted from 
+   the EEPROM start, 0 if none as record 0 is the header of the first page */
+#define EE_INDEX_ENTRY(h, addr)       ((uint16_t)(((addr) - (h)->alloc->start_addr) / EE_RECORD_SIZE))
+#define EE_INDEX_ADDRESS(h, entry)    ((h)->alloc->start_addr + ((uint32_t)(entry) * EE_RECORD_SIZE))
+#define EE_INDEX_FITS(pages)          ((((uint32_t)(pages) * PAGE_SIZE) / EE_RECORD_SIZE) <= 0xFFFF)
+
+#ifdef EE_INDEX_ENABLE
+/* PAGE_SIZE is a cast, out of reach of #if: the array size turns negative when 
+   the index entries cannot number the records of PAGE_NUM pages */
+typedef char ee_index_fits_t[EE_INDEX_FITS(PAGE_NUM) ? 1 : -1];
+#endif
+
+/* Byte n of a blob whose payload records start at addr, each record holds 
+   EE_DATA_SIZE bytes of payload in its data field */
+#define EE_BlobByte(addr, n)  (*(__IO uint8_t*)((addr) + (((n) / EE_DATA_SIZE) * EE_RECORD_SIZE) + ((n) % EE_DATA_SIZE)))
+
+/* Records of a blob of len bytes: its payload, length, CRC and key */
+#define EE_BLOB_RECORDS(len)  ((((uint32_t)(len) + EE_DATA_SIZE - 1) / EE_DATA_SIZE) + 3)
+
+#ifdef EE_BLOB_ENABLE
+/* The array size turns negative when the longest blob and a record of each 
+   variable do not fit in a page */
+typedef char ee_blob_fits_t[((EE_BLOB_RECORDS(EE_BLOB_MAX_LENGTH) + EE_VAR_MAX) * EE_RECORD_SIZE) <= 
+                            (PAGE_SIZE - EE_HEADER_SIZE) ? 1 : -1];
+#endif
+
+/* Bitmaps indexed like the variable table */
+#define VAR_BIT_TEST(map, n)  ((map)[(n) / 8] & (1 << ((n) % 8)))
+#define VAR_BIT_SET(map, n)   ((map)[(n) / 8] |= (1 << ((n) % 8)))
+
+#ifdef EE_RTOS_ENABLE
+/* Serializes the Flash work of every instance, they share the Flash controller. 
+   A thread never takes it twice, it need not be recursive */
+#define EE_LOCK()             osMutexWait(EepromMutex, osWaitForever)
+#define EE_UNLOCK()           osMutexRelease(EepromMutex)
+
+/* Wait for the end of a Flash operation, a page erase takes 40 ms at most */
+#define EE_FLASH_WAIT_MS      100
+#else
+#define EE_LOCK()
+#define EE_UNLOCK()
+#endif
+
+#ifdef EE_MULT_ENABLE
+/* Public functions receive the instance, forward it */
+#define EE_HANDLE_ARG         Handle
+#define EE_HANDLE_ARG_FIRST   Handle,
+#else
+#define EE_HANDLE_ARG
+#define EE_HANDLE_ARG_FIRST
+#endif
+
+#ifdef EE_SERVICE_ENABLE
+/* Requests to the same instance, and to the same variable of it */
+#ifdef EE_MULT_ENABLE
+#define EE_SERVICE_SAME_HANDLE(a, b)  ((a)->handle == (b)->handle)
+#else
+#define EE_SERVICE_SAME_HANDLE(a, b)  true
+#endif
+#define EE_SERVICE_SAME_VAR(a, b)     (EE_SERVICE_SAME_HANDLE(a, b) && ((a)->var.addr == (b)->var.addr))
+
+/* State of a request in a batch of the service thread */
+#define EE_SERVICE_QUEUED             0
+#define EE_SERVICE_PENDING            1   /* write due in the next EE_WriteVariables() */
+#define EE_SERVICE_WRITTEN            2
+#define EE_SERVICE_DONE               3
+#endif
+
+/* Private variables ---------------------------------------------------------*/
 
 /* Virtual address defined by the user: 0xFFFF value is prohibited */
 extern ee_data_t VirtAddVarTab[NB_OF_VAR];
@@ -48,104 +336,369 @@ extern ee_data_t VirtAddVarTab[NB_OF_VAR];
 /* multi-allocations definition */
 #ifdef EE_MULT_ENABLE
 extern ee_alloc_t EmulatedChips[EE_NUM];     
+#else
+/* Single EEPROM described by the configuration, the public functions work on 
+   it through Handle like the multi-EEPROM ones do on their parameter */
+static const ee_alloc_t DefaultAlloc = {EEPROM_START_ADDRESS, PAGE_NUM, NB_OF_VAR, VirtAddVarTab};
+static ee_handle_t DefaultHandle = {.alloc = &DefaultAlloc, .read_page = NO_VALID_PAGE, .write_page = NO_VALID_PAGE};
+static ee_handle_t* const Handle = &DefaultHandle;
+#endif
+
+#ifdef EE_ASYNC_ENABLE
+/* Asynchronous write queue, the application adds requests at the tail and the 
+   engine removes them from the head once they are complete */
+static ee_async_req_t AsyncQueue[EE_ASYNC_QUEUE_SIZE];
+static volatile uint16_t AsyncHead = 0;
+static volatile uint16_t AsyncTail = 0;
+static volatile ee_async_state_t AsyncState = ASYNC_IDLE;
+
+/* Page transfer run by the engine, the head request goes to the new page first */
+static bool AsyncTransfer = false;
+static uint16_t AsyncOldPage;
+static uint8_t AsyncSeen[VAR_BITMAP_SIZE];
+static uint16_t AsyncSeenCount;
+static uint16_t AsyncEraseCount;
+
+/* Slot of the head request being programmed, or record of the old page being 
+   transferred */
+static uint32_t AsyncAddress;
+
+#if (EE_DATA_32BIT == EE_DATA_WIDTH)
+/* Upper halfword of the word being programmed, started on the next EOP */
+static bool AsyncHighPending = false;
+static uint32_t AsyncHighAddress;
+static uint16_t AsyncHighData;
+#endif
+
+/* Bumped by the engine each time it changes the pages of an instance, the 
+   readers scan again when it moved during their scan */
+static volatile uint16_t AsyncSwitches = 0;
+#endif
+
+#ifdef EE_RTOS_ENABLE
+/* Created by EE_RtosInit() */
+osMutexDef(EepromMutex);
+osSemaphoreDef(EepromFlashDone);
+static osMutexId EepromMutex;
+static osSemaphoreId EepromFlashDone;
+
+/* Status of the last erase, set by EE_FLASH_IRQHandler() */
+static volatile FLASH_Status EepromFlashStatus;
+#endif
+
+#ifdef EE_SERVICE_ENABLE
+/* Requests to the service thread, created by EE_ServiceStart() */
+osMailQDef(EepromService, EE_SERVICE_QUEUE_SIZE, ee_service_req_t);
+static osMailQId ServiceQueue;
+
+#ifdef EE_MULT_ENABLE
+/* Instances served so far, the idle work runs on each of them */
+static ee_handle_t* ServiceHandles[EE_NUM];
+static uint16_t ServiceHandleCount = 0;
+#endif
+#endif
+
+#ifdef EE_RAMFUNC_ENABLE
+/* Copy of the vector table, the .ram_vectors section must be placed at the 
+   start of the SRAM which is remapped at address 0 */
+static __IO uint32_t RamVectors[EE_VECTOR_NUM] EE_RAM_VECTORS;
 #endif
 
 /* Private function prototypes -----------------------------------------------*/
 /* Private functions ---------------------------------------------------------*/
-static FLASH_Status EE_Format(uint16_t initial_page);
-static uint16_t EE_VerifyPageFullWriteVariable(ee_data_t VirtAddress, ee_data_t Data);
-static uint16_t EE_PageTransfer(ee_data_t VirtAddress, ee_data_t Data);
-static uint16_t EE_FindValidPage(uint8_t Operation);
+static uint16_t EE_RecoverPages(ee_handle_t* Handle);
+static FLASH_Status EE_Format(ee_handle_t* Handle, uint16_t initial_page);
+static uint16_t EE_VerifyPageFullWriteVariable(ee_handle_t* Handle, ee_data_t VirtAddress, ee_data_t Data);
+static uint16_t EE_ReadStoredVariable(ee_handle_t* Handle, ee_data_t VirtAddress, ee_data_t* Data);
+static uint16_t EE_WriteBatch(ee_handle_t* Handle, const ee_var_t* Vars, uint16_t Count);
+#ifndef EE_LOG_ENABLE
+#ifndef EE_INCREMENTAL_ENABLE
+static uint16_t EE_PageTransfer(ee_handle_t* Handle, const ee_var_t* Vars, uint16_t Count);
+static uint16_t EE_PageTransferFinish(ee_handle_t* Handle, uint16_t OldPage);
+#endif
+static uint16_t EE_PageTransferStart(ee_handle_t* Handle);
+#endif
+static bool EE_IsOverwritten(const ee_var_t* Vars, uint16_t Idx, uint16_t Count);
+static bool EE_CountWrite(ee_handle_t* Handle, const ee_var_t* Var);
+static void EE_FindPages(ee_handle_t* Handle, uint16_t* ValidPage, uint16_t* ReceivePage);
+static uint16_t EE_LegacyMigrate(ee_handle_t* Handle);
+static bool EE_LegacyRead(ee_handle_t* Handle, uint16_t Page, ee_data_t VirtAddress, uint16_t* Data);
+static FLASH_Status EE_CommitPage(ee_handle_t* Handle, uint16_t Page);
+static FLASH_Status EE_ErasePage(ee_handle_t* Handle, uint16_t Page);
+#ifndef EE_LOG_ENABLE
+static FLASH_Status EE_EraseOtherPages(ee_handle_t* Handle, uint16_t KeptPage);
+#endif
+static uint16_t EE_GetEraseCount(ee_handle_t* Handle, uint16_t Page);
+static uint16_t EE_ReadEraseCount(ee_handle_t* Handle, uint16_t Page);
+static uint16_t EE_SelectPage(ee_handle_t* Handle, uint16_t ValidPage);
+static bool EE_IsPageBlank(uint32_t PageAddress);
+static uint32_t EE_FindFreeSlot(ee_handle_t* Handle, uint16_t Page);
+static void EE_LoadState(ee_handle_t* Handle);
+#ifndef EE_LOG_ENABLE
+static uint16_t EE_TransferVariables(ee_handle_t* Handle, uint16_t OldPage);
+#endif
+#ifdef EE_BLOB_ENABLE
+static bool EE_BlobCheck(uint32_t PageStartAddress, uint32_t Address, uint32_t* PayloadAddress, uint16_t* Length);
+static bool EE_BlobFind(ee_handle_t* Handle, uint16_t Page, uint32_t EndAddress, ee_data_t Key, uint32_t* PayloadAddress, uint16_t* Length);
+static bool EE_BlobFindStored(ee_handle_t* Handle, ee_data_t Key, uint32_t* PayloadAddress, uint16_t* Length);
+static uint16_t EE_BlobWriteRecords(ee_handle_t* Handle, ee_data_t Key, const uint8_t* Buffer, uint16_t Length);
+static uint16_t EE_BlobTransfer(ee_handle_t* Handle, uint16_t OldPage, uint32_t Address, ee_data_t* Keys, uint16_t* KeyCount);
+static bool EE_BlobKeyMark(ee_handle_t* Handle, ee_data_t* Keys, uint16_t* KeyCount, ee_data_t Key);
+static uint16_t EE_BlobCrc(uint32_t PayloadAddress, uint16_t Length);
+static uint16_t EE_BlobStore(ee_handle_t* Handle, ee_data_t Key, const void* Buffer, uint16_t Length);
+static uint16_t EE_BlobLocate(ee_handle_t* Handle, ee_data_t Key, uint32_t* PayloadAddress, uint16_t* Length);
+#endif
+static void EE_SortVarTable(ee_handle_t* Handle);
+static int16_t EE_GetVarIndex(ee_handle_t* Handle, ee_data_t VirtAddress);
+#ifdef EE_INDEX_ENABLE
+static void EE_IndexBuild(ee_handle_t* Handle);
+#endif
+#ifdef EE_LOG_ENABLE
+static uint16_t EE_LogRecover(ee_handle_t* Handle);
+static uint16_t EE_LogAdvance(ee_handle_t* Handle);
+static uint16_t EE_LogReclaim(ee_handle_t* Handle);
+static uint16_t EE_LogOldestPage(ee_handle_t* Handle);
+static uint16_t EE_LogPreviousPage(ee_handle_t* Handle, uint16_t Page);
+#ifdef EE_INDEX_ENABLE
+static uint16_t EE_LogNextPage(ee_handle_t* Handle, uint16_t Page);
+#endif
+#endif
+#ifdef EE_MAINTENANCE_ENABLE
+static uint16_t EE_RunMaintenance(ee_handle_t* Handle, uint16_t* Work);
+#endif
+#ifdef EE_INCREMENTAL_ENABLE
+static uint16_t EE_TransferBegin(ee_handle_t* Handle);
+static void EE_TransferTrack(ee_handle_t* Handle, uint16_t OldPage);
+static uint16_t EE_TransferStep(ee_handle_t* Handle, uint16_t* Budget, bool Erase);
+#endif
+#if defined(EE_LOG_ENABLE) || defined(EE_INCREMENTAL_ENABLE)
+static uint16_t EE_OlderPage(ee_handle_t* Handle, uint16_t Page);
+#endif
+#ifdef EE_WRITEBACK_ENABLE
+static bool EE_CacheVariable(ee_handle_t* Handle, ee_data_t VirtAddress, ee_data_t Data);
+#endif
+static uint16_t EE_WriteVars(ee_handle_t* Handle, const ee_var_t* Vars, uint16_t Count);
+static uint16_t EE_FlushCache(ee_handle_t* Handle);
+#ifdef EE_ISR_RING_ENABLE
+static bool EE_ISRLookup(ee_handle_t* Handle, ee_data_t VirtAddress, ee_data_t* Data);
+#endif
+#ifdef EE_ISR_READ_ENABLE
+static void EE_PublishVariable(ee_handle_t* Handle, ee_data_t VirtAddress, ee_data_t Data);
+static void EE_PublishAll(ee_handle_t* Handle);
+#endif
+#ifdef EE_RAMFUNC_ENABLE
+static EE_RAMFUNC FLASH_Status EE_RamWait(void);
+#ifdef EE_LOWPOWER_ENABLE
+static EE_RAMFUNC FLASH_Status EE_RamSleep(void);
+#endif
+static EE_RAMFUNC FLASH_Status EE_RamProgram(uint32_t Address, uint32_t Data, uint16_t HalfWords);
+static EE_RAMFUNC FLASH_Status EE_RamErasePage(uint32_t PageAddress);
+#endif
+static uint16_t EE_ReadVars(ee_handle_t* Handle, const ee_data_t* VirtAddress, ee_data_t* Data, uint8_t* Found, uint16_t Count);
+static void EE_ReadStoredVariables(ee_handle_t* Handle, const ee_data_t* VirtAddress, ee_data_t* Data, uint8_t* Found, uint16_t Count);
+#ifdef EE_CRC_ENABLE
+static uint32_t EE_RecordCrc(ee_data_t VirtAddress, ee_data_t Data);
+static bool EE_RecordCheck(ee_handle_t* Handle, uint32_t Address);
+static FLASH_Status EE_SealPage(ee_handle_t* Handle, uint16_t Page);
+static void EE_SealCheck(ee_handle_t* Handle, uint16_t Page);
+#endif
+#ifdef EE_ASYNC_ENABLE
+static bool EE_AsyncLookup(ee_handle_t* Handle, ee_data_t VirtAddress, ee_data_t* Data);
+static void EE_AsyncAdvance(void);
+static void EE_AsyncProgram(uint32_t Address, ee_data_t Data, ee_async_state_t State);
+static void EE_AsyncProgramHalfWord(uint32_t Address, uint16_t Data, ee_async_state_t State);
+static void EE_AsyncComplete(uint16_t Status);
+#endif
+#ifdef EE_RTOS_ENABLE
+static bool EE_IndexRead(ee_handle_t* Handle, ee_data_t VirtAddress, ee_data_t* Data);
+static FLASH_Status EE_FlashProgram(uint32_t Address, uint32_t Data, uint16_t HalfWords);
+static FLASH_Status EE_FlashErasePage(uint32_t PageAddress);
+static FLASH_Status EE_FlashStart(void);
+static FLASH_Status EE_FlashSleep(void);
+#endif
+#ifdef EE_SERVICE_ENABLE
+static void EE_ServiceThread(void const* Argument);
+static void EE_ServiceBatch(ee_service_req_t* First);
+static void EE_ServiceWrites(ee_service_req_t** Reqs, const uint16_t* Owner, uint8_t* State, uint16_t Count);
+static bool EE_ServiceIdle(void);
+#endif
 
 
 /**
   * @brief  Restore the pages to a known good state in case of page's status
   *   corruption after a power loss.
-  * @param  None.
+  * @note   With EE_MULT_ENABLE, each instance is initialized on its own and its 
+  *   alloc member must point to its allocation, e.g. one of EmulatedChips.
+  * @note   The variable table is sorted here for the lookups, its virtual 
+  *   addresses must not change afterwards.
+  * @note   Pages written by the library before the page header held a 
+  *   generation are migrated here, their variables are copied to a page of 
+  *   the current format.
+  * @note   With EE_RTOS_ENABLE, EE_RtosInit() must be called first.
+  * @param  Handle: EEPROM instance, only when EE_MULT_ENABLE is defined
+  * @retval - Flash error code: on write Flash error
+  *         - ALLOC_TOO_LARGE: with EE_INDEX_ENABLE, if the allocation holds 
+  *           more records than the index entries can number
+  *         - NO_RTOS: with EE_RTOS_ENABLE, if EE_RtosInit() did not succeed
+  *         - FLASH_COMPLETE: on success
+  */
+ee_status_t EE_Init(EE_HANDLE_ONLY)
+{
+  uint16_t EepromStatus;
+
+  assert_param((Handle->alloc->page_num >= PAGE_NUM_MIN) && (Handle->alloc->page_num < NO_VALID_PAGE));
+  assert_param(Handle->alloc->var_num <= EE_VAR_MAX);
+
+#ifdef EE_INDEX_ENABLE
+  /* The allocations other than the default one are only known here */
+  if (!EE_INDEX_FITS(Handle->alloc->page_num))
+  {
+    return (ee_status_t) ALLOC_TOO_LARGE;
+  }
+#endif
+
+#ifdef EE_ASYNC_ENABLE
+  /* Let the asynchronous engine complete the queued requests */
+  while (EE_Busy())
+  {
+  }
+#endif
+
+#ifdef EE_RTOS_ENABLE
+  if (EepromFlashDone == (osSemaphoreId)0)
+  {
+    return (ee_status_t) NO_RTOS;
+  }
+#endif
+
+#ifdef EE_CRC_ENABLE
+  RCC_AHBPeriphClockCmd(RCC_AHBPeriph_CRC, ENABLE);
+#endif
+
+  EE_LOCK();
+  EE_SortVarTable(Handle);
+  EepromStatus = EE_RecoverPages(Handle);
+#ifdef EE_ISR_READ_ENABLE
+  if (EepromStatus == FLASH_COMPLETE)
+  {
+    EE_PublishAll(Handle);
+  }
+#endif
+  EE_UNLOCK();
+
+  return (ee_status_t) EepromStatus;
+}
+
+/**
+  * @brief  Restore the pages to a known good state, see EE_Init().
+  * @param  Handle: EEPROM instance
   * @retval - Flash error code: on write Flash error
   *         - FLASH_COMPLETE: on success
   */
-ee_status_t EE_Init(void)
+static uint16_t EE_RecoverPages(ee_handle_t* Handle)
 {
-  uint16_t VarIdx = 0;
-  uint16_t EepromStatus = 0, ReadStatus = 0;
-  int16_t x = -1;
+  uint16_t EepromStatus = 0;
+#ifndef EE_LOG_ENABLE
   uint16_t  FlashStatus;
  
-  uint16_t page_idx;  
-  ee_page_status_t page_status[PAGE_NUM];
-  uint16_t current_page = NO_VALID_PAGE;
-  uint16_t next_page = NO_VALID_PAGE; 
-  bool is_pages_invalid = false;
+  uint16_t current_page;
+  uint16_t next_page;
+#endif
 
+  /* Do not trust the cached state until the pages are recovered */
+  Handle->read_page = NO_VALID_PAGE;
+  Handle->write_page = NO_VALID_PAGE;
 
-  /* Set initial status value */
-  for(page_idx = 0; page_idx < PAGE_NUM; page_idx++)
+  /* Pages written before the page header are moved to a page of the current format */
+  EepromStatus = EE_LegacyMigrate(Handle);
+  if (EepromStatus != FLASH_COMPLETE)
   {
-    page_status[page_idx] = PAGE_UNKNOWN;
+    return EepromStatus;
   }
-  
-  /* Read all pages' status */
-  for(page_idx = 0; page_idx < PAGE_NUM; page_idx++)
+
+#ifdef EE_LOG_ENABLE
+  /* The committed pages form the ring, the other ones are erased */
+  EepromStatus = EE_LogRecover(Handle);
+  if (EepromStatus != FLASH_COMPLETE)
   {
-    page_status[page_idx] = (*(__IO uint16_t*)PAGE_BASE_ADDRESS(page_idx));
+    return EepromStatus;
   }
+#else
+  /* Single sweep of the page headers: the committed page of the newest generation 
+     holds the variables, a newer page being filled is an interrupted transfer */
+  EE_FindPages(Handle, &current_page, &next_page);
 
-  /* check the most possible valid page if existed, it is impossible more than 1 valid pages existed. */
-  /* try to find a valid page */
-  for(page_idx = 0; page_idx < PAGE_NUM; page_idx++)
+  if((current_page == NO_VALID_PAGE) && (next_page == NO_VALID_PAGE))
   {
-    if(page_status[page_idx] == VALID_PAGE)
+    // all pages are erased(or other unknown status value): erase all pages and set 
+    // the first page status to VALID_PAGE
+    FlashStatus = EE_Format(Handle, 0);                                
+    if (FlashStatus != FLASH_COMPLETE)
     {
-      if(current_page == NO_VALID_PAGE)
-      {
-        current_page = page_idx;
-      }
-      else
-      {
-        is_pages_invalid = true;                //more than 1 valid pages detected
-        break;
-      }
+      return FlashStatus;
     }
   }
-  
-  /* if no valid page found, try to find a page with RECEIVE_DATA */
-  if(!is_pages_invalid && current_page == NO_VALID_PAGE)
+  else if(current_page == NO_VALID_PAGE)
   {
-    for(page_idx = 0; page_idx < PAGE_NUM; page_idx++)
+    /* means only a page being filled is found, its transfer completed but the commit */
+    FlashStatus = EE_CommitPage(Handle, next_page);
+    if (FlashStatus != FLASH_COMPLETE)
     {
-      if(page_status[page_idx] == RECEIVE_DATA)
-      {
-        if(current_page == NO_VALID_PAGE)
-        {
-          current_page = page_idx;
-        }
-        else
-        {
-          is_pages_invalid = true;                //more than 1 RECEIVE_DATA pages detected
-          break;
-        }
-      }
+      return FlashStatus;
+    }
+    
+    /* Erase the other pages unless they are blank */
+    FlashStatus = EE_EraseOtherPages(Handle, next_page);
+    /* If erase operation was failed, a Flash error code is returned */
+    if (FlashStatus != FLASH_COMPLETE)
+    {
+      return FlashStatus;
     }
   }
-
-
-  /* if page statuses are invalid (unexpected number of VALID_PAGE or RECEIVE_DATA detected) or 
-     all pages are erased(or other unknown status value) */
-  if(is_pages_invalid || current_page == NO_VALID_PAGE)
+  else if(next_page != NO_VALID_PAGE)
   {
-    // select initial valid page
-    if(is_pages_invalid)
+    // use current page as VALID_PAGE, transfer the last updated vars from current page to 
+    // next page, and then commit next page and erase the other pages
+    
+    /* Resume appending to the next page after the records already transferred */
+    EE_LoadState(Handle);
+    
+    /* Transfer data from current valid page to next page, the variables already in 
+       next page (the one that triggered the transfer first) are not copied again */
+    EepromStatus = EE_TransferVariables(Handle, current_page);
+    
+    /* The records cut by power losses, e.g. a blob written to next page before 
+       the transfer, can leave too little room: transfer again to an erased page */
+    if (EepromStatus == PAGE_FULL)
+    {
+      FlashStatus = EE_ErasePage(Handle, next_page);
+      if (FlashStatus != FLASH_COMPLETE)
+      {
+        return FlashStatus;
+      }
+      
+      EE_LoadState(Handle);
+      EepromStatus = EE_PageTransferStart(Handle);
+      if (EepromStatus == FLASH_COMPLETE)
+      {
+        next_page = Handle->write_page;
+        EepromStatus = EE_TransferVariables(Handle, current_page);
+      }
+    }
+    if (EepromStatus != FLASH_COMPLETE)
     {
-      current_page = page_idx;                    // last data operation position
+      return EepromStatus;
     }
-    else
+    
+    /* The newer generation wins once committed, so the current page is erased last */
+    FlashStatus = EE_CommitPage(Handle, next_page);
+    if (FlashStatus != FLASH_COMPLETE)
     {
-      current_page = PAGE0;                       // default:set PAGE0 as VALID_PAGE
+      return FlashStatus;
     }
     
-    // erase all pages and set current_page status to VALID_PAGE
-    FlashStatus = EE_Format(current_page);                                
+    FlashStatus = EE_EraseOtherPages(Handle, next_page);
+    /* If erase operation was failed, a Flash error code is returned */
     if (FlashStatus != FLASH_COMPLETE)
     {
       return FlashStatus;
@@ -153,441 +706,4533 @@ ee_status_t EE_Init(void)
   }
   else
   {
-    uint16_t current_page_status = (uint16_t)page_status[current_page];
-    next_page = (current_page + 1) % PAGE_NUM;
+    // erase the other pages unless they are blank already and use current page as VALID_PAGE, 
+    // this drops an older committed page left by a reset before its erase
+    FlashStatus = EE_EraseOtherPages(Handle, current_page);
+    /* If erase operation was failed, a Flash error code is returned */
+    if (FlashStatus != FLASH_COMPLETE)
+    {
+      return FlashStatus;
+    }
+  }
+#endif
+
+  /* Pages are in a known good state now, cache it */
+  EE_LoadState(Handle);
     
-    switch(current_page_status){
-      case ERASED:        
-        // not possible, this situation should be processed as all pages erased before
-        break;
-      case RECEIVE_DATA:  
-        /* means only 1 page indicates RECEIVE_DATA, all others are ERASED. */
-        
-        /* Mark current page as valid */
-        FlashStatus = FLASH_ProgramHalfWord(PAGE_BASE_ADDRESS(current_page), VALID_PAGE);
-        if (FlashStatus != FLASH_COMPLETE)
-        {
-          return FlashStatus;
-        }
-        
-        /* Erase next page */
-        FlashStatus = FLASH_ErasePage(PAGE_BASE_ADDRESS(next_page));
-        /* If erase operation was failed, a Flash error code is returned */
-        if (FlashStatus != FLASH_COMPLETE)
-        {
-          return FlashStatus;
-        }
-        break;
-        
-      case VALID_PAGE:    
-        /* means only 1 valid page found, it may has a next page with RECEIVE_DATA or ERASED status */
-        
-        if(page_status[next_page] == RECEIVE_DATA)
-        {
-          // use current page as VALID_PAGE, transfer the last updated vars from current page to 
-          // next page, and then mark next page as VALID_PAGE and erase current page
-          
-          /* Transfer data from current valid page to next page */
-          for (VarIdx = 0; VarIdx < NB_OF_VAR; VarIdx++)
-          {
-            if (( *(__IO uint16_t*)(PAGE_BASE_ADDRESS(next_page) + 6)) == VirtAddVarTab[VarIdx])
-            {
-              x = VarIdx;
-            }
-            if (VarIdx != x)
-            {
-              /* Read the last variables' updates */  
-              ReadStatus = EE_ReadVariable(VirtAddVarTab[VarIdx], &DataVar);
-              /* In case variable corresponding to the virtual address was found */
-              if (ReadStatus != 0x1)
-              {
-                /* Transfer the variable to the next page */
-                EepromStatus = EE_VerifyPageFullWriteVariable(VirtAddVarTab[VarIdx], DataVar);
-                if (EepromStatus != FLASH_COMPLETE)
-                {
-                  return EepromStatus;
-                }
-              }
-            }
-          }
-          /* transfer finished */
-          
-          
-          /* Mark before erase may leave 2 valid pages if power down happened here, so we change the order*/
-          /* Erase current page */
-          FlashStatus = FLASH_ErasePage(PAGE_BASE_ADDRESS(current_page));
-          /* If erase operation was failed, a Flash error code is returned */
-          if (FlashStatus != FLASH_COMPLETE)
-          {
-            return FlashStatus;
-          }
-          
-          /* Mark next page as valid */
-          FlashStatus = FLASH_ProgramHalfWord(PAGE_BASE_ADDRESS(next_page), VALID_PAGE);
-          /* If program operation was failed, a Flash error code is returned */
-          if (FlashStatus != FLASH_COMPLETE)
-          {
-            return FlashStatus;
-          }
-        }
-        else if(page_status[next_page] == ERASED)
-        {
-          // erase next page and use current page as VALID_PAGE
-          // FIXME: why erase an ERASED page? Can we read the memory first to verify if it has bee full erased before erasing?
-          FlashStatus = FLASH_ErasePage(PAGE_BASE_ADDRESS(next_page));
-          /* If erase operation was failed, a Flash error code is returned */
-          if (FlashStatus != FLASH_COMPLETE)
-          {
-            return FlashStatus;
-          }
-        }
-        break;
-      default:
-        break;
+  return FLASH_COMPLETE;
+}
+
+/**
+  * @brief  Returns the last stored variable data, if found, which correspond to
+  *   the passed virtual address
+  * @param  Handle: EEPROM instance, only when EE_MULT_ENABLE is defined
+  * @param  VirtAddress: Variable virtual address
+  * @param  Data: Global variable contains the read variable value
+  * @retval Success or error status:
+  *           - 0: if variable was found
+  *           - 1: if the variable was not found
+  *           - NO_VALID_PAGE: if no valid page was found.
+  */
+ee_status_t EE_ReadVariable(EE_HANDLE_FIRST ee_data_t VirtAddress, ee_data_t* Data)
+{
+#if defined(EE_ASYNC_ENABLE) || defined(EE_RTOS_ENABLE)
+  uint16_t ReadStatus;
+#endif
+#ifdef EE_ASYNC_ENABLE
+  uint32_t PriMask;
+  uint16_t Switches;
+  bool Queued;
+#endif
+#ifdef EE_WRITEBACK_ENABLE
+  int16_t VarIdx = EE_GetVarIndex(Handle, VirtAddress);
+#endif
+
+#ifdef EE_ISR_RING_ENABLE
+  /* Values queued by the interrupts are the newest */
+  if (EE_ISRLookup(Handle, VirtAddress, Data))
+  {
+    return 0;
+  }
+#endif
+
+#ifdef EE_WRITEBACK_ENABLE
+  /* Values not flushed yet are newer than the Flash */
+  if ((VarIdx >= 0) && VAR_BIT_TEST(Handle->cache_dirty, VarIdx))
+  {
+    *Data = Handle->cache_data[VarIdx];
+    return 0;
+  }
+#endif
+
+#ifdef EE_ASYNC_ENABLE
+  /* Queued values are newer than the Flash. The page is scanned with the 
+     interrupts enabled, again if the engine switched pages meanwhile */
+  do
+  {
+    Switches = AsyncSwitches;
+    PriMask = __get_PRIMASK();
+    __disable_irq();
+    Queued = EE_AsyncLookup(Handle, VirtAddress, Data);
+    if (!Queued && (Handle->read_page == NO_VALID_PAGE))
+    {
+      EE_LoadState(Handle);
+    }
+    __set_PRIMASK(PriMask);
+    
+    ReadStatus = Queued ? 0 : EE_ReadStoredVariable(Handle, VirtAddress, Data);
+  } while (Switches != AsyncSwitches);
+  
+  return (ee_status_t) ReadStatus;
+#elif defined(EE_RTOS_ENABLE)
+  /* The index is read without the lock, the scans need the pages to hold still */
+  if (EE_IndexRead(Handle, VirtAddress, Data))
+  {
+    return (ee_status_t) 0;
+  }
+  
+  EE_LOCK();
+  ReadStatus = EE_ReadStoredVariable(Handle, VirtAddress, Data);
+  EE_UNLOCK();
+  
+  return (ee_status_t) ReadStatus;
+#else
+  return (ee_status_t) EE_ReadStoredVariable(Handle, VirtAddress, Data);
+#endif
+}
+
+/**
+  * @brief  Returns the last variable data stored in Flash, ignoring the 
+  *   write-back cache, see EE_ReadVariable().
+  * @param  Handle: EEPROM instance
+  * @param  VirtAddress: Variable virtual address
+  * @param  Data: Receives the value of the variable when it is found
+  * @retval Success or error status:
+  *           - 0: if variable was found
+  *           - 1: if the variable was not found
+  *           - NO_VALID_PAGE: if no valid page was found.
+  */
+static uint16_t EE_ReadStoredVariable(ee_handle_t* Handle, ee_data_t VirtAddress, ee_data_t* Data)
+{
+  uint16_t ValidPage = NO_VALID_PAGE;
+  ee_data_t AddressValue = 0x5555;
+  uint16_t ReadStatus = 1;
+  uint32_t PageStartAddress = EE_PAGE_BASE(Handle, 0);
+  uint32_t Address = EE_PAGE_END(Handle, 0) + 1 - EE_DATA_SIZE;
+#ifdef EE_INDEX_ENABLE
+  int16_t VarIdx = EE_GetVarIndex(Handle, VirtAddress);
+#endif
+  
+  /* Get active Page for read operation */
+  if (Handle->read_page == NO_VALID_PAGE)
+  {
+    EE_LoadState(Handle);
+  }
+  ValidPage = Handle->read_page;
+
+  /* Check if there is no valid page */
+  if (ValidPage == NO_VALID_PAGE)
+  {
+    return  NO_VALID_PAGE;
+  }
+
+#ifdef EE_INDEX_ENABLE
+  /* Variables of the variable table are resolved from the index without scanning */
+  if (VarIdx >= 0)
+  {
+    if (Handle->index_offset[VarIdx] == 0)
+    {
+      return ReadStatus;
+    }
+    
+    *Data = EE_READ_DATA(EE_INDEX_ADDRESS(Handle, Handle->index_offset[VarIdx]));
+    return 0;
+  }
+#endif
+
+#if defined(EE_LOG_ENABLE) || defined(EE_INCREMENTAL_ENABLE)
+  /* Walk the pages from the one holding the newest records until the variable is found */
+  for (ValidPage = Handle->write_page; (ReadStatus != 0) && (ValidPage != NO_VALID_PAGE); ValidPage = EE_OlderPage(Handle, ValidPage))
+#endif
+  {
+    /* Get the valid Page start Address */
+    PageStartAddress = EE_PAGE_BASE(Handle, ValidPage);
+    /* Get the valid Page end Address, the scan starts from the newest record */
+    if (ValidPage == Handle->write_page)
+    {
+      Address = Handle->write_address - EE_RECORD_SIZE + EE_DATA_SIZE;
+    }
+    else
+    {
+      Address = EE_PAGE_END(Handle, ValidPage) + 1 - EE_RECORD_SIZE + EE_DATA_SIZE;
+    }
+    
+    /* Check each active page address starting from end */
+    while (Address > (PageStartAddress + EE_HEADER_SIZE - EE_DATA_SIZE))
+    {
+      /* Get the current location content to be compared with virtual address */
+      AddressValue = EE_READ_DATA(Address);
+
+      /* Compare the read address with the virtual address */
+      if ((AddressValue == VirtAddress) && EE_RECORD_VALID(Handle, Address - EE_DATA_SIZE))
+      {
+        /* Get content of Address-2 which is variable value */
+        *Data = EE_READ_DATA(Address - EE_DATA_SIZE);
+
+        /* In case variable value is read, reset ReadStatus flag */
+        ReadStatus = 0;
+
+        break;
+      }
+      else
+      {
+        /* Next address location */
+        Address = Address - EE_RECORD_SIZE;
+      }
+    }
+  }
+
+  /* Return ReadStatus value: (0: variable exist, 1: variable doesn't exist) */
+  return ReadStatus;
+}
+
+/**
+  * @brief  Returns the last stored data of several variables, resolved with a 
+  *   single backward pass over the valid page which stops as soon as every 
+  *   variable was found.
+  * @param  Handle: EEPROM instance, only when EE_MULT_ENABLE is defined
+  * @param  VirtAddress: Array of variable virtual addresses
+  * @param  Data: Array receiving the value of each variable found
+  * @param  Found: Array receiving 1 for each variable found, 0 otherwise
+  * @param  Count: Number of variables to read
+  * @retval Success or error status:
+  *           - 0: if all the variables were found
+  *           - 1: if at least one variable was not found
+  *           - NO_VALID_PAGE: if no valid page was found.
+  */
+ee_status_t EE_ReadVariables(EE_HANDLE_FIRST const ee_data_t* VirtAddress, ee_data_t* Data, uint8_t* Found, uint16_t Count)
+{
+#ifdef EE_ASYNC_ENABLE
+  uint16_t ReadStatus;
+  uint16_t Switches;
+
+  /* The page is scanned with the interrupts enabled, again if the engine 
+     switched pages meanwhile */
+  do
+  {
+    Switches = AsyncSwitches;
+    ReadStatus = EE_ReadVars(Handle, VirtAddress, Data, Found, Count);
+  } while (Switches != AsyncSwitches);
+
+  return (ee_status_t) ReadStatus;
+#else
+  return (ee_status_t) EE_ReadVars(Handle, VirtAddress, Data, Found, Count);
+#endif
+}
+
+/**
+  * @brief  Returns the last data of several variables, see EE_ReadVariables().
+  * @param  Handle: EEPROM instance
+  * @param  VirtAddress: Array of variable virtual addresses
+  * @param  Data: Array receiving the value of each variable found
+  * @param  Found: Array receiving 1 for each variable found, 0 otherwise
+  * @param  Count: Number of variables to read
+  * @retval Success or error status, see EE_ReadVariables()
+  */
+static uint16_t EE_ReadVars(ee_handle_t* Handle, const ee_data_t* VirtAddress, ee_data_t* Data, uint8_t* Found, uint16_t Count)
+{
+  uint16_t Idx;
+#ifdef EE_ASYNC_ENABLE
+  uint32_t PriMask;
+#endif
+#ifdef EE_RTOS_ENABLE
+  uint16_t Pending = 0;
+#endif
+  
+  for (Idx = 0; Idx < Count; Idx++)
+  {
+    Found[Idx] = 0;
+#ifdef EE_ISR_RING_ENABLE
+    /* Values queued by the interrupts are the newest */
+    if (EE_ISRLookup(Handle, VirtAddress[Idx], &Data[Idx]))
+    {
+      Found[Idx] = 1;
+    }
+#endif
+#ifdef EE_WRITEBACK_ENABLE
+    /* Values not flushed yet are newer than the Flash */
+    {
+      int16_t VarIdx = EE_GetVarIndex(Handle, VirtAddress[Idx]);
+      if (!Found[Idx] && (VarIdx >= 0) && VAR_BIT_TEST(Handle->cache_dirty, VarIdx))
+      {
+        Data[Idx] = Handle->cache_data[VarIdx];
+        Found[Idx] = 1;
+      }
+    }
+#endif
+#ifdef EE_RTOS_ENABLE
+    /* The index is read without the lock */
+    if (!Found[Idx] && !EE_IndexRead(Handle, VirtAddress[Idx], &Data[Idx]))
+    {
+      Pending++;
+    }
+    else
+    {
+      Found[Idx] = 1;
+    }
+#endif
+  }
+  
+#ifdef EE_RTOS_ENABLE
+  if (Pending == 0)
+  {
+    return 0;
+  }
+#endif
+  
+  EE_LOCK();
+  
+#ifdef EE_ASYNC_ENABLE
+  /* Queued values are newer than the Flash, the engine must not move meanwhile */
+  PriMask = __get_PRIMASK();
+  __disable_irq();
+  for (Idx = 0; Idx < Count; Idx++)
+  {
+    if (!Found[Idx] && EE_AsyncLookup(Handle, VirtAddress[Idx], &Data[Idx]))
+    {
+      Found[Idx] = 1;
+    }
+  }
+#endif
+  
+  /* Get active Page for read operation */
+  if (Handle->read_page == NO_VALID_PAGE)
+  {
+    EE_LoadState(Handle);
+  }
+#ifdef EE_ASYNC_ENABLE
+  __set_PRIMASK(PriMask);
+#endif
+
+  /* Check if there is no valid page */
+  if (Handle->read_page == NO_VALID_PAGE)
+  {
+    EE_UNLOCK();
+    return  NO_VALID_PAGE;
+  }
+  
+  EE_ReadStoredVariables(Handle, VirtAddress, Data, Found, Count);
+  
+  EE_UNLOCK();
+  
+  /* Return 1 if any variable doesn't exist */
+  for (Idx = 0; Idx < Count; Idx++)
+  {
+    if (!Found[Idx])
+    {
+      return 1;
+    }
+  }
+  
+  return 0;
+}
+
+/**
+  * @brief  Resolves the variables not found yet from the valid page, with a 
+  *   single backward pass which stops as soon as every variable was found, 
+  *   see EE_ReadVariables().
+  * @param  Handle: EEPROM instance
+  * @param  VirtAddress: Array of variable virtual addresses
+  * @param  Data: Array receiving the value of each variable found
+  * @param  Found: Array of found flags, set for each variable found
+  * @param  Count: Number of variables to read
+  * @retval None
+  */
+static void EE_ReadStoredVariables(ee_handle_t* Handle, const ee_data_t* VirtAddress, ee_data_t* Data, uint8_t* Found, uint16_t Count)
+{
+  uint16_t ValidPage = Handle->read_page;
+  ee_data_t AddressValue;
+  uint16_t Pending = 0;
+  uint16_t Idx;
+  uint32_t PageStartAddress;
+  uint32_t Address;
+#ifdef EE_INDEX_ENABLE
+  int16_t VarIdx;
+#endif
+  
+  for (Idx = 0; Idx < Count; Idx++)
+  {
+    if (Found[Idx])
+    {
+      continue;
+    }
+#ifdef EE_INDEX_ENABLE
+    /* Variables of the variable table are resolved from the index without scanning */
+    VarIdx = EE_GetVarIndex(Handle, VirtAddress[Idx]);
+    if (VarIdx >= 0)
+    {
+      if (Handle->index_offset[VarIdx] != 0)
+      {
+        Data[Idx] = EE_READ_DATA(EE_INDEX_ADDRESS(Handle, Handle->index_offset[VarIdx]));
+        Found[Idx] = 1;
+      }
+      continue;
+    }
+#endif
+    Pending++;
+  }
+  
+#if defined(EE_LOG_ENABLE) || defined(EE_INCREMENTAL_ENABLE)
+  /* Walk the pages from the one holding the newest records until every variable is found */
+  for (ValidPage = Handle->write_page; (Pending > 0) && (ValidPage != NO_VALID_PAGE); ValidPage = EE_OlderPage(Handle, ValidPage))
+#endif
+  {
+    PageStartAddress = EE_PAGE_BASE(Handle, ValidPage);
+    /* Get the valid Page end Address, the scan starts from the newest record */
+    if (ValidPage == Handle->write_page)
+    {
+      Address = Handle->write_address - EE_RECORD_SIZE + EE_DATA_SIZE;
+    }
+    else
+    {
+      Address = EE_PAGE_END(Handle, ValidPage) + 1 - EE_RECORD_SIZE + EE_DATA_SIZE;
+    }
+    
+    /* Check each active page address starting from end */
+    while ((Pending > 0) && (Address > (PageStartAddress + EE_HEADER_SIZE - EE_DATA_SIZE)))
+    {
+      AddressValue = EE_READ_DATA(Address);
+      
+      /* The newest record satisfies every request of that address */
+      for (Idx = 0; Idx < Count; Idx++)
+      {
+        if (!Found[Idx] && (VirtAddress[Idx] == AddressValue) && EE_RECORD_VALID(Handle, Address - EE_DATA_SIZE))
+        {
+          Data[Idx] = EE_READ_DATA(Address - EE_DATA_SIZE);
+          Found[Idx] = 1;
+          Pending--;
+        }
+      }
+      
+      Address = Address - EE_RECORD_SIZE;
+    }
+  }
+}
+
+/**
+  * @brief  Writes/upadtes variable data in EEPROM.
+  * @param  Handle: EEPROM instance, only when EE_MULT_ENABLE is defined
+  * @param  VirtAddress: Variable virtual address
+  * @param  Data: data to be written
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success
+  *           - PAGE_FULL: if valid page is full
+  *           - NO_VALID_PAGE: if no valid page was found
+  *           - Flash error code: on write Flash error
+  */
+ee_status_t EE_WriteVariable(EE_HANDLE_FIRST ee_data_t VirtAddress, ee_data_t Data)
+{
+  ee_var_t Var;
+  uint16_t Status;
+
+#ifdef EE_ISR_RING_ENABLE
+  /* The writes queued by the interrupts are older */
+  Status = EE_DrainISRWrites(EE_HANDLE_ARG);
+  if (Status != FLASH_COMPLETE)
+  {
+    return (ee_status_t) Status;
+  }
+#endif
+
+#ifdef EE_WRITEBACK_ENABLE
+  /* Variables of the variable table reach the Flash when the cache is flushed */
+  EE_LOCK();
+  if (EE_CacheVariable(Handle, VirtAddress, Data))
+  {
+    EE_UNLOCK();
+    return EE_FlushIfDue(EE_HANDLE_ARG);
+  }
+  EE_UNLOCK();
+#endif
+
+  /* Write the variable virtual address and value in the EEPROM */
+  Var.addr = VirtAddress;
+  Var.data = Data;
+  EE_LOCK();
+  Status = EE_WriteBatch(Handle, &Var, 1);
+  EE_UNLOCK();
+  
+  return (ee_status_t) Status;
+}
+
+/**
+  * @brief  Writes/updates several variables in EEPROM. The records are appended 
+  *   back to back from the cached write position; if the page fills up, a 
+  *   single page transfer writes the remaining variables to the new page first 
+  *   so that the old values of those are not transferred.
+  * @note   When an address appears more than once, only its last value is written.
+  * @param  Handle: EEPROM instance, only when EE_MULT_ENABLE is defined
+  * @param  Vars: Array of virtual address and data pairs
+  * @param  Count: Number of pairs
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success
+  *           - PAGE_FULL: if valid page is full
+  *           - NO_VALID_PAGE: if no valid page was found
+  *           - Flash error code: on write Flash error
+  */
+ee_status_t EE_WriteVariables(EE_HANDLE_FIRST const ee_var_t* Vars, uint16_t Count)
+{
+  uint16_t Status;
+
+#ifdef EE_ISR_RING_ENABLE
+  /* The writes queued by the interrupts are older */
+  Status = EE_DrainISRWrites(EE_HANDLE_ARG);
+  if (Status != FLASH_COMPLETE)
+  {
+    return (ee_status_t) Status;
+  }
+#endif
+
+  EE_LOCK();
+  Status = EE_WriteVars(Handle, Vars, Count);
+  EE_UNLOCK();
+
+  return (ee_status_t) Status;
+}
+
+/**
+  * @brief  Writes/updates several variables, through the write-back cache 
+  *   when enabled, see EE_WriteVariables(). The caller holds the lock.
+  * @param  Handle: EEPROM instance
+  * @param  Vars: Array of virtual address and data pairs
+  * @param  Count: Number of pairs
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success
+  *           - PAGE_FULL: if valid page is full
+  *           - NO_VALID_PAGE: if no valid page was found
+  *           - Flash error code: on write Flash error
+  */
+static uint16_t EE_WriteVars(ee_handle_t* Handle, const ee_var_t* Vars, uint16_t Count)
+{
+  uint16_t Status = FLASH_COMPLETE;
+#ifdef EE_WRITEBACK_ENABLE
+  uint16_t Idx;
+
+  /* Variables of the variable table reach the Flash when the cache is flushed */
+  for (Idx = 0; (Idx < Count) && (Status == FLASH_COMPLETE); Idx++)
+  {
+    if (!EE_CacheVariable(Handle, Vars[Idx].addr, Vars[Idx].data))
+    {
+      Status = EE_WriteBatch(Handle, &Vars[Idx], 1);
+    }
+  }
+  
+  if (Status != FLASH_COMPLETE)
+  {
+    return Status;
+  }
+  
+  return EE_FlushIfDue(EE_HANDLE_ARG);
+#else
+  Status = EE_WriteBatch(Handle, Vars, Count);
+  
+  return Status;
+#endif
+}
+
+/**
+  * @brief  Writes all the variables of the write-back cache not yet in Flash, 
+  *   and the ones queued by EE_WriteVariableFromISR() before them. Must be 
+  *   called before a reset or power down when the write-back cache or the 
+  *   ring of the interrupts is enabled, does nothing otherwise.
+  * @param  Handle: EEPROM instance, only when EE_MULT_ENABLE is defined
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success
+  *           - PAGE_FULL: if valid page is full
+  *           - NO_VALID_PAGE: if no valid page was found
+  *           - Flash error code: on write Flash error
+  */
+ee_status_t EE_Flush(EE_HANDLE_ONLY)
+{
+#ifdef EE_ISR_RING_ENABLE
+  uint16_t Status;
+
+  /* The writes queued by the interrupts are older, they may go to the cache */
+  Status = EE_DrainISRWrites(EE_HANDLE_ARG);
+  if (Status != FLASH_COMPLETE)
+  {
+    return (ee_status_t) Status;
+  }
+#endif
+
+  return (ee_status_t) EE_FlushCache(Handle);
+}
+
+/**
+  * @brief  Writes all the variables of the write-back cache not yet in Flash.
+  * @param  Handle: EEPROM instance
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success
+  *           - PAGE_FULL: if valid page is full
+  *           - NO_VALID_PAGE: if no valid page was found
+  *           - Flash error code: on write Flash error
+  */
+static uint16_t EE_FlushCache(ee_handle_t* Handle)
+{
+#ifdef EE_WRITEBACK_ENABLE
+  ee_var_t Vars[EE_VAR_MAX];
+  uint16_t Count = 0;
+  uint16_t Status;
+  int16_t VarIdx;
+  
+  if (Handle->cache_dirty_count == 0)
+  {
+    return (ee_status_t) FLASH_COMPLETE;
+  }
+  
+  /* The entries written meanwhile by another thread must not be cleared unwritten */
+  EE_LOCK();
+  for (VarIdx = 0; VarIdx < Handle->alloc->var_num; VarIdx++)
+  {
+    if (VAR_BIT_TEST(Handle->cache_dirty, VarIdx))
+    {
+      Vars[Count].addr = Handle->alloc->var_addr_tab[VarIdx];
+      Vars[Count].data = Handle->cache_data[VarIdx];
+      Count++;
+    }
+  }
+  
+  /* Entries stay dirty if the write failed, a retry writes them again */
+  Status = EE_WriteBatch(Handle, Vars, Count);
+  if (Status == FLASH_COMPLETE)
+  {
+    for (VarIdx = 0; VarIdx < VAR_BITMAP_SIZE; VarIdx++)
+    {
+      Handle->cache_dirty[VarIdx] = 0;
+    }
+    Handle->cache_dirty_count = 0;
+  }
+  EE_UNLOCK();
+  
+  return Status;
+#else
+  return FLASH_COMPLETE;
+#endif
+}
+
+/**
+  * @brief  Flushes the write-back cache if the dirty-count or the age threshold 
+  *   is reached. Called after each cached write, the application should also 
+  *   call it periodically for the age threshold to apply without writes.
+  * @param  Handle: EEPROM instance, only when EE_MULT_ENABLE is defined
+  * @retval Success or error status of the flush, FLASH_COMPLETE if not due
+  */
+ee_status_t EE_FlushIfDue(EE_HANDLE_ONLY)
+{
+#ifdef EE_WRITEBACK_ENABLE
+  if (Handle->cache_dirty_count >= EE_WRITEBACK_MAX_DIRTY)
+  {
+    return (ee_status_t) EE_FlushCache(Handle);
+  }
+#ifdef EE_GET_TICK
+  if ((Handle->cache_dirty_count > 0) && ((uint32_t)(EE_GET_TICK() - Handle->cache_dirty_since) >= EE_WRITEBACK_MAX_AGE))
+  {
+    return (ee_status_t) EE_FlushCache(Handle);
+  }
+#endif
+#endif
+  return (ee_status_t) FLASH_COMPLETE;
+}
+
+#ifdef EE_ISR_RING_ENABLE
+/**
+  * @brief  Queues a variable write from an interrupt, in a ring of the instance 
+  *   which is neither locked nor guarded by interrupt masking: the interrupt 
+  *   only moves the head, EE_DrainISRWrites() only moves the tail. The reads 
+  *   return the queued value until it is written.
+  * @note   The ring has a single producer, the writes must all come from the 
+  *   same interrupt priority level.
+  * @param  Handle: EEPROM instance, only when EE_MULT_ENABLE is defined
+  * @param  VirtAddress: Variable virtual address
+  * @param  Data: data to be written
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success
+  *           - QUEUE_FULL: if EE_ISR_RING_SIZE - 1 writes are queued already
+  */
+ee_status_t EE_WriteVariableFromISR(EE_HANDLE_FIRST ee_data_t VirtAddress, ee_data_t Data)
+{
+  uint16_t Head = Handle->isr_head;
+  uint16_t Next = (Head + 1) % EE_ISR_RING_SIZE;
+
+  if (Next == Handle->isr_tail)
+  {
+    return (ee_status_t) QUEUE_FULL;
+  }
+
+  /* Single core: the volatile accesses keep their order, the entry is 
+     complete before the head publishes it */
+  Handle->isr_ring[Head].addr = VirtAddress;
+  Handle->isr_ring[Head].data = Data;
+  Handle->isr_head = Next;
+
+  return (ee_status_t) FLASH_COMPLETE;
+}
+
+/**
+  * @brief  Writes the variables queued by EE_WriteVariableFromISR() in a single 
+  *   batch, to be called from thread context. The writes also drain the ring 
+  *   first, so the values queued by the interrupts do not override newer ones.
+  * @param  Handle: EEPROM instance, only when EE_MULT_ENABLE is defined
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success
+  *           - PAGE_FULL: if valid page is full
+  *           - NO_VALID_PAGE: if no valid page was found
+  *           - Flash error code: on write Flash error, the entries stay queued
+  */
+ee_status_t EE_DrainISRWrites(EE_HANDLE_ONLY)
+{
+  ee_var_t Vars[EE_ISR_RING_SIZE];
+  uint16_t Status = FLASH_COMPLETE;
+  uint16_t Count = 0;
+  uint16_t Head;
+  uint16_t Idx;
+
+  /* A single consumer at a time */
+  EE_LOCK();
+  Head = Handle->isr_head;
+  for (Idx = Handle->isr_tail; Idx != Head; Idx = (Idx + 1) % EE_ISR_RING_SIZE)
+  {
+    Vars[Count].addr = Handle->isr_ring[Idx].addr;
+    Vars[Count].data = Handle->isr_ring[Idx].data;
+    Count++;
+  }
+
+  if (Count > 0)
+  {
+    /* The entries are released once written, the reads find them meanwhile */
+    Status = EE_WriteVars(Handle, Vars, Count);
+    if (Status == FLASH_COMPLETE)
+    {
+      Handle->isr_tail = Head;
+    }
+  }
+  EE_UNLOCK();
+
+  return (ee_status_t) Status;
+}
+#endif
+
+#ifdef EE_ISR_READ_ENABLE
+/**
+  * @brief  Returns the newest value of a variable of the variable table from a 
+  *   RAM table of the instance, without locking, blocking or reading the 
+  *   Flash, so it may be called from any interrupt, also while a write or a 
+  *   page transfer is in progress.
+  * @note   The writers update the two copies of the table in turn and bump 
+  *   isr_seq before each, the read takes the copy isr_seq designates and is 
+  *   retried only if isr_seq changed meanwhile. An interrupt never waits for 
+  *   the thread it preempted.
+  * @param  Handle: EEPROM instance, only when EE_MULT_ENABLE is defined
+  * @param  VirtAddress: Variable virtual address
+  * @param  Data: Receives the value of the variable when it is found
+  * @retval Success or error status:
+  *           - 0: if variable was found
+  *           - 1: if the variable was not found or is not in the variable table
+  */
+ee_status_t EE_ReadVariableFromISR(EE_HANDLE_FIRST ee_data_t VirtAddress, ee_data_t* Data)
+{
+  int16_t VarIdx = EE_GetVarIndex(Handle, VirtAddress);
+  uint32_t Seq;
+
+#ifdef EE_ISR_RING_ENABLE
+  /* Values queued by the interrupts are the newest */
+  if (EE_ISRLookup(Handle, VirtAddress, Data))
+  {
+    return (ee_status_t) 0;
+  }
+#endif
+
+  if ((VarIdx < 0) || !VAR_BIT_TEST(Handle->isr_known, VarIdx))
+  {
+    return (ee_status_t) 1;
+  }
+
+  do
+  {
+    Seq = Handle->isr_seq;
+    *Data = Handle->isr_value[Seq & 1][VarIdx];
+  } while (Seq != Handle->isr_seq);
+
+  return (ee_status_t) 0;
+}
+#endif
+
+#ifdef EE_RAMFUNC_ENABLE
+/**
+  * @brief  Copies the vector table to the start of the SRAM and remaps the 
+  *   SRAM at address 0, so that the exception entries do not fetch the vectors 
+  *   from the Flash. To be called once at startup, with the interrupts disabled.
+  * @note   The Cortex-M0 has no VTOR, the remap is the only way to move the 
+  *   vector table. The interrupts which must keep running during a Flash 
+  *   program or erase are declared EE_RAMFUNC, and only access RAM and 
+  *   peripherals; the others stall until the operation ends.
+  * @param  None
+  * @retval None
+  */
+void EE_RelocateVectorTable(void)
+{
+  uint16_t Idx;
+
+  for (Idx = 0; Idx < EE_VECTOR_NUM; Idx++)
+  {
+    RamVectors[Idx] = *(__IO uint32_t*)(FLASH_BASE + ((uint32_t)Idx << 2));
+  }
+
+  RCC_APB2PeriphClockCmd(RCC_APB2Periph_SYSCFG, ENABLE);
+  SYSCFG_MemoryRemapConfig(SYSCFG_MemoryRemap_SRAM);
+}
+#endif
+
+#ifdef EE_ASYNC_ENABLE
+/**
+  * @brief  Queues a variable write for the asynchronous engine and returns. The 
+  *   engine is driven by the Flash EOP and ERR interrupts, so EE_FLASH_IRQHandler() 
+  *   must be called from FLASH_IRQHandler() and FLASH_IRQn enabled in the NVIC.
+  *   Page transfers are run by the engine as well. Until the write is complete, 
+  *   EE_ReadVariable() returns the queued value. With EE_SKIP_UNCHANGED_ENABLE, 
+  *   a write of the newest value is not queued, its callback is called before 
+  *   the return.
+  * @note   The synchronous writes and EE_Init() wait until the engine is idle, 
+  *   they must not be called from an interrupt while it is busy.
+  * @param  Handle: EEPROM instance, only when EE_MULT_ENABLE is defined
+  * @param  VirtAddress: Variable virtual address
+  * @param  Data: data to be written
+  * @param  Callback: called from the Flash interrupt with the write status once 
+  *   the write is complete, may be NULL
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success
+  *           - QUEUE_FULL: if EE_ASYNC_QUEUE_SIZE - 1 requests are queued already
+  */
+ee_status_t EE_WriteVariableAsync(EE_HANDLE_FIRST ee_data_t VirtAddress, ee_data_t Data, ee_callback_t Callback)
+{
+  uint16_t Next = (AsyncTail + 1) % EE_ASYNC_QUEUE_SIZE;
+  uint32_t PriMask;
+#ifdef EE_SKIP_UNCHANGED_ENABLE
+  ee_data_t StoredData;
+#endif
+#ifdef EE_WRITEBACK_ENABLE
+  int16_t VarIdx = EE_GetVarIndex(Handle, VirtAddress);
+#endif
+
+  if (Next == AsyncHead)
+  {
+    return (ee_status_t) QUEUE_FULL;
+  }
+
+  Handle->write_count++;
+
+#ifdef EE_SKIP_UNCHANGED_ENABLE
+  /* The newest value, queued, cached or stored, is already this one */
+  if ((EE_ReadVariable(EE_HANDLE_ARG_FIRST VirtAddress, &StoredData) == 0) && (StoredData == Data))
+  {
+    Handle->elided_count++;
+    if (Callback != 0)
+    {
+      Callback(VirtAddress, (ee_status_t) FLASH_COMPLETE);
+    }
+    return (ee_status_t) FLASH_COMPLETE;
+  }
+#endif
+
+#ifdef EE_WRITEBACK_ENABLE
+  /* The queued value supersedes the cached one */
+  if ((VarIdx >= 0) && VAR_BIT_TEST(Handle->cache_dirty, VarIdx))
+  {
+    Handle->cache_dirty[VarIdx / 8] &= ~(1 << (VarIdx % 8));
+    Handle->cache_dirty_count--;
+  }
+#endif
+
+  AsyncQueue[AsyncTail].handle = Handle;
+  AsyncQueue[AsyncTail].var.addr = VirtAddress;
+  AsyncQueue[AsyncTail].var.data = Data;
+  AsyncQueue[AsyncTail].callback = Callback;
+  AsyncTail = Next;
+
+  /* Start the engine unless the Flash interrupt is already driving it */
+  PriMask = __get_PRIMASK();
+  __disable_irq();
+  if (AsyncState == ASYNC_IDLE)
+  {
+    FLASH_ITConfig(FLASH_IT_EOP | FLASH_IT_ERR, ENABLE);
+    AsyncState = ASYNC_DISPATCH;
+    EE_AsyncAdvance();
+  }
+  __set_PRIMASK(PriMask);
+
+  return (ee_status_t) FLASH_COMPLETE;
+}
+
+/**
+  * @brief  Check whether the asynchronous engine has requests in progress
+  * @param  None
+  * @retval true while requests are queued
+  */
+bool EE_Busy(void)
+{
+  return (AsyncState != ASYNC_IDLE);
+}
+
+/**
+  * @brief  Advances the asynchronous engine, to be called from FLASH_IRQHandler()
+  * @param  None
+  * @retval None
+  */
+void EE_FLASH_IRQHandler(void)
+{
+  uint32_t FlashFlags = FLASH->SR;
+
+  /* Acknowledge the flags and end the programming or erase */
+  FLASH->SR = FLASH_SR_EOP | FLASH_SR_PGERR | FLASH_SR_WRPERR;
+  FLASH->CR &= ~(FLASH_CR_PG | FLASH_CR_PER);
+
+  if (AsyncState == ASYNC_IDLE)
+  {
+    return;
+  }
+
+  if (FlashFlags & (FLASH_SR_PGERR | FLASH_SR_WRPERR))
+  {
+    /* The pages may be left inconsistent, the next request reloads them from 
+       the headers. The page read from still holds every variable */
+    AsyncSwitches++;
+    AsyncQueue[AsyncHead].handle->write_page = NO_VALID_PAGE;
+    AsyncTransfer = false;
+#if (EE_DATA_32BIT == EE_DATA_WIDTH)
+    AsyncHighPending = false;
+#endif
+    EE_AsyncComplete((FlashFlags & FLASH_SR_WRPERR) ? FLASH_ERROR_WRP : FLASH_ERROR_PROGRAM);
+  }
+  else if (!(FlashFlags & FLASH_SR_EOP))
+  {
+    return;
+  }
+#if (EE_DATA_32BIT == EE_DATA_WIDTH)
+  else if (AsyncHighPending)
+  {
+    /* Words are programmed a halfword at a time */
+    AsyncHighPending = false;
+    FLASH->CR |= FLASH_CR_PG;
+    *(__IO uint16_t*)AsyncHighAddress = AsyncHighData;
+    return;
+  }
+#endif
+
+  EE_AsyncAdvance();
+}
+#endif
+
+#ifdef EE_RTOS_ENABLE
+/**
+  * @brief  Creates the mutex and the semaphore of the RTOS layer. To be called 
+  *   once, before EE_Init() and before the threads using the EEPROM start.
+  * @param  None
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success
+  *           - NO_RTOS: if the mutex or the semaphore could not be created
+  */
+ee_status_t EE_RtosInit(void)
+{
+  EepromMutex = osMutexCreate(osMutex(EepromMutex));
+  if (EepromMutex == (osMutexId)0)
+  {
+    return (ee_status_t) NO_RTOS;
+  }
+
+  EepromFlashDone = osSemaphoreCreate(osSemaphore(EepromFlashDone), 0);
+  if (EepromFlashDone == (osSemaphoreId)0)
+  {
+    return (ee_status_t) NO_RTOS;
+  }
+
+  return (ee_status_t) FLASH_COMPLETE;
+}
+
+/**
+  * @brief  Signals the end of a Flash operation to the thread waiting for it, 
+  *   to be called from FLASH_IRQHandler() with FLASH_IRQn enabled in the NVIC.
+  * @param  None
+  * @retval None
+  */
+void EE_FLASH_IRQHandler(void)
+{
+  uint32_t FlashFlags = FLASH->SR;
+
+  /* Acknowledge the flags and end the programming or erase */
+  FLASH->SR = FLASH_SR_EOP | FLASH_SR_PGERR | FLASH_SR_WRPERR;
+  FLASH->CR &= ~(FLASH_CR_PG | FLASH_CR_PER);
+
+  if (FlashFlags & FLASH_SR_WRPERR)
+  {
+    EepromFlashStatus = FLASH_ERROR_WRP;
+  }
+  else if (FlashFlags & FLASH_SR_PGERR)
+  {
+    EepromFlashStatus = FLASH_ERROR_PROGRAM;
+  }
+  else if (FlashFlags & FLASH_SR_EOP)
+  {
+    EepromFlashStatus = FLASH_COMPLETE;
+  }
+  else
+  {
+    return;
+  }
+
+  osSemaphoreRelease(EepromFlashDone);
+}
+#endif
+
+#ifdef EE_SERVICE_ENABLE
+osThreadDef(EE_ServiceThread, EE_SERVICE_THREAD_PRIORITY, 1, EE_SERVICE_STACK_SIZE);
+
+/**
+  * @brief  Starts the service thread, which owns the Flash from then on: the 
+  *   other threads submit their requests with EE_ServiceWrite() and 
+  *   EE_ServiceRead() and never wait for a Flash operation themselves.
+  * @note   To be called once, after EE_Init() of each instance.
+  * @param  None
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success
+  *           - NO_SERVICE: if the queue or the thread could not be created
+  */
+ee_status_t EE_ServiceStart(void)
+{
+  ServiceQueue = osMailCreate(osMailQ(EepromService), (osThreadId)0);
+  if (ServiceQueue == (osMailQId)0)
+  {
+    return (ee_status_t) NO_SERVICE;
+  }
+
+  if (osThreadCreate(osThread(EE_ServiceThread), (void*)0) == (osThreadId)0)
+  {
+    return (ee_status_t) NO_SERVICE;
+  }
+
+  return (ee_status_t) FLASH_COMPLETE;
+}
+
+/**
+  * @brief  Queues a variable write for the service thread and returns. The 
+  *   writes to the same address still queued are merged, only the last value 
+  *   reaches the Flash.
+  * @param  Handle: EEPROM instance, only when EE_MULT_ENABLE is defined
+  * @param  VirtAddress: Variable virtual address
+  * @param  Data: data to be written
+  * @param  Priority: EE_SERVICE_URGENT requests are served before the 
+  *   EE_SERVICE_NORMAL ones queued with them, the requests to a variable keep 
+  *   their queue order
+  * @param  Callback: called from the service thread with the write status once 
+  *   the write is complete, may be NULL
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success
+  *           - QUEUE_FULL: if EE_SERVICE_QUEUE_SIZE requests are queued already
+  *           - NO_SERVICE: if the service thread is not started
+  */
+ee_status_t EE_ServiceWrite(EE_HANDLE_FIRST ee_data_t VirtAddress, ee_data_t Data, uint8_t Priority, ee_callback_t Callback)
+{
+  ee_service_req_t* Req;
+
+  if (ServiceQueue == (osMailQId)0)
+  {
+    return (ee_status_t) NO_SERVICE;
+  }
+
+  Req = (ee_service_req_t*)osMailAlloc(ServiceQueue, 0);
+  if (Req == (ee_service_req_t*)0)
+  {
+    return (ee_status_t) QUEUE_FULL;
+  }
+
+#ifdef EE_MULT_ENABLE
+  Req->handle = Handle;
+#endif
+  Req->var.addr = VirtAddress;
+  Req->var.data = Data;
+  Req->priority = Priority;
+  Req->read = false;
+  Req->callback = Callback;
+  osMailPut(ServiceQueue, Req);
+
+  return (ee_status_t) FLASH_COMPLETE;
+}
+
+/**
+  * @brief  Reads a variable through the service thread, the calling thread 
+  *   waits for the answer on the EE_SERVICE_SIGNAL signal. The read sees the 
+  *   writes to the variable queued before it and none of the ones queued 
+  *   after it, whatever their priority.
+  * @param  Handle: EEPROM instance, only when EE_MULT_ENABLE is defined
+  * @param  VirtAddress: Variable virtual address
+  * @param  Data: receives the variable value
+  * @param  Priority: EE_SERVICE_URGENT or EE_SERVICE_NORMAL
+  * @retval Success or error status:
+  *           - 0: if variable was found
+  *           - 1: if the variable was not found
+  *           - NO_VALID_PAGE: if no valid page was found
+  *           - NO_SERVICE: if the service thread is not started
+  *           - QUEUE_FULL: if no request could be allocated, e.g. from an interrupt
+  */
+ee_status_t EE_ServiceRead(EE_HANDLE_FIRST ee_data_t VirtAddress, ee_data_t* Data, uint8_t Priority)
+{
+  ee_service_req_t* Req;
+  ee_status_t ReadStatus;
+
+  if (ServiceQueue == (osMailQId)0)
+  {
+    return (ee_status_t) NO_SERVICE;
+  }
+
+  Req = (ee_service_req_t*)osMailAlloc(ServiceQueue, osWaitForever);
+  if (Req == (ee_service_req_t*)0)
+  {
+    return (ee_status_t) QUEUE_FULL;
+  }
+
+#ifdef EE_MULT_ENABLE
+  Req->handle = Handle;
+#endif
+  Req->var.addr = VirtAddress;
+  Req->priority = Priority;
+  Req->read = true;
+  Req->data = Data;
+  Req->status = &ReadStatus;
+  Req->thread = osThreadGetId();
+  osMailPut(ServiceQueue, Req);
+
+  osSignalWait(EE_SERVICE_SIGNAL, osWaitForever);
+
+  return ReadStatus;
+}
+#endif
+
+#ifdef EE_BLOB_ENABLE
+/**
+  * @brief  Writes/updates a blob, a byte string stored under a key. The payload 
+  *   is appended with back to back programs, followed by its length, its CRC 
+  *   and finally the key, which commits the blob: an interrupted write leaves 
+  *   the previous version in place. A page transfer is done first if the blob 
+  *   does not fit in the valid page, it copies only the newest version of each 
+  *   blob.
+  * @param  Handle: EEPROM instance, only when EE_MULT_ENABLE is defined
+  * @param  Key: blob key, blobs and variables do not share keys
+  * @param  Buffer: blob content
+  * @param  Length: blob length in bytes, at most EE_BLOB_MAX_LENGTH
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success
+  *           - PAGE_FULL: if the blob is longer than EE_BLOB_MAX_LENGTH or 
+  *             does not fit in a page next to the variables and other blobs
+  *           - NO_VALID_PAGE: if no valid page was found
+  *           - Flash error code: on write Flash error
+  */
+ee_status_t EE_BlobWrite(EE_HANDLE_FIRST ee_data_t Key, const void* Buffer, uint16_t Length)
+{
+  uint16_t Status;
+
+  EE_LOCK();
+  Status = EE_BlobStore(Handle, Key, Buffer, Length);
+  EE_UNLOCK();
+
+  return (ee_status_t) Status;
+}
+
+/**
+  * @brief  Reads the newest version of a blob
+  * @param  Handle: EEPROM instance, only when EE_MULT_ENABLE is defined
+  * @param  Key: blob key
+  * @param  Buffer: receives the blob content
+  * @param  Capacity: size of Buffer in bytes, see EE_BlobSize()
+  * @retval Success or error status:
+  *           - 0: if the blob was found
+  *           - 1: if the blob was not found
+  *           - BUFFER_TOO_SMALL: if the blob is longer than Capacity
+  *           - NO_VALID_PAGE: if no valid page was found.
+  */
+ee_status_t EE_BlobRead(EE_HANDLE_FIRST ee_data_t Key, void* Buffer, uint16_t Capacity)
+{
+  uint32_t PayloadAddress;
+  uint16_t Length;
+  uint16_t Status;
+  uint16_t Idx;
+
+  EE_LOCK();
+  Status = EE_BlobLocate(Handle, Key, &PayloadAddress, &Length);
+  if ((Status == 0) && (Length > Capacity))
+  {
+    Status = BUFFER_TOO_SMALL;
+  }
+  
+  if (Status == 0)
+  {
+    for (Idx = 0; Idx < Length; Idx++)
+    {
+      ((uint8_t*)Buffer)[Idx] = EE_BlobByte(PayloadAddress, Idx);
+    }
+  }
+  EE_UNLOCK();
+
+  return (ee_status_t) Status;
+}
+
+/**
+  * @brief  Get the length of the newest version of a blob
+  * @param  Handle: EEPROM instance, only when EE_MULT_ENABLE is defined
+  * @param  Key: blob key
+  * @param  Length: receives the blob length in bytes
+  * @retval Success or error status:
+  *           - 0: if the blob was found
+  *           - 1: if the blob was not found
+  *           - NO_VALID_PAGE: if no valid page was found.
+  */
+ee_status_t EE_BlobSize(EE_HANDLE_FIRST ee_data_t Key, uint16_t* Length)
+{
+  uint32_t PayloadAddress;
+  uint16_t Status;
+
+  EE_LOCK();
+  Status = EE_BlobLocate(Handle, Key, &PayloadAddress, Length);
+  EE_UNLOCK();
+
+  return (ee_status_t) Status;
+}
+#endif
+
+/**
+  * @brief  Get the write statistics of the library since reset.
+  * @param  Handle: EEPROM instance, only when EE_MULT_ENABLE is defined
+  * @param  Stats: receives the statistics
+  * @retval None
+  */
+void EE_GetStats(EE_HANDLE_FIRST ee_stats_t* Stats)
+{
+  Stats->write_count = Handle->write_count;
+  Stats->elided_count = Handle->elided_count;
+}
+
+/**
+  * @brief  Get the erase count of each page, to be weighed against the Flash 
+  *   endurance. The counts are kept in the page headers so they survive resets.
+  * @param  Handle: EEPROM instance, only when EE_MULT_ENABLE is defined
+  * @param  EraseCount: receives the erase count of each page, in page order
+  * @param  Count: number of entries of EraseCount
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success
+  *           - BUFFER_TOO_SMALL: if Count is less than the number of pages, 
+  *             the first Count pages are reported
+  */
+ee_status_t EE_GetWearInfo(EE_HANDLE_FIRST uint16_t* EraseCount, uint16_t Count)
+{
+  uint16_t page_idx;
+
+  EE_LOCK();
+  for (page_idx = 0; (page_idx < Handle->alloc->page_num) && (page_idx < Count); page_idx++)
+  {
+    EraseCount[page_idx] = EE_GetEraseCount(Handle, page_idx);
+  }
+  EE_UNLOCK();
+
+  if (Count < Handle->alloc->page_num)
+  {
+    return (ee_status_t) BUFFER_TOO_SMALL;
+  }
+
+  return (ee_status_t) FLASH_COMPLETE;
+}
+
+#ifdef EE_INCREMENTAL_ENABLE
+/**
+  * @brief  Advances the pending page transfer, if any, by a bounded amount of 
+  *   work. The variables are migrated to the new page, then the new page is 
+  *   committed and the old page erased.
+  * @note   Each record copied, the commit and the erase take one unit of Budget, 
+  *   only the erase stalls the CPU for tens of milliseconds.
+  * @param  Handle: EEPROM instance, only when EE_MULT_ENABLE is defined
+  * @param  Budget: number of Flash operations allowed
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success
+  *           - PAGE_FULL: if the new page is full
+  *           - Flash error code: on write Flash error
+  */
+ee_status_t EE_Step(EE_HANDLE_FIRST uint16_t Budget)
+{
+  uint16_t Status;
+
+  EE_LOCK();
+  Status = EE_TransferStep(Handle, &Budget, true);
+  EE_UNLOCK();
+
+  return (ee_status_t) Status;
+}
+#endif
+
+#ifdef EE_MAINTENANCE_ENABLE
+/**
+  * @brief  Runs the Flash work which can be done ahead of the writes, to be 
+  *   called from the idle loop or a low priority task. A single page is 
+  *   erased per call: the page left by the last transfer, so the next 
+  *   transfer finds it erased. Once the page written to is filled up to 
+  *   EE_MAINTENANCE_THRESHOLD percent, the variables are compacted to a new 
+  *   page, so the writes neither transfer nor erase.
+  * @note   With EE_LOG_ENABLE, the compaction is the reclaim of the oldest page 
+  *   of the ring, run as soon as a single page is left erased whatever the 
+  *   fill of the page written to, so opening the next page never reclaims.
+  * @param  Handle: EEPROM instance, only when EE_MULT_ENABLE is defined
+  * @param  Work: receives the number of records written, pages committed and 
+  *   pages erased, 0 when there was nothing to do
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success
+  *           - PAGE_FULL: if valid page is full
+  *           - NO_VALID_PAGE: if no valid page was found
+  *           - Flash error code: on write Flash error
+  */
+ee_status_t EE_Maintenance(EE_HANDLE_FIRST uint16_t* Work)
+{
+  uint16_t Status;
+
+  EE_LOCK();
+  Status = EE_RunMaintenance(Handle, Work);
+  EE_UNLOCK();
+
+  return (ee_status_t) Status;
+}
+#endif
+
+#ifdef EE_BLOB_ENABLE
+/**
+  * @brief  Writes a blob, see EE_BlobWrite().
+  * @param  Handle: EEPROM instance
+  * @param  Key: blob key
+  * @param  Buffer: blob content
+  * @param  Length: blob length in bytes
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success
+  *           - PAGE_FULL: if the blob does not fit in a page
+  *           - NO_VALID_PAGE: if no valid page was found
+  *           - Flash error code: on write Flash error
+  */
+static uint16_t EE_BlobStore(ee_handle_t* Handle, ee_data_t Key, const void* Buffer, uint16_t Length)
+{
+  uint32_t Slots = EE_BLOB_RECORDS(Length);
+  uint16_t ValidPage;
+  uint16_t EepromStatus;
+#ifdef EE_SKIP_UNCHANGED_ENABLE
+  uint32_t PayloadAddress;
+  uint16_t StoredLength;
+  uint16_t Idx;
+#endif
+
+  /* Longer blobs could leave no room for the variables in the transfers */
+  if (Length > EE_BLOB_MAX_LENGTH)
+  {
+    return PAGE_FULL;
+  }
+
+  /* Get valid Page for write operation */
+  if (Handle->write_page == NO_VALID_PAGE)
+  {
+    EE_LoadState(Handle);
+    
+    /* Check if there is no valid page */
+    if (Handle->write_page == NO_VALID_PAGE)
+    {
+      return NO_VALID_PAGE;
+    }
+  }
+
+  Handle->write_count++;
+
+#ifdef EE_SKIP_UNCHANGED_ENABLE
+  /* The newest version already holds this content */
+  if (EE_BlobFindStored(Handle, Key, &PayloadAddress, &StoredLength) && (StoredLength == Length))
+  {
+    for (Idx = 0; Idx < Length; Idx++)
+    {
+      if (((const uint8_t*)Buffer)[Idx] != EE_BlobByte(PayloadAddress, Idx))
+      {
+        break;
+      }
+    }
+    if (Idx == Length)
+    {
+      Handle->elided_count++;
+      return FLASH_COMPLETE;
+    }
+  }
+#endif
+
+  if (Handle->write_address + (Slots * EE_RECORD_SIZE) <= EE_PAGE_END(Handle, Handle->write_page) + 1)
+  {
+    return EE_BlobWriteRecords(Handle, Key, Buffer, Length);
+  }
+
+  /* The blob goes to the new page first, so its old versions are not transferred */
+  ValidPage = Handle->read_page;
+  EepromStatus = EE_PageTransferStart(Handle);
+  if (EepromStatus != FLASH_COMPLETE)
+  {
+    return EepromStatus;
+  }
+
+  EepromStatus = EE_BlobWriteRecords(Handle, Key, Buffer, Length);
+  if (EepromStatus != FLASH_COMPLETE)
+  {
+    return EepromStatus;
+  }
+
+  return EE_PageTransferFinish(Handle, ValidPage);
+}
+
+/**
+  * @brief  Finds the newest version of a blob, see EE_BlobRead().
+  * @param  Handle: EEPROM instance
+  * @param  Key: blob key
+  * @param  PayloadAddress: receives the address of the first payload record
+  * @param  Length: receives the blob length in bytes
+  * @retval Success or error status:
+  *           - 0: if the blob was found
+  *           - 1: if the blob was not found
+  *           - NO_VALID_PAGE: if no valid page was found.
+  */
+static uint16_t EE_BlobLocate(ee_handle_t* Handle, ee_data_t Key, uint32_t* PayloadAddress, uint16_t* Length)
+{
+  if (Handle->read_page == NO_VALID_PAGE)
+  {
+    EE_LoadState(Handle);
+    
+    if (Handle->read_page == NO_VALID_PAGE)
+    {
+      return NO_VALID_PAGE;
+    }
+  }
+
+  if (!EE_BlobFindStored(Handle, Key, PayloadAddress, Length))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+#endif
+
+#ifdef EE_MAINTENANCE_ENABLE
+/**
+  * @brief  Runs the Flash work done ahead of the writes, see EE_Maintenance().
+  * @param  Handle: EEPROM instance
+  * @param  Work: receives the number of Flash operations done
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success
+  *           - PAGE_FULL: if valid page is full
+  *           - NO_VALID_PAGE: if no valid page was found
+  *           - Flash error code: on write Flash error
+  */
+static uint16_t EE_RunMaintenance(ee_handle_t* Handle, uint16_t* Work)
+{
+  uint16_t EepromStatus = FLASH_COMPLETE;
+#ifdef EE_INCREMENTAL_ENABLE
+  uint16_t Budget = EE_STEP_UNBOUNDED;
+#else
+  uint32_t WriteAddress;
+#endif
+#ifdef EE_LOG_ENABLE
+  uint16_t Page;
+  uint16_t ErasedCount = 0;
+#endif
+
+  *Work = 0;
+  
+  if (Handle->write_page == NO_VALID_PAGE)
+  {
+    EE_LoadState(Handle);
+    
+    if (Handle->write_page == NO_VALID_PAGE)
+    {
+      return NO_VALID_PAGE;
+    }
+  }
+
+#if defined(EE_LOG_ENABLE)
+  for (Page = 0; Page < Handle->alloc->page_num; Page++)
+  {
+    if (EE_PAGE_STATUS(Handle, Page) == ERASED)
+    {
+      ErasedCount++;
+    }
+  }
+  
+  /* The next head advance must leave an erased page, else the write opening it 
+     reclaims the oldest page: reclaim it now, whatever the fill of the head. 
+     When the head has no room for every variable, or is the oldest page itself 
+     and filled up, the next page is opened now and the reclaim goes to it */
+  if (ErasedCount <= 1)
+  {
+    WriteAddress = Handle->write_address;
+    if (((EE_PAGE_END(Handle, Handle->write_page) + 1 - Handle->write_address) < ((uint32_t)Handle->alloc->var_num * EE_RECORD_SIZE)) || 
+        ((EE_LogOldestPage(Handle) == Handle->read_page) && EE_FILL_REACHED(Handle)))
+    {
+      EepromStatus = EE_LogAdvance(Handle);
+      WriteAddress = EE_PAGE_BASE(Handle, Handle->write_page) + EE_HEADER_SIZE;
+      *Work = (uint16_t)((Handle->write_address - WriteAddress) / EE_RECORD_SIZE) + 1;
+    }
+    else if (EE_LogOldestPage(Handle) != Handle->read_page)
+    {
+      EepromStatus = EE_LogReclaim(Handle);
+      *Work = (uint16_t)((Handle->write_address - WriteAddress) / EE_RECORD_SIZE) + 1;
+    }
+  }
+#elif defined(EE_INCREMENTAL_ENABLE)
+  /* Open the new page early, the variables migrate below */
+  if ((Handle->transfer_page == NO_VALID_PAGE) && EE_FILL_REACHED(Handle))
+  {
+    EepromStatus = EE_TransferBegin(Handle);
+    if (EepromStatus != FLASH_COMPLETE)
+    {
+      return EepromStatus;
+    }
+  }
+  
+  EepromStatus = EE_TransferStep(Handle, &Budget, true);
+  *Work = EE_STEP_UNBOUNDED - Budget;
+#else
+  /* Erase the page left by the last transfer */
+  if (Handle->erase_page != NO_VALID_PAGE)
+  {
+    EepromStatus = EE_ErasePage(Handle, Handle->erase_page);
+    if (EepromStatus == FLASH_COMPLETE)
+    {
+      Handle->erase_page = NO_VALID_PAGE;
+      *Work = 1;
+    }
+    return EepromStatus;
+  }
+  
+  /* Compact the variables to a new page before the page written to is full */
+  if (EE_FILL_REACHED(Handle))
+  {
+    EepromStatus = EE_PageTransfer(Handle, (const ee_var_t*)0, 0);
+    WriteAddress = EE_PAGE_BASE(Handle, Handle->write_page) + EE_HEADER_SIZE;
+    *Work = (uint16_t)((Handle->write_address - WriteAddress) / EE_RECORD_SIZE) + 1;
+  }
+#endif
+
+  return EepromStatus;
+}
+#endif
+
+/**
+  * @brief  Writes/updates several variables in Flash, see EE_WriteVariables().
+  * @param  Handle: EEPROM instance
+  * @param  Vars: Array of virtual address and data pairs
+  * @param  Count: Number of pairs
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success
+  *           - PAGE_FULL: if valid page is full
+  *           - NO_VALID_PAGE: if no valid page was found
+  *           - Flash error code: on write Flash error
+  */
+static uint16_t EE_WriteBatch(ee_handle_t* Handle, const ee_var_t* Vars, uint16_t Count)
+{
+  uint16_t Status = FLASH_COMPLETE;
+  uint16_t Idx;
+
+#ifdef EE_ASYNC_ENABLE
+  /* Let the asynchronous engine complete the queued requests */
+  while (EE_Busy())
+  {
+  }
+#endif
+
+  for (Idx = 0; Idx < Count; Idx++)
+  {
+    if (EE_IsOverwritten(Vars, Idx, Count) || EE_CountWrite(Handle, &Vars[Idx]))
+    {
+      continue;
+    }
+    
+    /* Write the variable virtual address and value in the EEPROM */
+    Status = EE_VerifyPageFullWriteVariable(Handle, Vars[Idx].addr, Vars[Idx].data);
+
+#ifdef EE_LOG_ENABLE
+    /* In case the head of the ring is full, open the next page and retry there */
+    if (Status == PAGE_FULL)
+    {
+      Status = EE_LogAdvance(Handle);
+      if (Status == FLASH_COMPLETE)
+      {
+        Status = EE_VerifyPageFullWriteVariable(Handle, Vars[Idx].addr, Vars[Idx].data);
+      }
+    }
+#elif defined(EE_INCREMENTAL_ENABLE)
+    /* In case the EEPROM active page is full, start a transfer and retry in the new page */
+    if (Status == PAGE_FULL)
+    {
+      Status = EE_TransferBegin(Handle);
+      if (Status == FLASH_COMPLETE)
+      {
+        Status = EE_VerifyPageFullWriteVariable(Handle, Vars[Idx].addr, Vars[Idx].data);
+      }
+    }
+#else
+    /* In case the EEPROM active page is full, the transfer takes the remaining ones */
+    if (Status == PAGE_FULL)
+    {
+      Status = EE_PageTransfer(Handle, &Vars[Idx], Count - Idx);
+#ifdef EE_ISR_READ_ENABLE
+      for (; (Idx < Count) && (Status == FLASH_COMPLETE); Idx++)
+      {
+        if (!EE_IsOverwritten(Vars, Idx, Count))
+        {
+          EE_PublishVariable(Handle, Vars[Idx].addr, Vars[Idx].data);
+        }
+      }
+#endif
+      return Status;
+    }
+#endif
+    
+    if (Status != FLASH_COMPLETE)
+    {
+      return Status;
+    }
+#ifdef EE_ISR_READ_ENABLE
+    EE_PublishVariable(Handle, Vars[Idx].addr, Vars[Idx].data);
+#endif
+  }
+
+#ifdef EE_INCREMENTAL_ENABLE
+  /* A bounded part of the pending transfer rides on the write, the erase is left to EE_Step(). 
+     The migration is completed while the new page still has room for every variable */
+  {
+    uint16_t Budget = EE_WRITE_STEP_BUDGET;
+    if ((EE_PAGE_END(Handle, Handle->write_page) + 1 - Handle->write_address) <= ((uint32_t)Handle->alloc->var_num * EE_RECORD_SIZE))
+    {
+      Budget = EE_STEP_UNBOUNDED;
+    }
+    Status = EE_TransferStep(Handle, &Budget, false);
+  }
+#endif
+
+  /* Return last operation status */
+  return Status;
+}
+
+/**
+  * @brief  Erases all pages and writes VALID_PAGE header to initial_page
+  * @param  Handle: EEPROM instance
+  * @retval Status of the last operation (Flash write or erase) done during
+  *         EEPROM formating
+  */
+static FLASH_Status EE_Format(ee_handle_t* Handle, uint16_t initial_page)
+{
+  FLASH_Status FlashStatus = FLASH_COMPLETE;
+  uint16_t page_idx;
+  
+  //assert_param((IS_VALID_PAGE_INDEX(initial_page));
+  
+  for(page_idx = 0; page_idx < Handle->alloc->page_num; page_idx++)
+  {
+    FlashStatus = EE_ErasePage(Handle, page_idx);
+    if (FlashStatus != FLASH_COMPLETE)
+    {
+      return FlashStatus;
+    }
+    
+    /* Set initial_page as valid page: the first generation, committed */
+    if(page_idx == initial_page)
+    {
+      FlashStatus = EE_PROGRAM_HALFWORD(EE_PAGE_BASE(Handle, page_idx) + EE_GENERATION_OFFSET, 1);
+      if (FlashStatus != FLASH_COMPLETE)
+      {
+        return FlashStatus;
+      }
+      
+      FlashStatus = EE_CommitPage(Handle, page_idx);
+      if (FlashStatus != FLASH_COMPLETE)
+      {
+        return FlashStatus;
+      }
+    }
+  }
+  
+      
+  return FlashStatus;
+}
+
+/**
+  * @brief  Find the valid page and the page receiving a transfer with a single 
+  *   sweep of the page headers.
+  * @param  Handle: EEPROM instance
+  * @param  ValidPage: receives the committed page of the newest generation, 
+  *   NO_VALID_PAGE if none
+  * @param  ReceivePage: receives the page of a newer generation being filled 
+  *   by a transfer, NO_VALID_PAGE if none
+  * @retval None
+  */
+static void EE_FindPages(ee_handle_t* Handle, uint16_t* ValidPage, uint16_t* ReceivePage)
+{
+  uint16_t page_status;
+  uint16_t page_idx;
+  
+  *ValidPage = NO_VALID_PAGE;
+  *ReceivePage = NO_VALID_PAGE;
+  
+  for(page_idx = 0; page_idx < Handle->alloc->page_num; page_idx++)
+  {
+    page_status = EE_PAGE_STATUS(Handle, page_idx);
+    if(EE_PAGE_COMMITTED(Handle, page_idx))
+    {
+      if((*ValidPage == NO_VALID_PAGE) || 
+         EE_GENERATION_NEWER(EE_PAGE_GENERATION(Handle, page_idx), EE_PAGE_GENERATION(Handle, *ValidPage)))
+      {
+        *ValidPage = page_idx;
+      }
+    }
+    else if(EE_STATUS_RECEIVING(page_status))
+    {
+      /* VALID_PAGE without its commit, whole or cut: reset while committing */
+      if((*ReceivePage == NO_VALID_PAGE) || 
+         EE_GENERATION_NEWER(EE_PAGE_GENERATION(Handle, page_idx), EE_PAGE_GENERATION(Handle, *ReceivePage)))
+      {
+        *ReceivePage = page_idx;
+      }
+    }
+  }
+  
+  /* A page older than the valid one is a leftover to be erased */
+  if((*ValidPage != NO_VALID_PAGE) && (*ReceivePage != NO_VALID_PAGE) && 
+     !EE_GENERATION_NEWER(EE_PAGE_GENERATION(Handle, *ReceivePage), EE_PAGE_GENERATION(Handle, *ValidPage)))
+  {
+    *ReceivePage = NO_VALID_PAGE;
+  }
+}
+
+/**
+  * @brief  Migrate the pages written before the page header: the interrupted 
+  *   transfer between two of them is completed as it was then, the newest 
+  *   record of each variable is copied to the next page, which is committed, 
+  *   and the legacy pages are erased. A reset at any point migrates again.
+  * @param  Handle: EEPROM instance
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success or if no page is legacy
+  *           - PAGE_FULL: if the records do not fit in a page
+  *           - Flash error code: on write Flash error
+  */
+static uint16_t EE_LegacyMigrate(ee_handle_t* Handle)
+{
+  FLASH_Status FlashStatus = FLASH_COMPLETE;
+  uint16_t EepromStatus = 0;
+  uint16_t LegacyValid = NO_VALID_PAGE;
+  uint16_t LegacyReceive = NO_VALID_PAGE;
+  uint16_t LegacyCount = 0;
+  bool Committed = false;
+  uint16_t page_idx;
+  uint16_t VarIdx;
+  uint16_t Page;
+  uint16_t Data;
+  ee_data_t VirtAddress;
+  uint32_t Address;
+  
+  for (page_idx = 0; page_idx < Handle->alloc->page_num; page_idx++)
+  {
+    if (EE_PAGE_LEGACY(Handle, page_idx))
+    {
+      LegacyCount++;
+      if (EE_PAGE_STATUS(Handle, page_idx) == VALID_PAGE)
+      {
+        LegacyValid = page_idx;
+      }
+      else
+      {
+        LegacyReceive = page_idx;
+      }
+    }
+    else if (EE_PAGE_COMMITTED(Handle, page_idx))
+    {
+      Committed = true;
+    }
+  }
+  
+  if (LegacyCount == 0)
+  {
+    return FLASH_COMPLETE;
+  }
+  
+  /* A migration was committed already, the legacy pages are leftovers. Two valid 
+     or two receiving legacy pages were formatted by the library of that time */
+  if (Committed || (LegacyCount > 2) || 
+      ((LegacyCount == 2) && ((LegacyValid == NO_VALID_PAGE) || (LegacyReceive == NO_VALID_PAGE))))
+  {
+    for (page_idx = 0; page_idx < Handle->alloc->page_num; page_idx++)
+    {
+      if (EE_PAGE_LEGACY(Handle, page_idx))
+      {
+        FlashStatus = EE_ErasePage(Handle, page_idx);
+        if (FlashStatus != FLASH_COMPLETE)
+        {
+          return FlashStatus;
+        }
+      }
+    }
+    
+    return FLASH_COMPLETE;
+  }
+  
+  /* Complete the transfer to the receiving page: it takes the variables it does 
+     not hold yet, then the valid page is erased */
+  if (LegacyCount == 2)
+  {
+    for (VarIdx = 0; VarIdx < Handle->alloc->var_num; VarIdx++)
+    {
+      VirtAddress = Handle->alloc->var_addr_tab[VarIdx];
+      if (EE_LegacyRead(Handle, LegacyReceive, VirtAddress, &Data) || 
+          !EE_LegacyRead(Handle, LegacyValid, VirtAddress, &Data))
+      {
+        continue;
+      }
+      
+      /* First free slot, a record torn by a reset is not free */
+      for (Address = EE_PAGE_BASE(Handle, LegacyReceive) + EE_LEGACY_HEADER_SIZE; 
+           (Address < EE_PAGE_END(Handle, LegacyReceive)) && ((*(__IO uint32_t*)Address) != 0xFFFFFFFF); 
+           Address += EE_LEGACY_RECORD_SIZE)
+      {
+      }
+      if (Address >= EE_PAGE_END(Handle, LegacyReceive))
+      {
+        return PAGE_FULL;
+      }
+      
+      FlashStatus = EE_PROGRAM_HALFWORD(Address, Data);
+      if (FlashStatus == FLASH_COMPLETE)
+      {
+        FlashStatus = EE_PROGRAM_HALFWORD(Address + 2, (uint16_t)VirtAddress);
+      }
+      if (FlashStatus != FLASH_COMPLETE)
+      {
+        return FlashStatus;
+      }
+    }
+    
+    FlashStatus = EE_ErasePage(Handle, LegacyValid);
+    if (FlashStatus != FLASH_COMPLETE)
+    {
+      return FlashStatus;
+    }
+    LegacyValid = LegacyReceive;
+  }
+  else if (LegacyValid == NO_VALID_PAGE)
+  {
+    /* The old page was erased, only the status of the receiving one was left */
+    LegacyValid = LegacyReceive;
+  }
+  
+  /* Copy the variables to the next page, the first generation, and commit it */
+  Page = EE_PAGE_NEXT(Handle, LegacyValid);
+  FlashStatus = EE_ErasePage(Handle, Page);
+  if (FlashStatus == FLASH_COMPLETE)
+  {
+    FlashStatus = EE_PROGRAM_HALFWORD(EE_PAGE_BASE(Handle, Page) + EE_GENERATION_OFFSET, 1);
+  }
+  if (FlashStatus == FLASH_COMPLETE)
+  {
+    FlashStatus = EE_PROGRAM_HALFWORD(EE_PAGE_BASE(Handle, Page), RECEIVE_DATA);
+  }
+  if (FlashStatus != FLASH_COMPLETE)
+  {
+    return FlashStatus;
+  }
+  
+  Handle->write_page = Page;
+  Handle->write_address = EE_PAGE_BASE(Handle, Page) + EE_HEADER_SIZE;
+  for (VarIdx = 0; VarIdx < Handle->alloc->var_num; VarIdx++)
+  {
+    VirtAddress = Handle->alloc->var_addr_tab[VarIdx];
+    if (EE_LegacyRead(Handle, LegacyValid, VirtAddress, &Data))
+    {
+      EepromStatus = EE_VerifyPageFullWriteVariable(Handle, VirtAddress, Data);
+      if (EepromStatus != FLASH_COMPLETE)
+      {
+        Handle->write_page = NO_VALID_PAGE;
+        return EepromStatus;
+      }
+    }
+  }
+  Handle->write_page = NO_VALID_PAGE;
+  
+  FlashStatus = EE_CommitPage(Handle, Page);
+  if (FlashStatus != FLASH_COMPLETE)
+  {
+    return FlashStatus;
+  }
+  
+  return EE_ErasePage(Handle, LegacyValid);
+}
+
+/**
+  * @brief  Returns the newest record of a variable in a legacy page
+  * @param  Handle: EEPROM instance
+  * @param  Page: legacy page
+  * @param  VirtAddress: variable virtual address
+  * @param  Data: receives the variable value if found
+  * @retval true if the variable was found
+  */
+static bool EE_LegacyRead(ee_handle_t* Handle, uint16_t Page, ee_data_t VirtAddress, uint16_t* Data)
+{
+  uint32_t Address;
+  
+  for (Address = EE_PAGE_END(Handle, Page) + 1 - EE_LEGACY_RECORD_SIZE; 
+       Address >= EE_PAGE_BASE(Handle, Page) + EE_LEGACY_HEADER_SIZE; 
+       Address -= EE_LEGACY_RECORD_SIZE)
+  {
+    if ((*(__IO uint16_t*)(Address + 2)) == (uint16_t)VirtAddress)
+    {
+      *Data = *(__IO uint16_t*)Address;
+      return true;
+    }
+  }
+  
+  return false;
+}
+
+/**
+  * @brief  Commit a page: mark it VALID_PAGE then program the commit halfword, 
+  *   from then on it supersedes the pages of older generations. Called again 
+  *   on a page whose commit was cut, it zeroes the commit halfword.
+  * @param  Handle: EEPROM instance
+  * @param  Page: page holding every variable
+  * @retval Status of the last Flash operation
+  */
+static FLASH_Status EE_CommitPage(ee_handle_t* Handle, uint16_t Page)
+{
+  FLASH_Status FlashStatus = FLASH_COMPLETE;
+  
+  if (EE_PAGE_STATUS(Handle, Page) != VALID_PAGE)
+  {
+    FlashStatus = EE_PROGRAM_HALFWORD(EE_PAGE_BASE(Handle, Page), VALID_PAGE);
+    if (FlashStatus != FLASH_COMPLETE)
+    {
+      return FlashStatus;
+    }
+  }
+  
+  /* A commit cut by a power loss is partly programmed, it can only be zeroed */
+  if (EE_PAGE_COMMIT(Handle, Page) == 0xFFFF)
+  {
+    FlashStatus = EE_PROGRAM_HALFWORD(EE_PAGE_BASE(Handle, Page) + EE_COMMIT_OFFSET, (uint16_t)~EE_PAGE_GENERATION(Handle, Page));
+  }
+  else
+  {
+    FlashStatus = EE_PROGRAM_HALFWORD(EE_PAGE_BASE(Handle, Page) + EE_COMMIT_OFFSET, 0x0000);
+  }
+#ifdef EE_CRC_ENABLE
+  if (FlashStatus == FLASH_COMPLETE)
+  {
+    FlashStatus = EE_SealPage(Handle, Page);
+  }
+#endif
+  
+  return FlashStatus;
+}
+
+
+/**
+  * @brief  Verify if active page is full and Writes variable in EEPROM.
+  * @param  Handle: EEPROM instance
+  * @param  VirtAddress: virtual address of the variable
+  * @param  Data: data to be written as variable value
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success
+  *           - PAGE_FULL: if valid page is full
+  *           - NO_VALID_PAGE: if no valid page was found
+  *           - Flash error code: on write Flash error
+  */
+static uint16_t EE_VerifyPageFullWriteVariable(ee_handle_t* Handle, ee_data_t VirtAddress, ee_data_t Data)
+{
+  FLASH_Status FlashStatus = FLASH_COMPLETE;
+  uint32_t Address = Handle->write_address;
+   
+  /* Get valid Page for write operation */
+  if (Handle->write_page == NO_VALID_PAGE)
+  {
+    EE_LoadState(Handle);
+    
+    /* Check if there is no valid page */
+    if (Handle->write_page == NO_VALID_PAGE)
+    {
+      return  NO_VALID_PAGE;
+    }
+    
+    Address = Handle->write_address;
+  }
+
+  /* Return PAGE_FULL in case the valid page is full */
+  if (Address >= EE_PAGE_END(Handle, Handle->write_page))
+  {
+    return PAGE_FULL;
+  }
+
+  /* Set variable data */
+  FlashStatus = EE_PROGRAM_DATA(Address, Data);
+  if (FlashStatus == FLASH_COMPLETE)
+  {
+    /* Set variable virtual address */
+    FlashStatus = EE_PROGRAM_DATA(Address + EE_DATA_SIZE, VirtAddress);
+  }
+#ifdef EE_CRC_ENABLE
+  if (FlashStatus == FLASH_COMPLETE)
+  {
+    /* The CRC comes last, a record torn before it fails the check */
+    FlashStatus = EE_PROGRAM_WORD(Address + EE_CRC_OFFSET, EE_RecordCrc(VirtAddress, Data));
+  }
+#endif
+  
+  /* Step over the slot unless it is still erased, the erased slots must stay 
+     at the end of the page */
+  if (!EE_RECORD_ERASED(Address))
+  {
+    Handle->write_address = Address + EE_RECORD_SIZE;
+  }
+  
+#if defined(EE_INDEX_ENABLE) || defined(EE_INCREMENTAL_ENABLE)
+  if (FlashStatus == FLASH_COMPLETE)
+  {
+    int16_t VarIdx = EE_GetVarIndex(Handle, VirtAddress);
+    if (VarIdx >= 0)
+    {
+#ifdef EE_INDEX_ENABLE
+      /* The index holds the newest record, in a page receiving a transfer too */
+      Handle->index_offset[VarIdx] = EE_INDEX_ENTRY(Handle, Address);
+#endif
+#ifdef EE_INCREMENTAL_ENABLE
+      /* The pending transfer must not copy an older value over this one */
+      VAR_BIT_SET(Handle->transfer_seen, VarIdx);
+#endif
+    }
+  }
+#endif
+
+  /* Return program operation status */
+  return FlashStatus;
+}
+
+#ifndef EE_LOG_ENABLE
+#ifndef EE_INCREMENTAL_ENABLE
+/**
+  * @brief  Transfers last updated variables data from the full Page to
+  *   an empty one.
+  * @param  Handle: EEPROM instance
+  * @param  Vars: variables to be written to the new page before the transfer,
+  *   the first one is counted by the caller, the next ones are counted here 
+  *   and skipped when unchanged as in EE_WriteBatch()
+  * @param  Count: number of variables in Vars
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success
+  *           - PAGE_FULL: if valid page is full
+  *           - NO_VALID_PAGE: if no valid page was found
+  *           - Flash error code: on write Flash error
+  */
+static uint16_t EE_PageTransfer(ee_handle_t* Handle, const ee_var_t* Vars, uint16_t Count)
+{
+  uint16_t ValidPage = Handle->read_page;
+  uint16_t EepromStatus = 0;
+  uint16_t Idx;
+
+  EepromStatus = EE_PageTransferStart(Handle);
+  if (EepromStatus != FLASH_COMPLETE)
+  {
+    return EepromStatus;
+  }
+
+  /* Write the variables passed as parameter in the new active page */
+  for (Idx = 0; Idx < Count; Idx++)
+  {
+    if (EE_IsOverwritten(Vars, Idx, Count) || ((Idx > 0) && EE_CountWrite(Handle, &Vars[Idx])))
+    {
+      continue;
+    }
+    
+    EepromStatus = EE_VerifyPageFullWriteVariable(Handle, Vars[Idx].addr, Vars[Idx].data);
+    /* If program operation was failed, a Flash error code is returned */
+    if (EepromStatus != FLASH_COMPLETE)
+    {
+      return EepromStatus;
+    }
+  }
+
+  return EE_PageTransferFinish(Handle, ValidPage);
+}
+#endif
+
+/**
+  * @brief  Starts a page transfer: marks the least worn erased page 
+  *   RECEIVE_DATA and appends to it from now on, reads still come from the 
+  *   old one. The records written before EE_PageTransferFinish() take 
+  *   precedence over the ones of the old page.
+  * @param  Handle: EEPROM instance
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success
+  *           - PAGE_FULL: if no page could be erased for the transfer
+  *           - NO_VALID_PAGE: if no valid page was found
+  *           - Flash error code: on write Flash error
+  */
+static uint16_t EE_PageTransferStart(ee_handle_t* Handle)
+{
+  FLASH_Status FlashStatus = FLASH_COMPLETE;
+  uint32_t NewPageAddress;
+  uint16_t NewPage;
+  uint16_t ValidPage = Handle->read_page;
+
+  if (ValidPage == NO_VALID_PAGE)
+  {
+    return NO_VALID_PAGE;       /* No valid Page */
+  }
+
+#ifdef EE_DEFERRED_ERASE
+  /* EE_Maintenance() did not erase the page left by the last transfer yet */
+  if (Handle->erase_page != NO_VALID_PAGE)
+  {
+    FlashStatus = EE_ErasePage(Handle, Handle->erase_page);
+    if (FlashStatus != FLASH_COMPLETE)
+    {
+      return FlashStatus;
+    }
+    Handle->erase_page = NO_VALID_PAGE;
+  }
+#endif
+
+  /* New page address where variable will be moved to */
+  NewPage = EE_SelectPage(Handle, ValidPage);
+  
+  /* A failed or interrupted erase left no usable page: erase the pages but the 
+     valid one again, the blank ones are skipped */
+  if ((NewPage == NO_VALID_PAGE) || !EE_IsPageBlank(EE_PAGE_BASE(Handle, NewPage)))
+  {
+    FlashStatus = EE_EraseOtherPages(Handle, ValidPage);
+    if (FlashStatus != FLASH_COMPLETE)
+    {
+      return FlashStatus;
+    }
+    
+    NewPage = EE_SelectPage(Handle, ValidPage);
+    if (NewPage == NO_VALID_PAGE)
+    {
+      return PAGE_FULL;
+    }
+  }
+  NewPageAddress = EE_PAGE_BASE(Handle, NewPage); 
+
+  /* The new page is one generation newer */
+  FlashStatus = EE_PROGRAM_HALFWORD(NewPageAddress + EE_GENERATION_OFFSET, 
+                                    EE_GENERATION_NEXT(EE_PAGE_GENERATION(Handle, ValidPage)));
+  /* If program operation was failed, a Flash error code is returned */
+  if (FlashStatus != FLASH_COMPLETE)
+  {
+    return FlashStatus;
+  }
+
+  /* Set the new Page status to RECEIVE_DATA status */
+  FlashStatus = EE_PROGRAM_HALFWORD(NewPageAddress, RECEIVE_DATA);
+  /* If program operation was failed, a Flash error code is returned */
+  if (FlashStatus != FLASH_COMPLETE)
+  {
+    return FlashStatus;
+  }
+
+  /* Append to the new page from now on, reads still come from the old one */
+  Handle->write_page = NewPage;
+  Handle->write_address = NewPageAddress + EE_HEADER_SIZE;
+
+  return FlashStatus;
+}
+
+#ifndef EE_INCREMENTAL_ENABLE
+/**
+  * @brief  Completes a page transfer: transfers the variables from the old 
+  *   page, commits the new page and erases the old one.
+  * @param  Handle: EEPROM instance
+  * @param  OldPage: page the variables are taken from
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success
+  *           - PAGE_FULL: if the new page is full
+  *           - Flash error code: on write Flash error
+  */
+static uint16_t EE_PageTransferFinish(ee_handle_t* Handle, uint16_t OldPage)
+{
+  FLASH_Status FlashStatus = FLASH_COMPLETE;
+  uint16_t EepromStatus = 0;
+
+  /* Transfer process: transfer variables from old to the new active page, except 
+     the ones already written to it */
+  EepromStatus = EE_TransferVariables(Handle, OldPage);
+  /* If program operation was failed, a Flash error code is returned */
+  if (EepromStatus != FLASH_COMPLETE)
+  {
+    return EepromStatus;
+  }
+
+  /* Commit the new page, its generation supersedes the old page from now on */
+  FlashStatus = EE_CommitPage(Handle, Handle->write_page);
+  /* If program operation was failed, a Flash error code is returned */
+  if (FlashStatus != FLASH_COMPLETE)
+  {
+    return FlashStatus;
+  }
+
+  /* The new page holds the newest copy of each variable now, and it is already indexed */
+  Handle->read_page = Handle->write_page;
+
+#ifdef EE_DEFERRED_ERASE
+  /* The old page is superseded, EE_Maintenance() erases it */
+  Handle->erase_page = OldPage;
+#else
+  /* Erase the old Page: Set old Page status to ERASED status */
+  FlashStatus = EE_ErasePage(Handle, OldPage);
+  /* If erase operation was failed, a Flash error code is returned */
+  if (FlashStatus != FLASH_COMPLETE)
+  {
+    return FlashStatus;
+  }
+#endif
+
+  /* Return last operation flash status */
+  return FlashStatus;
+}
+#endif
+#endif
+
+/**
+  * @brief  Erase a page unless it is blank already. A page erase stalls the CPU 
+  *   for tens of milliseconds while the blank check is a read of the page. The 
+  *   erase count of the page is carried over to its header.
+  * @param  Handle: EEPROM instance
+  * @param  Page: page to erase
+  * @retval FLASH_COMPLETE if the page is blank, the erase status otherwise
+  */
+static FLASH_Status EE_ErasePage(ee_handle_t* Handle, uint16_t Page)
+{
+  FLASH_Status FlashStatus = FLASH_COMPLETE;
+  uint16_t EraseCount = EE_GetEraseCount(Handle, Page);
+  
+  if (!EE_IsPageBlank(EE_PAGE_BASE(Handle, Page)))
+  {
+#ifdef EE_CRC_ENABLE
+    /* The seal goes with the page */
+    if (Handle->sealed_start == EE_PAGE_BASE(Handle, Page) + EE_HEADER_SIZE)
+    {
+      Handle->sealed_start = 0;
+      Handle->sealed_end = 0;
+    }
+#endif
+    FlashStatus = EE_ERASE_PAGE(EE_PAGE_BASE(Handle, Page));
+    if (FlashStatus != FLASH_COMPLETE)
+    {
+      return FlashStatus;
+    }
+    
+    if (EraseCount < EE_ERASE_COUNT_MAX)
+    {
+      EraseCount++;
+    }
+  }
+  
+  if (EE_PAGE_ERASE_COUNT(Handle, Page) == EE_ERASE_COUNT_UNKNOWN)
+  {
+    FlashStatus = EE_PROGRAM_HALFWORD(EE_PAGE_BASE(Handle, Page) + EE_ERASE_COUNT_OFFSET, EraseCount);
+    if (FlashStatus == FLASH_COMPLETE)
+    {
+      FlashStatus = EE_PROGRAM_HALFWORD(EE_PAGE_BASE(Handle, Page) + EE_ERASE_CHECK_OFFSET, EE_ERASE_CHECK(EraseCount));
+    }
+  }
+  
+  return FlashStatus;
+}
+
+#ifndef EE_LOG_ENABLE
+/**
+  * @brief  Erase every page but one, see EE_ErasePage()
+  * @param  Handle: EEPROM instance
+  * @param  KeptPage: page left untouched
+  * @retval Status of the last erase
+  */
+static FLASH_Status EE_EraseOtherPages(ee_handle_t* Handle, uint16_t KeptPage)
+{
+  FLASH_Status FlashStatus = FLASH_COMPLETE;
+  uint16_t page_idx;
+  
+  for (page_idx = 0; page_idx < Handle->alloc->page_num; page_idx++)
+  {
+    if (page_idx != KeptPage)
+    {
+      FlashStatus = EE_ErasePage(Handle, page_idx);
+      if (FlashStatus != FLASH_COMPLETE)
+      {
+        return FlashStatus;
+      }
+    }
+  }
+  
+  return FlashStatus;
+}
+#endif
+
+/**
+  * @brief  Get the erase count of a page from its header. A count lost to a 
+  *   reset right after the erase is taken as the highest count of the other 
+  *   pages, which are rotated evenly.
+  * @param  Handle: EEPROM instance
+  * @param  Page: page to get the count of
+  * @retval Erase count of the page
+  */
+static uint16_t EE_GetEraseCount(ee_handle_t* Handle, uint16_t Page)
+{
+  uint16_t EraseCount = EE_ReadEraseCount(Handle, Page);
+  uint16_t page_idx;
+  
+  if (EraseCount != EE_ERASE_COUNT_UNKNOWN)
+  {
+    return EraseCount;
+  }
+  
+  EraseCount = 0;
+  for (page_idx = 0; page_idx < Handle->alloc->page_num; page_idx++)
+  {
+    if ((EE_ReadEraseCount(Handle, page_idx) != EE_ERASE_COUNT_UNKNOWN) && 
+        (EE_ReadEraseCount(Handle, page_idx) > EraseCount))
+    {
+      EraseCount = EE_ReadEraseCount(Handle, page_idx);
+    }
+  }
+  
+  return EraseCount;
+}
+
+/**
+  * @brief  Read the erase count stored in a page header. Pages with an unknown 
+  *   status hold no count, e.g. before the first format, nor do the pages 
+  *   whose count fails its check.
+  * @param  Handle: EEPROM instance
+  * @param  Page: page to read the count of
+  * @retval Erase count of the page, EE_ERASE_COUNT_UNKNOWN if none is stored
+  */
+static uint16_t EE_ReadEraseCount(ee_handle_t* Handle, uint16_t Page)
+{
+  uint16_t PageStatus = (*(__IO uint16_t*)EE_PAGE_BASE(Handle, Page));
+  
+  if ((PageStatus != ERASED) && (PageStatus != RECEIVE_DATA) && (PageStatus != VALID_PAGE))
+  {
+    return EE_ERASE_COUNT_UNKNOWN;
+  }
+  
+  if (!EE_ERASE_COUNT_CHECKED(EE_PAGE_ERASE_COUNT(Handle, Page), EE_PAGE_ERASE_CHECK(Handle, Page)))
+  {
+    return EE_ERASE_COUNT_UNKNOWN;
+  }
+  
+  return EE_PAGE_ERASE_COUNT(Handle, Page);
+}
+
+/**
+  * @brief  Select the page a transfer goes to: the least worn erased page, the 
+  *   pages are taken in ring order from the valid page when the counts are equal.
+  * @param  Handle: EEPROM instance
+  * @param  ValidPage: page the variables are taken from
+  * @retval Page to transfer the variables to, NO_VALID_PAGE if no page is erased
+  */
+static uint16_t EE_SelectPage(ee_handle_t* Handle, uint16_t ValidPage)
+{
+  uint16_t SelectedPage = NO_VALID_PAGE;
+  uint16_t SelectedCount = 0;
+  uint16_t Page = ValidPage;
+  uint16_t EraseCount;
+  
+  do
+  {
+    Page = EE_PAGE_NEXT(Handle, Page);
+    if (EE_PAGE_STATUS(Handle, Page) == ERASED)
+    {
+      EraseCount = EE_GetEraseCount(Handle, Page);
+      if ((SelectedPage == NO_VALID_PAGE) || (EraseCount < SelectedCount))
+      {
+        SelectedPage = Page;
+        SelectedCount = EraseCount;
+      }
+    }
+  } while (Page != ValidPage);
+  
+  return SelectedPage;
+}
+
+/**
+  * @brief  Check whether a page reads 0xFF but the erase count in its header, 
+  *   which is either erased too or programmed in full along with its check
+  * @param  PageAddress: page base address
+  * @retval true if the page is blank
+  */
+static bool EE_IsPageBlank(uint32_t PageAddress)
+{
+  uint16_t EraseCount = *(__IO uint16_t*)(PageAddress + EE_ERASE_COUNT_OFFSET);
+  uint16_t EraseCheck = *(__IO uint16_t*)(PageAddress + EE_ERASE_CHECK_OFFSET);
+  uint32_t Address;
+  uint32_t Word;
+  
+  if ((*(__IO uint16_t*)PageAddress) != ERASED)
+  {
+    return false;
+  }
+  
+  if (!((EraseCount == EE_ERASE_COUNT_UNKNOWN) && (EraseCheck == 0xFFFF)) && 
+      !EE_ERASE_COUNT_CHECKED(EraseCount, EraseCheck))
+  {
+    return false;
+  }
+  
+  for (Address = PageAddress + 4; Address < PageAddress + PAGE_SIZE; Address += 4)
+  {
+    Word = *(__IO uint32_t*)Address;
+    if (Address == PageAddress + (EE_ERASE_CHECK_OFFSET & ~3))
+    {
+      /* The check halfword, checked above */
+      Word |= (EE_ERASE_CHECK_OFFSET & 2) ? 0xFFFF0000 : 0x0000FFFF;
+    }
+    if (Word != 0xFFFFFFFF)
+    {
+      return false;
+    }
+  }
+  
+  return true;
+}
+
+/**
+  * @brief  Find the first free slot of a page. Records are only ever appended, 
+  *   so the page is a run of used slots followed by erased ones and a binary 
+  *   search finds the boundary.
+  * @param  Handle: EEPROM instance
+  * @param  Page: page to search
+  * @retval Address of the first free slot, EE_PAGE_END(Handle, Page) + 1 if the 
+  *   page is full
+  */
+static uint32_t EE_FindFreeSlot(ee_handle_t* Handle, uint16_t Page)
+{
+  uint32_t PageStartAddress = EE_PAGE_BASE(Handle, Page);
+  uint16_t Low = EE_HEADER_SIZE / EE_RECORD_SIZE;   /* the page header comes first */
+  uint16_t High = PAGE_SIZE / EE_RECORD_SIZE;
+  uint16_t Mid;
+  
+  while (Low < High)
+  {
+    Mid = (Low + High) / 2;
+    if (EE_RECORD_ERASED(PageStartAddress + (Mid * EE_RECORD_SIZE)))
+    {
+      High = Mid;
+    }
+    else
+    {
+      Low = Mid + 1;
+    }
+  }
+  
+  return PageStartAddress + (Low * EE_RECORD_SIZE);
+}
+
+/**
+  * @brief  Load the cached page state from the page headers
+  * @param  Handle: EEPROM instance
+  * @retval None
+  */
+static void EE_LoadState(ee_handle_t* Handle)
+{
+  EE_FindPages(Handle, &Handle->read_page, &Handle->write_page);
+  
+  if (Handle->read_page == NO_VALID_PAGE)
+  {
+    Handle->write_page = NO_VALID_PAGE;
+    return;
+  }
+  
+#ifdef EE_LOG_ENABLE
+  /* Records are appended to the head of the ring */
+  Handle->write_page = Handle->read_page;
+#else
+  if (Handle->write_page == NO_VALID_PAGE)
+  {
+    Handle->write_page = Handle->read_page;
+  }
+#endif
+  
+  Handle->write_address = EE_FindFreeSlot(Handle, Handle->write_page);
+  
+#ifdef EE_CRC_ENABLE
+  EE_SealCheck(Handle, Handle->read_page);
+#endif
+  
+#ifdef EE_DEFERRED_ERASE
+  /* EE_Init() erases the pages superseded */
+  Handle->erase_page = NO_VALID_PAGE;
+#endif
+  
+#ifdef EE_INCREMENTAL_ENABLE
+  /* A transfer is found when EE_Init() did not complete it, resume it */
+  Handle->transfer_page = NO_VALID_PAGE;
+  if (Handle->write_page != Handle->read_page)
+  {
+    EE_TransferTrack(Handle, Handle->read_page);
+  }
+#endif
+  
+#ifdef EE_INDEX_ENABLE
+  EE_IndexBuild(Handle);
+#endif
+}
+
+#ifndef EE_LOG_ENABLE
+/**
+  * @brief  Copy the newest record of each variable from the old page to Handle->write_page 
+  *   with a single pass over the old page from its newest record to its oldest.
+  *   Variables already present in Handle->write_page are newer than anything in the old 
+  *   page and are skipped, as is everything older than the first record met.
+  * @note   The index entries of the old page stay valid until it is erased, each 
+  *   entry is moved to the new page as its record is copied, so the reads 
+  *   from the index go on during the transfer.
+  * @param  Handle: EEPROM instance
+  * @param  OldPage: page the variables are taken from
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success
+  *           - PAGE_FULL: if Handle->write_page is full
+  *           - Flash error code: on write Flash error
+  */
+static uint16_t EE_TransferVariables(ee_handle_t* Handle, uint16_t OldPage)
+{
+  uint8_t Seen[VAR_BITMAP_SIZE];
+  uint16_t SeenCount = 0;
+  uint32_t PageStartAddress;
+  uint32_t Address;
+  uint16_t EepromStatus;
+  int16_t VarIdx;
+#ifdef EE_BLOB_ENABLE
+  ee_data_t BlobKeys[EE_BLOB_KEYS_MAX];
+  uint16_t BlobKeyCount = 0;
+  uint32_t PayloadAddress;
+  uint16_t Length;
+#endif
+  
+  for (VarIdx = 0; VarIdx < VAR_BITMAP_SIZE; VarIdx++)
+  {
+    Seen[VarIdx] = 0;
+  }
+  
+  /* Records already in Handle->write_page, newest first. After a reset the index 
+     was built from the old page, the entries of these variables move here */
+  PageStartAddress = EE_PAGE_BASE(Handle, Handle->write_page);
+  for (Address = Handle->write_address - EE_RECORD_SIZE; Address >= PageStartAddress + EE_HEADER_SIZE; Address -= EE_RECORD_SIZE)
+  {
+#ifdef EE_BLOB_ENABLE
+    /* So are the blobs, their keys are marked */
+    if ((EE_READ_DATA(Address + EE_DATA_SIZE) == EE_BLOB_TAG_KEY) && (BlobKeyCount < EE_BLOB_KEYS_MAX) && 
+        EE_RECORD_VALID(Handle, Address) && EE_BlobCheck(PageStartAddress, Address, &PayloadAddress, &Length))
+    {
+      EE_BlobKeyMark(Handle, BlobKeys, &BlobKeyCount, EE_READ_DATA(Address));
+      continue;
+    }
+#endif
+    VarIdx = EE_GetVarIndex(Handle, EE_READ_DATA(Address + EE_DATA_SIZE));
+    if ((VarIdx >= 0) && !VAR_BIT_TEST(Seen, VarIdx) && EE_RECORD_VALID(Handle, Address))
+    {
+      VAR_BIT_SET(Seen, VarIdx);
+      SeenCount++;
+#ifdef EE_INDEX_ENABLE
+      Handle->index_offset[VarIdx] = EE_INDEX_ENTRY(Handle, Address);
+#endif
+    }
+  }
+  
+  /* Records of the old page, newest first, until every variable was met */
+  PageStartAddress = EE_PAGE_BASE(Handle, OldPage);
+#ifdef EE_BLOB_ENABLE
+  /* Blobs are not counted, the whole page is walked for them */
+  for (Address = EE_FindFreeSlot(Handle, OldPage) - EE_RECORD_SIZE; 
+       Address >= PageStartAddress + EE_HEADER_SIZE; Address -= EE_RECORD_SIZE)
+#else
+  for (Address = EE_FindFreeSlot(Handle, OldPage) - EE_RECORD_SIZE; 
+       (Address >= PageStartAddress + EE_HEADER_SIZE) && (SeenCount < Handle->alloc->var_num); Address -= EE_RECORD_SIZE)
+#endif
+  {
+#ifdef EE_BLOB_ENABLE
+    if ((EE_READ_DATA(Address + EE_DATA_SIZE) == EE_BLOB_TAG_KEY) && EE_RECORD_VALID(Handle, Address))
+    {
+      EepromStatus = EE_BlobTransfer(Handle, OldPage, Address, BlobKeys, &BlobKeyCount);
+      if (EepromStatus != FLASH_COMPLETE)
+      {
+        return EepromStatus;
+      }
+      continue;
+    }
+#endif
+    
+    VarIdx = EE_GetVarIndex(Handle, EE_READ_DATA(Address + EE_DATA_SIZE));
+    if ((VarIdx >= 0) && !VAR_BIT_TEST(Seen, VarIdx) && EE_RECORD_VALID(Handle, Address))
+    {
+      VAR_BIT_SET(Seen, VarIdx);
+      SeenCount++;
+      
+      /* Transfer the variable to the new active page, the index follows it once programmed */
+      EepromStatus = EE_VerifyPageFullWriteVariable(Handle, Handle->alloc->var_addr_tab[VarIdx], EE_READ_DATA(Address));
+      if (EepromStatus != FLASH_COMPLETE)
+      {
+        return EepromStatus;
+      }
+    }
+  }
+  
+  return FLASH_COMPLETE;
+}
+#endif
+
+/**
+  * @brief  Check whether a variable of a write batch is written again later in 
+  *   the same batch
+  * @param  Vars: Array of virtual address and data pairs
+  * @param  Idx: position of the variable to check
+  * @param  Count: number of pairs in Vars
+  * @retval true if a later pair has the same virtual address
+  */
+static bool EE_IsOverwritten(const ee_var_t* Vars, uint16_t Idx, uint16_t Count)
+{
+  uint16_t Next;
+  
+  for (Next = Idx + 1; Next < Count; Next++)
+  {
+    if (Vars[Next].addr == Vars[Idx].addr)
+    {
+      return true;
+    }
+  }
+  
+  return false;
+}
+
+/**
+  * @brief  Counts a write request and, with EE_SKIP_UNCHANGED_ENABLE, checks 
+  *   whether the newest record already holds its value
+  * @param  Handle: EEPROM instance
+  * @param  Var: virtual address and data pair to be written
+  * @retval true if the write is elided
+  */
+static bool EE_CountWrite(ee_handle_t* Handle, const ee_var_t* Var)
+{
+#ifdef EE_SKIP_UNCHANGED_ENABLE
+  ee_data_t StoredData;
+#endif
+
+  Handle->write_count++;
+  
+#ifdef EE_SKIP_UNCHANGED_ENABLE
+  /* The newest record already holds this value */
+  if ((EE_ReadStoredVariable(Handle, Var->addr, &StoredData) == 0) && (StoredData == Var->data))
+  {
+    Handle->elided_count++;
+    return true;
+  }
+#endif
+  
+  return false;
+}
+
+#ifdef EE_ASYNC_ENABLE
+/**
+  * @brief  Get the newest queued value of a variable
+  * @param  Handle: EEPROM instance the write was queued for
+  * @param  VirtAddress: Variable virtual address
+  * @param  Data: receives the queued value
+  * @retval true if a write of the variable is queued
+  */
+static bool EE_AsyncLookup(ee_handle_t* Handle, ee_data_t VirtAddress, ee_data_t* Data)
+{
+  uint16_t Idx = AsyncTail;
+  
+  while (Idx != AsyncHead)
+  {
+    Idx = (Idx + EE_ASYNC_QUEUE_SIZE - 1) % EE_ASYNC_QUEUE_SIZE;
+    if ((AsyncQueue[Idx].handle == Handle) && (AsyncQueue[Idx].var.addr == VirtAddress))
+    {
+      *Data = AsyncQueue[Idx].var.data;
+      return true;
+    }
+  }
+  
+  return false;
+}
+
+/**
+  * @brief  Run the asynchronous engine until a Flash operation is started or 
+  *   the queue is empty. AsyncState is the operation just completed.
+  * @param  None
+  * @retval None
+  */
+static void EE_AsyncAdvance(void)
+{
+  ee_async_req_t* Req;
+  ee_handle_t* Handle;
+  uint16_t NewPage;
+  int16_t VarIdx;
+  
+  for (;;)
+  {
+    Req = &AsyncQueue[AsyncHead];
+    Handle = Req->handle;
+    
+    switch (AsyncState)
+    {
+      case ASYNC_DISPATCH:
+        if (AsyncHead == AsyncTail)
+        {
+          FLASH_ITConfig(FLASH_IT_EOP | FLASH_IT_ERR, DISABLE);
+          AsyncState = ASYNC_IDLE;
+          return;
+        }
+        
+        if (Handle->write_page == NO_VALID_PAGE)
+        {
+          AsyncSwitches++;
+          EE_LoadState(Handle);
+          if (Handle->write_page == NO_VALID_PAGE)
+          {
+            EE_AsyncComplete(NO_VALID_PAGE);
+            break;
+          }
+        }
+        
+        if (Handle->write_address >= EE_PAGE_END(Handle, Handle->write_page))
+        {
+          /* No page is left to transfer to, a blocking write erases one again */
+          NewPage = EE_SelectPage(Handle, Handle->read_page);
+          if ((NewPage == NO_VALID_PAGE) || !EE_IsPageBlank(EE_PAGE_BASE(Handle, NewPage)))
+          {
+            EE_AsyncComplete(PAGE_FULL);
+            break;
+          }
+          
+          /* Page full: the request goes to the next page, then the others are transferred */
+          AsyncTransfer = true;
+          AsyncOldPage = Handle->read_page;
+          AsyncSwitches++;
+          Handle->write_page = NewPage;
+          Handle->write_address = EE_PAGE_BASE(Handle, Handle->write_page) + EE_HEADER_SIZE;
+          EE_AsyncProgramHalfWord(EE_PAGE_BASE(Handle, Handle->write_page) + EE_GENERATION_OFFSET, 
+                                  EE_GENERATION_NEXT(EE_PAGE_GENERATION(Handle, AsyncOldPage)), ASYNC_GENERATION);
+          return;
+        }
+        
+        AsyncAddress = Handle->write_address;
+        EE_AsyncProgram(AsyncAddress, Req->var.data, ASYNC_PROGRAM_DATA);
+        return;
+        
+      case ASYNC_GENERATION:
+        EE_AsyncProgramHalfWord(EE_PAGE_BASE(Handle, Handle->write_page), RECEIVE_DATA, ASYNC_RECEIVE_HEADER);
+        return;
+        
+      case ASYNC_RECEIVE_HEADER:
+        AsyncAddress = Handle->write_address;
+        EE_AsyncProgram(AsyncAddress, Req->var.data, ASYNC_PROGRAM_DATA);
+        return;
+        
+      case ASYNC_PROGRAM_DATA:
+        EE_AsyncProgram(AsyncAddress + EE_DATA_SIZE, Req->var.addr, ASYNC_PROGRAM_ADDRESS);
+        return;
+        
+      case ASYNC_PROGRAM_ADDRESS:
+        Handle->write_address = AsyncAddress + EE_RECORD_SIZE;
+        
+        if (!AsyncTransfer)
+        {
+#ifdef EE_INDEX_ENABLE
+          VarIdx = EE_GetVarIndex(Handle, Req->var.addr);
+          if ((VarIdx >= 0) && (Handle->write_page == Handle->read_page))
+          {
+            Handle->index_offset[VarIdx] = EE_INDEX_ENTRY(Handle, AsyncAddress);
+          }
+#endif
+          EE_AsyncComplete(FLASH_COMPLETE);
+          break;
+        }
+        
+        /* The request is in the new page, transfer the other variables */
+        for (VarIdx = 0; VarIdx < VAR_BITMAP_SIZE; VarIdx++)
+        {
+          AsyncSeen[VarIdx] = 0;
+        }
+        AsyncSeenCount = 0;
+        VarIdx = EE_GetVarIndex(Handle, Req->var.addr);
+        if (VarIdx >= 0)
+        {
+          VAR_BIT_SET(AsyncSeen, VarIdx);
+          AsyncSeenCount++;
+        }
+        AsyncAddress = EE_FindFreeSlot(Handle, AsyncOldPage) - EE_RECORD_SIZE;
+        AsyncState = ASYNC_COPY_NEXT;
+        break;
+        
+      case ASYNC_COPY_NEXT:
+        /* Next record of the old page, newest first, of a variable not met yet */
+        VarIdx = -1;
+        while ((AsyncAddress >= EE_PAGE_BASE(Handle, AsyncOldPage) + EE_HEADER_SIZE) && (AsyncSeenCount < Handle->alloc->var_num))
+        {
+          VarIdx = EE_GetVarIndex(Handle, EE_READ_DATA(AsyncAddress + EE_DATA_SIZE));
+          if ((VarIdx >= 0) && !VAR_BIT_TEST(AsyncSeen, VarIdx))
+          {
+            break;
+          }
+          VarIdx = -1;
+          AsyncAddress -= EE_RECORD_SIZE;
+        }
+        
+        if (VarIdx >= 0)
+        {
+          if (Handle->write_address >= EE_PAGE_END(Handle, Handle->write_page))
+          {
+            AsyncTransfer = false;
+            EE_AsyncComplete(PAGE_FULL);
+            break;
+          }
+          
+          VAR_BIT_SET(AsyncSeen, VarIdx);
+          AsyncSeenCount++;
+          EE_AsyncProgram(Handle->write_address, EE_READ_DATA(AsyncAddress), ASYNC_COPY_DATA);
+          return;
+        }
+        
+        /* Every variable is in the new page, read from it and commit it */
+        AsyncSwitches++;
+        Handle->read_page = Handle->write_page;
+#ifdef EE_INDEX_ENABLE
+        EE_IndexBuild(Handle);
+#endif
+        EE_AsyncProgramHalfWord(EE_PAGE_BASE(Handle, Handle->write_page), VALID_PAGE, ASYNC_VALID_HEADER);
+        return;
+        
+      case ASYNC_VALID_HEADER:
+        EE_AsyncProgramHalfWord(EE_PAGE_BASE(Handle, Handle->write_page) + EE_COMMIT_OFFSET, 
+                                (uint16_t)~EE_PAGE_GENERATION(Handle, Handle->write_page), ASYNC_COMMIT);
+        return;
+        
+      case ASYNC_COMMIT:
+        /* The new page is committed, erase the old one */
+        AsyncState = ASYNC_ERASE;
+        AsyncEraseCount = EE_GetEraseCount(Handle, AsyncOldPage);
+        if (!EE_IsPageBlank(EE_PAGE_BASE(Handle, AsyncOldPage)))
+        {
+          if (AsyncEraseCount < EE_ERASE_COUNT_MAX)
+          {
+            AsyncEraseCount++;
+          }
+          FLASH->CR |= FLASH_CR_PER;
+          FLASH->AR = EE_PAGE_BASE(Handle, AsyncOldPage);
+          FLASH->CR |= FLASH_CR_STRT;
+          return;
+        }
+        break;
+        
+      case ASYNC_COPY_DATA:
+        EE_AsyncProgram(Handle->write_address + EE_DATA_SIZE, EE_READ_DATA(AsyncAddress + EE_DATA_SIZE), ASYNC_COPY_ADDRESS);
+        return;
+        
+      case ASYNC_COPY_ADDRESS:
+        Handle->write_address += EE_RECORD_SIZE;
+        AsyncAddress -= EE_RECORD_SIZE;
+        AsyncState = ASYNC_COPY_NEXT;
+        break;
+        
+      case ASYNC_ERASE:
+        if (EE_PAGE_ERASE_COUNT(Handle, AsyncOldPage) == EE_ERASE_COUNT_UNKNOWN)
+        {
+          EE_AsyncProgramHalfWord(EE_PAGE_BASE(Handle, AsyncOldPage) + EE_ERASE_COUNT_OFFSET, AsyncEraseCount, ASYNC_ERASE_COUNT);
+          return;
+        }
+        AsyncTransfer = false;
+        EE_AsyncComplete(FLASH_COMPLETE);
+        break;
+        
+      case ASYNC_ERASE_COUNT:
+        EE_AsyncProgramHalfWord(EE_PAGE_BASE(Handle, AsyncOldPage) + EE_ERASE_CHECK_OFFSET, EE_ERASE_CHECK(AsyncEraseCount), ASYNC_ERASE_CHECK);
+        return;
+        
+      case ASYNC_ERASE_CHECK:
+        AsyncTransfer = false;
+        EE_AsyncComplete(FLASH_COMPLETE);
+        break;
+        
+      default:
+        return;
+    }
+  }
+}
+
+/**
+  * @brief  Start programming a data or virtual address field of a record, 
+  *   completion is signaled by the EOP interrupt
+  * @param  Address: field address
+  * @param  Data: field value
+  * @param  State: engine state while the programming is in progress
+  * @retval None
+  */
+static void EE_AsyncProgram(uint32_t Address, ee_data_t Data, ee_async_state_t State)
+{
+#if (EE_DATA_32BIT == EE_DATA_WIDTH)
+  AsyncHighPending = true;
+  AsyncHighAddress = Address + 2;
+  AsyncHighData = (uint16_t)(Data >> 16);
+#endif
+  EE_AsyncProgramHalfWord(Address, (uint16_t)Data, State);
+}
+
+/**
+  * @brief  Start programming a halfword, completion is signaled by the EOP interrupt
+  * @param  Address: halfword address
+  * @param  Data: halfword value
+  * @param  State: engine state while the programming is in progress
+  * @retval None
+  */
+static void EE_AsyncProgramHalfWord(uint32_t Address, uint16_t Data, ee_async_state_t State)
+{
+  AsyncState = State;
+  FLASH->CR |= FLASH_CR_PG;
+  *(__IO uint16_t*)Address = Data;
+}
+
+/**
+  * @brief  Remove the head request from the queue and report its status
+  * @param  Status: write status passed to the request callback
+  * @retval None
+  */
+static void EE_AsyncComplete(uint16_t Status)
+{
+  ee_async_req_t* Req = &AsyncQueue[AsyncHead];
+  
+  if (Req->callback != 0)
+  {
+    Req->callback(Req->var.addr, (ee_status_t) Status);
+  }
+  
+  AsyncHead = (AsyncHead + 1) % EE_ASYNC_QUEUE_SIZE;
+  AsyncState = ASYNC_DISPATCH;
+}
+#endif
+
+#ifdef EE_BLOB_ENABLE
+/**
+  * @brief  Check the blob committed by a key record: the length and CRC records 
+  *   must precede it, preceded by the payload records, and the CRC must match.
+  * @param  PageStartAddress: base address of the page holding the blob
+  * @param  Address: address of the key record
+  * @param  PayloadAddress: receives the address of the first payload record
+  * @param  Length: receives the blob length in bytes
+  * @retval true if the blob is complete and intact
+  */
+static bool EE_BlobCheck(uint32_t PageStartAddress, uint32_t Address, uint32_t* PayloadAddress, uint16_t* Length)
+{
+  uint32_t Slots;
+  uint32_t Slot;
+
+  /* The page header, the length and the CRC records come first */
+  if ((Address < PageStartAddress + EE_HEADER_SIZE + (2 * EE_RECORD_SIZE)) || 
+      (EE_READ_DATA(Address - EE_RECORD_SIZE + EE_DATA_SIZE) != EE_BLOB_TAG_CRC) || 
+      (EE_READ_DATA(Address - (2 * EE_RECORD_SIZE) + EE_DATA_SIZE) != EE_BLOB_TAG_LENGTH))
+  {
+    return false;
+  }
+
+  *Length = (uint16_t)EE_READ_DATA(Address - (2 * EE_RECORD_SIZE));
+  Slots = (*Length + EE_DATA_SIZE - 1) / EE_DATA_SIZE;
+  if (((Slots + 2) * EE_RECORD_SIZE) > (Address - PageStartAddress - EE_HEADER_SIZE))
+  {
+    return false;
+  }
+
+  *PayloadAddress = Address - ((Slots + 2) * EE_RECORD_SIZE);
+  for (Slot = 0; Slot < Slots; Slot++)
+  {
+    if (EE_READ_DATA(*PayloadAddress + (Slot * EE_RECORD_SIZE) + EE_DATA_SIZE) != EE_BLOB_TAG_DATA)
+    {
+      return false;
+    }
+  }
+
+  return (EE_BlobCrc(*PayloadAddress, *Length) == (uint16_t)EE_READ_DATA(Address - EE_RECORD_SIZE));
+}
+
+/**
+  * @brief  Find the newest intact version of a blob in part of a page
+  * @param  Handle: EEPROM instance
+  * @param  Page: page to search
+  * @param  EndAddress: first free slot of the page, the search goes backward from it
+  * @param  Key: blob key
+  * @param  PayloadAddress: receives the address of the first payload record
+  * @param  Length: receives the blob length in bytes
+  * @retval true if the blob was found
+  */
+static bool EE_BlobFind(ee_handle_t* Handle, uint16_t Page, uint32_t EndAddress, ee_data_t Key, uint32_t* PayloadAddress, uint16_t* Length)
+{
+  uint32_t PageStartAddress = EE_PAGE_BASE(Handle, Page);
+  uint32_t Address;
+
+  for (Address = EndAddress - EE_RECORD_SIZE; Address >= PageStartAddress + EE_HEADER_SIZE; Address -= EE_RECORD_SIZE)
+  {
+    if ((EE_READ_DATA(Address + EE_DATA_SIZE) == EE_BLOB_TAG_KEY) && (EE_READ_DATA(Address) == Key) && 
+        EE_RECORD_VALID(Handle, Address) && EE_BlobCheck(PageStartAddress, Address, PayloadAddress, Length))
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+  * @brief  Find the newest intact version of a blob in the valid page
+  * @param  Handle: EEPROM instance
+  * @param  Key: blob key
+  * @param  PayloadAddress: receives the address of the first payload record
+  * @param  Length: receives the blob length in bytes
+  * @retval true if the blob was found
+  */
+static bool EE_BlobFindStored(ee_handle_t* Handle, ee_data_t Key, uint32_t* PayloadAddress, uint16_t* Length)
+{
+  uint32_t EndAddress;
+
+  if (Handle->read_page == Handle->write_page)
+  {
+    EndAddress = Handle->write_address;
+  }
+  else
+  {
+    EndAddress = EE_FindFreeSlot(Handle, Handle->read_page);
+  }
+
+  return EE_BlobFind(Handle, Handle->read_page, EndAddress, Key, PayloadAddress, Length);
+}
+
+/**
+  * @brief  Append the payload, length, CRC and key records of a blob
+  * @param  Handle: EEPROM instance
+  * @param  Key: blob key
+  * @param  Buffer: blob content
+  * @param  Length: blob length in bytes
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success
+  *           - PAGE_FULL: if the page is full
+  *           - Flash error code: on write Flash error
+  */
+static uint16_t EE_BlobWriteRecords(ee_handle_t* Handle, ee_data_t Key, const uint8_t* Buffer, uint16_t Length)
+{
+  uint16_t EepromStatus;
+  uint16_t Idx;
+  uint16_t Byte;
+  ee_data_t Chunk;
+
+  /* Payload, the bytes past the end of the blob read as erased */
+  for (Idx = 0; Idx < Length; Idx += EE_DATA_SIZE)
+  {
+    Chunk = 0;
+    for (Byte = EE_DATA_SIZE; Byte > 0; Byte--)
+    {
+      Chunk = (ee_data_t)((Chunk << 8) | ((Idx + Byte - 1 < Length) ? Buffer[Idx + Byte - 1] : 0xFF));
+    }
+    
+    EepromStatus = EE_VerifyPageFullWriteVariable(Handle, EE_BLOB_TAG_DATA, Chunk);
+    if (EepromStatus != FLASH_COMPLETE)
+    {
+      return EepromStatus;
+    }
+  }
+
+  EepromStatus = EE_VerifyPageFullWriteVariable(Handle, EE_BLOB_TAG_LENGTH, Length);
+  if (EepromStatus != FLASH_COMPLETE)
+  {
+    return EepromStatus;
+  }
+
+  EepromStatus = EE_VerifyPageFullWriteVariable(Handle, EE_BLOB_TAG_CRC, EE_BlobCrc(Handle->write_address - (((Length + EE_DATA_SIZE - 1) / EE_DATA_SIZE) + 1) * EE_RECORD_SIZE, Length));
+  if (EepromStatus != FLASH_COMPLETE)
+  {
+    return EepromStatus;
+  }
+
+  /* The key record commits the blob */
+  return EE_VerifyPageFullWriteVariable(Handle, EE_BLOB_TAG_KEY, Key);
+}
+
+/**
+  * @brief  Copy a blob of the old page to the new page during a transfer, 
+  *   unless it is damaged or its key is marked. The old page is walked newest 
+  *   first, so the first version met is copied and its key marked.
+  * @param  Handle: EEPROM instance
+  * @param  OldPage: page the blob is taken from
+  * @param  Address: address of the key record of the blob
+  * @param  Keys: keys of the blobs in the new page, see EE_BlobKeyMark()
+  * @param  KeyCount: number of keys marked
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success
+  *           - PAGE_FULL: if the new page is full
+  *           - Flash error code: on write Flash error
+  */
+static uint16_t EE_BlobTransfer(ee_handle_t* Handle, uint16_t OldPage, uint32_t Address, ee_data_t* Keys, uint16_t* KeyCount)
+{
+  uint32_t PayloadAddress;
+  uint16_t Length;
+  uint32_t Source;
+  uint16_t EepromStatus;
+
+  if (!EE_BlobCheck(EE_PAGE_BASE(Handle, OldPage), Address, &PayloadAddress, &Length))
+  {
+    return FLASH_COMPLETE;
+  }
+
+  if (EE_BlobKeyMark(Handle, Keys, KeyCount, EE_READ_DATA(Address)))
+  {
+    return FLASH_COMPLETE;
+  }
+
+  for (Source = PayloadAddress; Source <= Address; Source += EE_RECORD_SIZE)
+  {
+    EepromStatus = EE_VerifyPageFullWriteVariable(Handle, EE_READ_DATA(Source + EE_DATA_SIZE), EE_READ_DATA(Source));
+    if (EepromStatus != FLASH_COMPLETE)
+    {
+      return EepromStatus;
+    }
+  }
+
+  return FLASH_COMPLETE;
+}
+
+/**
+  * @brief  Mark the key of a blob in the new page of a transfer, the keys are 
+  *   kept sorted. Past EE_BLOB_KEYS_MAX keys, the new page is searched instead.
+  * @param  Handle: EEPROM instance
+  * @param  Keys: keys marked
+  * @param  KeyCount: number of keys marked, updated
+  * @param  Key: blob key
+  * @retval true if the key was marked already, or found in the new page
+  */
+static bool EE_BlobKeyMark(ee_handle_t* Handle, ee_data_t* Keys, uint16_t* KeyCount, ee_data_t Key)
+{
+  uint16_t Low = 0;
+  uint16_t High = *KeyCount;
+  uint16_t Mid;
+  uint32_t PayloadAddress;
+  uint16_t Length;
+
+  while (Low < High)
+  {
+    Mid = (Low + High) / 2;
+    if (Keys[Mid] < Key)
+    {
+      Low = Mid + 1;
+    }
+    else
+    {
+      High = Mid;
+    }
+  }
+
+  if ((Low < *KeyCount) && (Keys[Low] == Key))
+  {
+    return true;
+  }
+
+  if (*KeyCount == EE_BLOB_KEYS_MAX)
+  {
+    return EE_BlobFind(Handle, Handle->write_page, Handle->write_address, Key, &PayloadAddress, &Length);
+  }
+
+  for (High = *KeyCount; High > Low; High--)
+  {
+    Keys[High] = Keys[High - 1];
+  }
+  Keys[Low] = Key;
+  (*KeyCount)++;
+
+  return false;
+}
+
+#ifdef EE_CRC_ENABLE
+/**
+  * @brief  CRC of a blob payload, the low half word of the CRC-32 of its 
+  *   payload records computed by the CRC unit
+  * @param  PayloadAddress: address of the first payload record
+  * @param  Length: blob length in bytes
+  * @retval CRC of the payload records
+  */
+static uint16_t EE_BlobCrc(uint32_t PayloadAddress, uint16_t Length)
+{
+  uint32_t EndAddress = PayloadAddress + (((Length + EE_DATA_SIZE - 1) / EE_DATA_SIZE) * EE_RECORD_SIZE);
+  uint32_t Address;
+
+  CRC_ResetDR();
+  for (Address = PayloadAddress; Address < EndAddress; Address += EE_RECORD_SIZE)
+  {
+    CRC_CalcCRC((uint32_t)EE_READ_DATA(Address));
+  }
+
+  return (uint16_t)CRC_GetCRC();
+}
+#else
+/**
+  * @brief  CRC-16/CCITT of a blob payload
+  * @param  PayloadAddress: address of the first payload record
+  * @param  Length: blob length in bytes
+  * @retval CRC of the Length payload bytes
+  */
+static uint16_t EE_BlobCrc(uint32_t PayloadAddress, uint16_t Length)
+{
+  uint16_t Crc = 0xFFFF;
+  uint16_t Idx;
+  uint8_t Bit;
+
+  for (Idx = 0; Idx < Length; Idx++)
+  {
+    Crc ^= (uint16_t)EE_BlobByte(PayloadAddress, Idx) << 8;
+    for (Bit = 0; Bit < 8; Bit++)
+    {
+      Crc = (Crc & 0x8000) ? (uint16_t)((Crc << 1) ^ 0x1021) : (uint16_t)(Crc << 1);
+    }
+  }
+
+  return Crc;
+}
+#endif
+#endif
+
+/**
+  * @brief  Sort the positions of the variable table by virtual address, so 
+  *   that EE_GetVarIndex() searches them in O(log var_num)
+  * @param  Handle: EEPROM instance
+  * @retval None
+  */
+static void EE_SortVarTable(ee_handle_t* Handle)
+{
+  const ee_data_t* Table = Handle->alloc->var_addr_tab;
+  uint16_t Idx;
+  uint16_t Pos;
+  
+  /* Insertion sort, run once by EE_Init() */
+  for (Idx = 0; Idx < Handle->alloc->var_num; Idx++)
+  {
+    for (Pos = Idx; (Pos > 0) && (Table[Handle->var_order[Pos - 1]] > Table[Idx]); Pos--)
+    {
+      Handle->var_order[Pos] = Handle->var_order[Pos - 1];
+    }
+    Handle->var_order[Pos] = Idx;
+  }
+}
+
+/**
+  * @brief  Get the position of a virtual address in the variable table
+  * @param  Handle: EEPROM instance
+  * @param  VirtAddress: Variable virtual address
+  * @retval Index in the variable table, or -1 if the address is not in the table
+  */
+static int16_t EE_GetVarIndex(ee_handle_t* Handle, ee_data_t VirtAddress)
+{
+  const ee_data_t* Table = Handle->alloc->var_addr_tab;
+  uint16_t Low = 0;
+  uint16_t High = Handle->alloc->var_num;
+  uint16_t Mid;
+  
+  /* Binary search of the positions sorted by EE_SortVarTable() */
+  while (Low < High)
+  {
+    Mid = (Low + High) / 2;
+    if (Table[Handle->var_order[Mid]] < VirtAddress)
+    {
+      Low = Mid + 1;
+    }
+    else
+    {
+      High = Mid;
+    }
+  }
+  
+  if ((Low < Handle->alloc->var_num) && (Table[Handle->var_order[Low]] == VirtAddress))
+  {
+    return (int16_t)Handle->var_order[Low];
+  }
+  
+  return -1;
+}
+
+#ifdef EE_WRITEBACK_ENABLE
+/**
+  * @brief  Store a variable of the variable table in the write-back cache
+  * @param  Handle: EEPROM instance
+  * @param  VirtAddress: Variable virtual address
+  * @param  Data: variable value
+  * @retval true if cached, false if the address is not in the variable table
+  */
+static bool EE_CacheVariable(ee_handle_t* Handle, ee_data_t VirtAddress, ee_data_t Data)
+{
+  int16_t VarIdx = EE_GetVarIndex(Handle, VirtAddress);
+  
+  if (VarIdx < 0)
+  {
+    return false;
+  }
+  
+  Handle->cache_data[VarIdx] = Data;
+#ifdef EE_ISR_READ_ENABLE
+  EE_PublishVariable(Handle, VirtAddress, Data);
+#endif
+  if (!VAR_BIT_TEST(Handle->cache_dirty, VarIdx))
+  {
+    VAR_BIT_SET(Handle->cache_dirty, VarIdx);
+#ifdef EE_GET_TICK
+    if (Handle->cache_dirty_count == 0)
+    {
+      Handle->cache_dirty_since = EE_GET_TICK();
+    }
+#endif
+    Handle->cache_dirty_count++;
+  }
+  
+  return true;
+}
+#endif
+
+#ifdef EE_INDEX_ENABLE
+/**
+  * @brief  Rebuild the RAM index of Handle->read_page with a single forward pass. 
+  *   With EE_LOG_ENABLE, the pages of the ring are taken from the oldest one, 
+  *   with EE_INCREMENTAL_ENABLE, the page receiving a transfer comes last.
+  * @param  Handle: EEPROM instance
+  * @retval None
+  */
+static void EE_IndexBuild(ee_handle_t* Handle)
+{
+  uint16_t Page = Handle->read_page;
+  uint32_t PageEndAddress;
+  uint32_t Address;
+  int16_t VarIdx;
+  
+  for (VarIdx = 0; VarIdx < Handle->alloc->var_num; VarIdx++)
+  {
+    Handle->index_offset[VarIdx] = 0;
+  }
+  
+#ifdef EE_LOG_ENABLE
+  for (Page = EE_LogOldestPage(Handle); Page != NO_VALID_PAGE; Page = EE_LogNextPage(Handle, Page))
+#elif defined(EE_INCREMENTAL_ENABLE)
+  /* The page receiving a transfer holds the newer records */
+  for (Page = Handle->read_page; Page != NO_VALID_PAGE; Page = (Page == Handle->write_page) ? NO_VALID_PAGE : Handle->write_page)
+#endif
+  {
+    /* Later records overwrite earlier ones */
+    PageEndAddress = EE_FindFreeSlot(Handle, Page);
+    for (Address = EE_PAGE_BASE(Handle, Page) + EE_HEADER_SIZE; Address < PageEndAddress; Address += EE_RECORD_SIZE)
+    {
+      VarIdx = EE_GetVarIndex(Handle, EE_READ_DATA(Address + EE_DATA_SIZE));
+      if ((VarIdx >= 0) && EE_RECORD_VALID(Handle, Address))
+      {
+        Handle->index_offset[VarIdx] = EE_INDEX_ENTRY(Handle, Address);
+      }
+    }
+  }
+}
+#endif
+
+#ifdef EE_LOG_ENABLE
+/**
+  * @brief  Recover the page ring after a reset: the committed pages form the 
+  *   ring, a page being opened or retired is erased and the reclaim of the 
+  *   oldest page is completed if no erased page is left.
+  * @param  Handle: EEPROM instance
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success
+  *           - Flash error code: on write Flash error
+  */
+static uint16_t EE_LogRecover(ee_handle_t* Handle)
+{
+  FLASH_Status FlashStatus = FLASH_COMPLETE;
+  bool Committed = false;
+  uint16_t page_idx;
+  
+  for (page_idx = 0; page_idx < Handle->alloc->page_num; page_idx++)
+  {
+    if (EE_PAGE_COMMITTED(Handle, page_idx))
+    {
+      Committed = true;
+      continue;
+    }
+    
+    FlashStatus = EE_ErasePage(Handle, page_idx);
+    if (FlashStatus != FLASH_COMPLETE)
+    {
+      return FlashStatus;
+    }
+  }
+  
+  /* No committed page: format the EEPROM */
+  if (!Committed)
+  {
+    return EE_Format(Handle, 0);
+  }
+  
+  EE_LoadState(Handle);
+  
+  /* A reset after the last erased page was opened, before the oldest page was reclaimed */
+  if (EE_SelectPage(Handle, Handle->read_page) == NO_VALID_PAGE)
+  {
+    return EE_LogReclaim(Handle);
+  }
+  
+  return FlashStatus;
+}
+
+/**
+  * @brief  Open the next page of the ring once the head is full: the least worn 
+  *   erased page is committed one generation newer and becomes the head. When 
+  *   no erased page is left after it, the oldest page is reclaimed, so a page 
+  *   is erased per page filled and the ring only ever moves the live records.
+  * @param  Handle: EEPROM instance
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success
+  *           - PAGE_FULL: if no page is erased
+  *           - NO_VALID_PAGE: if no valid page was found
+  *           - Flash error code: on write Flash error
+  */
+static uint16_t EE_LogAdvance(ee_handle_t* Handle)
+{
+  FLASH_Status FlashStatus = FLASH_COMPLETE;
+  uint16_t HeadPage = Handle->read_page;
+  uint16_t NewPage;
+
+  if (HeadPage == NO_VALID_PAGE)
+  {
+    return NO_VALID_PAGE;
+  }
+  
+  NewPage = EE_SelectPage(Handle, HeadPage);
+  if (NewPage == NO_VALID_PAGE)
+  {
+    return PAGE_FULL;
+  }
+  
+  /* The new page holds no variable yet, it is committed right away */
+  FlashStatus = EE_PROGRAM_HALFWORD(EE_PAGE_BASE(Handle, NewPage) + EE_GENERATION_OFFSET, 
+                                    EE_GENERATION_NEXT(EE_PAGE_GENERATION(Handle, HeadPage)));
+  if (FlashStatus != FLASH_COMPLETE)
+  {
+    return FlashStatus;
+  }
+  
+  FlashStatus = EE_CommitPage(Handle, NewPage);
+  if (FlashStatus != FLASH_COMPLETE)
+  {
+    return FlashStatus;
+  }
+  
+  Handle->read_page = NewPage;
+  Handle->write_page = NewPage;
+  Handle->write_address = EE_PAGE_BASE(Handle, NewPage) + EE_HEADER_SIZE;
+  
+  /* Keep an erased page for the next advance */
+  if (EE_SelectPage(Handle, NewPage) == NO_VALID_PAGE)
+  {
+    return EE_LogReclaim(Handle);
+  }
+  
+  return FlashStatus;
+}
+
+/**
+  * @brief  Reclaim the oldest page of the ring: copy its live records, the 
+  *   newest record of each variable without a record in a newer page, to the 
+  *   head, then retire the page by zeroing its generation and erase it.
+  * @note   A reset in the middle is recovered by EE_Init() running the reclaim 
+  *   again, the records already copied supersede their originals.
+  * @param  Handle: EEPROM instance
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success
+  *           - PAGE_FULL: if the head is full
+  *           - Flash error code: on write Flash error
+  */
+static uint16_t EE_LogReclaim(ee_handle_t* Handle)
+{
+  FLASH_Status FlashStatus = FLASH_COMPLETE;
+  uint16_t EepromStatus = 0;
+  uint16_t OldestPage = EE_LogOldestPage(Handle);
+  uint8_t Seen[VAR_BITMAP_SIZE];
+  uint16_t SeenCount = 0;
+  uint32_t PageStartAddress;
+  uint32_t Address;
+  int16_t VarIdx;
+#ifndef EE_INDEX_ENABLE
+  uint16_t Page;
+#endif
+  
+  for (VarIdx = 0; VarIdx < VAR_BITMAP_SIZE; VarIdx++)
+  {
+    Seen[VarIdx] = 0;
+  }
+  
+#ifndef EE_INDEX_ENABLE
+  /* Variables with a record in a newer page, newest page first */
+  for (Page = Handle->read_page; (Page != OldestPage) && (Page != NO_VALID_PAGE) && (SeenCount < Handle->alloc->var_num); 
+       Page = EE_LogPreviousPage(Handle, Page))
+  {
+    PageStartAddress = EE_PAGE_BASE(Handle, Page);
+    Address = (Page == Handle->write_page) ? Handle->write_address : (EE_PAGE_END(Handle, Page) + 1);
+    for (Address -= EE_RECORD_SIZE; Address >= PageStartAddress + EE_HEADER_SIZE; Address -= EE_RECORD_SIZE)
+    {
+      VarIdx = EE_GetVarIndex(Handle, EE_READ_DATA(Address + EE_DATA_SIZE));
+      if ((VarIdx >= 0) && !VAR_BIT_TEST(Seen, VarIdx))
+      {
+        VAR_BIT_SET(Seen, VarIdx);
+        SeenCount++;
+      }
+    }
+  }
+#endif
+  
+  /* Records of the oldest page, newest first, until every variable was met */
+  PageStartAddress = EE_PAGE_BASE(Handle, OldestPage);
+  for (Address = EE_FindFreeSlot(Handle, OldestPage) - EE_RECORD_SIZE; 
+       (Address >= PageStartAddress + EE_HEADER_SIZE) && (SeenCount < Handle->alloc->var_num); Address -= EE_RECORD_SIZE)
+  {
+    VarIdx = EE_GetVarIndex(Handle, EE_READ_DATA(Address + EE_DATA_SIZE));
+    if ((VarIdx < 0) || VAR_BIT_TEST(Seen, VarIdx))
+    {
+      continue;
+    }
+    
+    VAR_BIT_SET(Seen, VarIdx);
+    SeenCount++;
+    
+#ifdef EE_INDEX_ENABLE
+    /* The index holds the newest record of each variable */
+    if (Handle->index_offset[VarIdx] != EE_INDEX_ENTRY(Handle, Address))
+    {
+      continue;
+    }
+#endif
+    
+    EepromStatus = EE_VerifyPageFullWriteVariable(Handle, Handle->alloc->var_addr_tab[VarIdx], EE_READ_DATA(Address));
+    if (EepromStatus != FLASH_COMPLETE)
+    {
+      return EepromStatus;
+    }
+  }
+  
+  /* Retire the oldest page, a reset during its erase must not leave it committed */
+  FlashStatus = EE_PROGRAM_HALFWORD(PageStartAddress + EE_GENERATION_OFFSET, 0);
+  if (FlashStatus != FLASH_COMPLETE)
+  {
+    return FlashStatus;
+  }
+  
+  return EE_ErasePage(Handle, OldestPage);
+}
+
+/**
+  * @brief  Find the oldest page of the ring with a single sweep of the page headers
+  * @param  Handle: EEPROM instance
+  * @retval Committed page of the oldest generation, NO_VALID_PAGE if none
+  */
+static uint16_t EE_LogOldestPage(ee_handle_t* Handle)
+{
+  uint16_t OldestPage = NO_VALID_PAGE;
+  uint16_t page_idx;
+  
+  for (page_idx = 0; page_idx < Handle->alloc->page_num; page_idx++)
+  {
+    if (EE_PAGE_COMMITTED(Handle, page_idx) && 
+        ((OldestPage == NO_VALID_PAGE) || 
+         EE_GENERATION_NEWER(EE_PAGE_GENERATION(Handle, OldestPage), EE_PAGE_GENERATION(Handle, page_idx))))
+    {
+      OldestPage = page_idx;
+    }
+  }
+  
+  return OldestPage;
+}
+
+/**
+  * @brief  Find the page of the ring preceding a page, the committed page one 
+  *   generation older
+  * @param  Handle: EEPROM instance
+  * @param  Page: page of the ring
+  * @retval Previous page, NO_VALID_PAGE if Page is the oldest one
+  */
+static uint16_t EE_LogPreviousPage(ee_handle_t* Handle, uint16_t Page)
+{
+  uint16_t Generation = EE_GENERATION_PREV(EE_PAGE_GENERATION(Handle, Page));
+  uint16_t page_idx;
+  
+  for (page_idx = 0; page_idx < Handle->alloc->page_num; page_idx++)
+  {
+    if (EE_PAGE_COMMITTED(Handle, page_idx) && (EE_PAGE_GENERATION(Handle, page_idx) == Generation))
+    {
+      return page_idx;
+    }
+  }
+  
+  return NO_VALID_PAGE;
+}
+
+#ifdef EE_INDEX_ENABLE
+/**
+  * @brief  Find the page of the ring following a page, the committed page one 
+  *   generation newer
+  * @param  Handle: EEPROM instance
+  * @param  Page: page of the ring
+  * @retval Next page, NO_VALID_PAGE if Page is the head
+  */
+static uint16_t EE_LogNextPage(ee_handle_t* Handle, uint16_t Page)
+{
+  uint16_t Generation = EE_GENERATION_NEXT(EE_PAGE_GENERATION(Handle, Page));
+  uint16_t page_idx;
+  
+  for (page_idx = 0; page_idx < Handle->alloc->page_num; page_idx++)
+  {
+    if (EE_PAGE_COMMITTED(Handle, page_idx) && (EE_PAGE_GENERATION(Handle, page_idx) == Generation))
+    {
+      return page_idx;
+    }
+  }
+  
+  return NO_VALID_PAGE;
+}
+#endif
+#endif
+
+#ifdef EE_INCREMENTAL_ENABLE
+/**
+  * @brief  Start a page transfer once the page written to is full: only the new 
+  *   page is opened, the variables are migrated later by EE_TransferStep(). A 
+  *   transfer still pending is completed first, erase included.
+  * @param  Handle: EEPROM instance
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success
+  *           - PAGE_FULL: if the pending transfer did not fit in its new page
+  *           - NO_VALID_PAGE: if no valid page was found
+  *           - Flash error code: on write Flash error
+  */
+static uint16_t EE_TransferBegin(ee_handle_t* Handle)
+{
+  uint16_t EepromStatus = 0;
+  uint16_t Budget = EE_STEP_UNBOUNDED;
+  uint16_t OldPage;
+  
+  EepromStatus = EE_TransferStep(Handle, &Budget, true);
+  if (EepromStatus != FLASH_COMPLETE)
+  {
+    return EepromStatus;
+  }
+  
+  OldPage = Handle->read_page;
+  EepromStatus = EE_PageTransferStart(Handle);
+  if (EepromStatus != FLASH_COMPLETE)
+  {
+    return EepromStatus;
+  }
+  
+  EE_TransferTrack(Handle, OldPage);
+  
+  return EepromStatus;
+}
+
+/**
+  * @brief  Set up the migration of the variables from the old page to 
+  *   Handle->write_page, the variables already written to it are skipped
+  * @param  Handle: EEPROM instance
+  * @param  OldPage: page the variables are taken from
+  * @retval None
+  */
+static void EE_TransferTrack(ee_handle_t* Handle, uint16_t OldPage)
+{
+  uint32_t Address;
+  int16_t VarIdx;
+  
+  Handle->transfer_page = OldPage;
+  Handle->transfer_address = EE_FindFreeSlot(Handle, OldPage) - EE_RECORD_SIZE;
+  
+  for (VarIdx = 0; VarIdx < VAR_BITMAP_SIZE; VarIdx++)
+  {
+    Handle->transfer_seen[VarIdx] = 0;
+  }
+  
+  for (Address = EE_PAGE_BASE(Handle, Handle->write_page) + EE_HEADER_SIZE; Address < Handle->write_address; Address += EE_RECORD_SIZE)
+  {
+    VarIdx = EE_GetVarIndex(Handle, EE_READ_DATA(Address + EE_DATA_SIZE));
+    if (VarIdx >= 0)
+    {
+      VAR_BIT_SET(Handle->transfer_seen, VarIdx);
+    }
+  }
+}
+
+/**
+  * @brief  Advance the pending transfer: copy the records of the old page, 
+  *   newest first, of the variables not in the new page yet, then commit the 
+  *   new page and erase the old one.
+  * @param  Handle: EEPROM instance
+  * @param  Budget: Flash operations allowed, decreased by the ones done
+  * @param  Erase: false to leave the erase of the old page pending
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success
+  *           - PAGE_FULL: if the new page is full
+  *           - Flash error code: on write Flash error
+  */
+static uint16_t EE_TransferStep(ee_handle_t* Handle, uint16_t* Budget, bool Erase)
+{
+  FLASH_Status FlashStatus = FLASH_COMPLETE;
+  uint16_t EepromStatus = 0;
+  uint32_t PageStartAddress;
+  uint32_t Address;
+  int16_t VarIdx;
+  
+  if (Handle->transfer_page == NO_VALID_PAGE)
+  {
+    return FLASH_COMPLETE;
+  }
+  
+  /* Reads come from both pages until the new one is committed */
+  PageStartAddress = EE_PAGE_BASE(Handle, Handle->transfer_page);
+  while ((*Budget > 0) && (Handle->read_page == Handle->transfer_page) && 
+         (Handle->transfer_address >= PageStartAddress + EE_HEADER_SIZE))
+  {
+    Address = Handle->transfer_address;
+    VarIdx = EE_GetVarIndex(Handle, EE_READ_DATA(Address + EE_DATA_SIZE));
+    if ((VarIdx >= 0) && !VAR_BIT_TEST(Handle->transfer_seen, VarIdx))
+    {
+      EepromStatus = EE_VerifyPageFullWriteVariable(Handle, Handle->alloc->var_addr_tab[VarIdx], EE_READ_DATA(Address));
+      if (EepromStatus != FLASH_COMPLETE)
+      {
+        return EepromStatus;
+      }
+      (*Budget)--;
+    }
+    
+    Handle->transfer_address = Address - EE_RECORD_SIZE;
+  }
+  
+  /* Every variable is in the new page, its generation supersedes the old page */
+  if ((*Budget > 0) && (Handle->read_page == Handle->transfer_page))
+  {
+    FlashStatus = EE_CommitPage(Handle, Handle->write_page);
+    if (FlashStatus != FLASH_COMPLETE)
+    {
+      return FlashStatus;
+    }
+    Handle->read_page = Handle->write_page;
+    (*Budget)--;
+  }
+  
+  if (Erase && (*Budget > 0) && (Handle->read_page != Handle->transfer_page))
+  {
+    FlashStatus = EE_ErasePage(Handle, Handle->transfer_page);
+    if (FlashStatus != FLASH_COMPLETE)
+    {
+      return FlashStatus;
+    }
+    Handle->transfer_page = NO_VALID_PAGE;
+    (*Budget)--;
+  }
+  
+  return FlashStatus;
+}
+#endif
+
+#if defined(EE_LOG_ENABLE) || defined(EE_INCREMENTAL_ENABLE)
+/**
+  * @brief  Get the page holding the records preceding the ones of a page
+  * @param  Handle: EEPROM instance
+  * @param  Page: page holding newer records
+  * @retval Page holding older records, NO_VALID_PAGE if none
+  */
+static uint16_t EE_OlderPage(ee_handle_t* Handle, uint16_t Page)
+{
+#ifdef EE_LOG_ENABLE
+  return EE_LogPreviousPage(Handle, Page);
+#else
+  /* The page receiving a transfer comes before the one the variables are taken from */
+  return ((Page == Handle->write_page) && (Page != Handle->read_page)) ? Handle->read_page : NO_VALID_PAGE;
+#endif
+}
+#endif
+
+#ifdef EE_RTOS_ENABLE
+/**
+  * @brief  Returns the newest data of a variable of the variable table from the 
+  *   RAM index, without taking the lock. The index entry is read again after 
+  *   the data: the entries follow the records before the page they left is 
+  *   erased, so an unchanged entry means the data came from a live record.
+  * @param  Handle: EEPROM instance
+  * @param  VirtAddress: Variable virtual address
+  * @param  Data: receives the variable value
+  * @retval true if the variable was read, false if the pages must be scanned 
+  *   under the lock: the variable is not in the table, was never written or 
+  *   the index is being rebuilt
+  */
+static bool EE_IndexRead(ee_handle_t* Handle, ee_data_t VirtAddress, ee_data_t* Data)
+{
+  __IO uint16_t* IndexOffset = Handle->index_offset;
+  int16_t VarIdx = EE_GetVarIndex(Handle, VirtAddress);
+  uint16_t Entry;
+
+  if ((VarIdx < 0) || (Handle->read_page == NO_VALID_PAGE))
+  {
+    return false;
+  }
+
+  do
+  {
+    Entry = IndexOffset[VarIdx];
+    if (Entry == 0)
+    {
+      return false;
+    }
+    *Data = EE_READ_DATA(EE_INDEX_ADDRESS(Handle, Entry));
+  } while (IndexOffset[VarIdx] != Entry);
+
+  return true;
+}
+
+/**
+  * @brief  Program a half word or a word, the calling thread sleeps on a 
+  *   semaphore released by EE_FLASH_IRQHandler() until each half word is 
+  *   programmed. Before the kernel runs, the program is polled like 
+  *   FLASH_ProgramHalfWord() and FLASH_ProgramWord() do.
+  * @param  Address: address to program, half word aligned
+  * @param  Data: data to program, the low half word first
+  * @param  HalfWords: 1 for a half word, 2 for a word
+  * @retval FLASH_COMPLETE on success, FLASH_TIMEOUT or a Flash error code otherwise
+  */
+static FLASH_Status EE_FlashProgram(uint32_t Address, uint32_t Data, uint16_t HalfWords)
+{
+  FLASH_Status FlashStatus = FLASH_COMPLETE;
+
+  if (!osKernelRunning())
+  {
+    return (HalfWords == 1) ? FLASH_ProgramHalfWord(Address, (uint16_t)Data) : FLASH_ProgramWord(Address, Data);
+  }
+
+  while ((HalfWords-- > 0) && (FlashStatus == FLASH_COMPLETE))
+  {
+    FlashStatus = EE_FlashStart();
+    if (FlashStatus == FLASH_COMPLETE)
+    {
+      FLASH->CR |= FLASH_CR_PG;
+      *(__IO uint16_t*)Address = (uint16_t)Data;
+      FlashStatus = EE_FlashSleep();
+    }
+    Address += 2;
+    Data >>= 16;
+  }
+
+  return FlashStatus;
+}
+
+/**
+  * @brief  Erase a page, the calling thread sleeps on a semaphore released by 
+  *   EE_FLASH_IRQHandler() instead of polling the busy flag. Before the kernel 
+  *   runs, the erase is polled like FLASH_ErasePage() does.
+  * @note   The CPU stalls on Flash fetches during the erase, only the threads 
+  *   running from RAM make progress meanwhile.
+  * @param  PageAddress: address of the page to erase
+  * @retval FLASH_COMPLETE on success, FLASH_TIMEOUT or a Flash error code otherwise
+  */
+static FLASH_Status EE_FlashErasePage(uint32_t PageAddress)
+{
+  FLASH_Status FlashStatus;
+
+  if (!osKernelRunning())
+  {
+    return FLASH_ErasePage(PageAddress);
+  }
+
+  FlashStatus = EE_FlashStart();
+  if (FlashStatus != FLASH_COMPLETE)
+  {
+    return FlashStatus;
+  }
+
+  FLASH->CR |= FLASH_CR_PER;
+  FLASH->AR = PageAddress;
+  FLASH->CR |= FLASH_CR_STRT;
+
+  return EE_FlashSleep();
+}
+
+/**
+  * @brief  Prepare the start of a Flash operation: wait on the semaphore for 
+  *   the end of one which timed out, drop the token its end left, clear the 
+  *   flags and enable the EOP and ERR interrupts.
+  * @param  None
+  * @retval FLASH_COMPLETE, or FLASH_TIMEOUT if the Flash stays busy
+  */
+static FLASH_Status EE_FlashStart(void)
+{
+  if ((FLASH->SR & FLASH_SR_BSY) != 0)
+  {
+    osSemaphoreWait(EepromFlashDone, EE_FLASH_WAIT_MS);
+    if ((FLASH->SR & FLASH_SR_BSY) != 0)
+    {
+      return FLASH_TIMEOUT;
+    }
+  }
+  while (osSemaphoreWait(EepromFlashDone, 0) > 0)
+  {
+  }
+
+  FLASH->SR = FLASH_SR_EOP | FLASH_SR_PGERR | FLASH_SR_WRPERR;
+  FLASH_ITConfig(FLASH_IT_EOP | FLASH_IT_ERR, ENABLE);
+
+  return FLASH_COMPLETE;
+}
+
+/**
+  * @brief  Sleep until the end of the Flash operation just started. On a 
+  *   timeout the interrupts stay enabled, the late end of the operation 
+  *   releases the semaphore for EE_FlashStart().
+  * @param  None
+  * @retval FLASH_COMPLETE on success, FLASH_TIMEOUT or a Flash error code otherwise
+  */
+static FLASH_Status EE_FlashSleep(void)
+{
+  if (osSemaphoreWait(EepromFlashDone, EE_FLASH_WAIT_MS) == 0)
+  {
+    return FLASH_TIMEOUT;
+  }
+
+  FLASH_ITConfig(FLASH_IT_EOP | FLASH_IT_ERR, DISABLE);
+
+  return EepromFlashStatus;
+}
+#endif
+
+#ifdef EE_SERVICE_ENABLE
+/**
+  * @brief  Body of the service thread: serves the queued requests in batches 
+  *   and, once no request came for EE_SERVICE_IDLE_MS, runs the idle work one 
+  *   step at a time, checking the queue between the steps.
+  * @param  Argument: unused
+  * @retval None
+  */
+static void EE_ServiceThread(void const* Argument)
+{
+  uint32_t Timeout = EE_SERVICE_IDLE_MS;
+  osEvent Event;
+
+  for (;;)
+  {
+    Event = osMailGet(ServiceQueue, Timeout);
+    if (Event.status == osEventMail)
+    {
+      EE_ServiceBatch((ee_service_req_t*)Event.value.p);
+      Timeout = EE_SERVICE_IDLE_MS;
+    }
+    else if (EE_ServiceIdle())
+    {
+      Timeout = 0;
+    }
+    else
+    {
+      Timeout = osWaitForever;
+    }
+  }
+}
+
+/**
+  * @brief  Serves a request and the ones queued behind it. The urgent requests 
+  *   are served first, but the requests to a variable keep their queue order: 
+  *   each one is served at the most urgent priority of the ones queued after 
+  *   it. Within a priority level, the writes are gathered in one 
+  *   EE_WriteVariables() call per instance, which is made before a read of a 
+  *   variable they write, so that a read sees the writes queued before it and 
+  *   none of the ones queued after it. A write superseded by a later write to 
+  *   the same variable, with no read of it in between, is not written, it 
+  *   completes with the later one, which takes the higher priority of the two.
+  * @param  First: first request, already taken from the queue
+  * @retval None
+  */
+static void EE_ServiceBatch(ee_service_req_t* First)
+{
+  ee_service_req_t* Reqs[EE_SERVICE_QUEUE_SIZE];
+  uint16_t Owner[EE_SERVICE_QUEUE_SIZE];
+  uint8_t State[EE_SERVICE_QUEUE_SIZE];
+  uint16_t Count = 0;
+  uint16_t Idx;
+  uint16_t Next;
+  uint8_t Priority;
+  osEvent Event;
+#ifdef EE_MULT_ENABLE
+  ee_handle_t* Handle;
+#endif
+
+  Reqs[Count++] = First;
+
+  /* Take the requests queued meanwhile */
+  while (Count < EE_SERVICE_QUEUE_SIZE)
+  {
+    Event = osMailGet(ServiceQueue, 0);
+    if (Event.status != osEventMail)
+    {
+      break;
+    }
+    Reqs[Count++] = (ee_service_req_t*)Event.value.p;
+  }
+
+  /* Newest first: a request takes the priority of the next one to its 
+     variable if higher, and a write is owned by the last write to its 
+     variable which no read of it separates from it */
+  for (Idx = Count; Idx-- > 0; )
+  {
+    Owner[Idx] = Idx;
+    State[Idx] = EE_SERVICE_QUEUED;
+    for (Next = Idx + 1; (Next < Count) && !EE_SERVICE_SAME_VAR(Reqs[Idx], Reqs[Next]); Next++)
+    {
+    }
+    if (Next == Count)
+    {
+      continue;
+    }
+    if (Reqs[Next]->priority < Reqs[Idx]->priority)
+    {
+      Reqs[Idx]->priority = Reqs[Next]->priority;
+    }
+    if (!Reqs[Idx]->read && !Reqs[Next]->read)
+    {
+      Owner[Idx] = Owner[Next];
+      if (Reqs[Idx]->priority < Reqs[Owner[Idx]]->priority)
+      {
+        Reqs[Owner[Idx]]->priority = Reqs[Idx]->priority;
+      }
+    }
+  }
+
+#ifdef EE_MULT_ENABLE
+  for (Idx = 0; Idx < Count; Idx++)
+  {
+    for (Next = 0; (Next < ServiceHandleCount) && (ServiceHandles[Next] != Reqs[Idx]->handle); Next++)
+    {
+    }
+    if ((Next == ServiceHandleCount) && (ServiceHandleCount < EE_NUM))
+    {
+      ServiceHandles[ServiceHandleCount++] = Reqs[Idx]->handle;
+    }
+  }
+#endif
+
+  for (Priority = EE_SERVICE_URGENT; Priority <= EE_SERVICE_NORMAL; Priority++)
+  {
+    for (Idx = 0; Idx < Count; Idx++)
+    {
+      if (Reqs[Idx]->priority != Priority)
+      {
+        continue;
+      }
+      if (!Reqs[Idx]->read)
+      {
+        if (Owner[Idx] == Idx)
+        {
+          State[Idx] = EE_SERVICE_PENDING;
+        }
+        continue;
+      }
+
+      /* The writes of the variable queued before the read reach it first */
+      for (Next = 0; (Next < Idx) && 
+           ((State[Next] != EE_SERVICE_PENDING) || !EE_SERVICE_SAME_VAR(Reqs[Idx], Reqs[Next])); Next++)
+      {
+      }
+      if (Next < Idx)
+      {
+        EE_ServiceWrites(Reqs, Owner, State, Count);
+      }
+#ifdef EE_MULT_ENABLE
+      Handle = Reqs[Idx]->handle;
+#endif
+      *Reqs[Idx]->status = EE_ReadVariable(EE_HANDLE_ARG_FIRST Reqs[Idx]->var.addr, Reqs[Idx]->data);
+      State[Idx] = EE_SERVICE_DONE;
+      osSignalSet(Reqs[Idx]->thread, EE_SERVICE_SIGNAL);
     }
+    EE_ServiceWrites(Reqs, Owner, State, Count);
+  }
+
+  for (Idx = 0; Idx < Count; Idx++)
+  {
+    osMailFree(ServiceQueue, Reqs[Idx]);
   }
-    
-  return (ee_status_t) FLASH_COMPLETE;
 }
 
 /**
-  * @brief  Returns the last stored variable data, if found, which correspond to
-  *   the passed virtual address
-  * @param  VirtAddress: Variable virtual address
-  * @param  Data: Global variable contains the read variable value
-  * @retval Success or error status:
-  *           - 0: if variable was found
-  *           - 1: if the variable was not found
-  *           - NO_VALID_PAGE: if no valid page was found.
+  * @brief  Writes the pending writes of a batch, in one EE_WriteVariables() 
+  *   call per instance, and completes them with the writes they own.
+  * @param  Reqs: requests of the batch, in queue order
+  * @param  Owner: index of the write which completes each write
+  * @param  State: state of each request, the pending writes end done
+  * @param  Count: number of requests
+  * @retval None
   */
-ee_status_t EE_ReadVariable(ee_data_t VirtAddress, ee_data_t* Data)
+static void EE_ServiceWrites(ee_service_req_t** Reqs, const uint16_t* Owner, uint8_t* State, uint16_t Count)
 {
-  uint16_t ValidPage = NO_VALID_PAGE;
-  uint16_t AddressValue = 0x5555;
-  uint16_t ReadStatus = 1;
-  uint32_t PageStartAddress = PAGE0_BASE_ADDRESS;
-  uint32_t Address = PAGE0_END_ADDRESS - 1;
-  
-  /* Get active Page for read operation */
-  ValidPage = EE_FindValidPage(READ_FROM_VALID_PAGE);
-
-  /* Check if there is no valid page */
-  if (ValidPage == NO_VALID_PAGE)
-  {
-    return  NO_VALID_PAGE;
-  }
+  ee_var_t Vars[EE_SERVICE_QUEUE_SIZE];
+  uint16_t VarCount;
+  uint16_t Idx;
+  uint16_t Next;
+  ee_status_t Status;
+#ifdef EE_MULT_ENABLE
+  ee_handle_t* Handle;
+#endif
 
-  /* Get the valid Page start Address */
-  PageStartAddress = PAGE_BASE_ADDRESS(ValidPage);
-  /* Get the valid Page end Address */
-  Address = PAGE_END_ADDRESS(ValidPage) - 1;
-  
-  /* Check each active page address starting from end */
-  while (Address > (PageStartAddress + 2))
+  for (Idx = 0; Idx < Count; Idx++)
   {
-    /* Get the current location content to be compared with virtual address */
-    AddressValue = (*(__IO uint16_t*)Address);
+    if (State[Idx] != EE_SERVICE_PENDING)
+    {
+      continue;
+    }
+#ifdef EE_MULT_ENABLE
+    Handle = Reqs[Idx]->handle;
+#endif
 
-    /* Compare the read address with the virtual address */
-    if (AddressValue == VirtAddress)
+    VarCount = 0;
+    for (Next = Idx; Next < Count; Next++)
     {
-      /* Get content of Address-2 which is variable value */
-      *Data = (*(__IO uint16_t*)(Address - 2));
+      if ((State[Next] == EE_SERVICE_PENDING) && EE_SERVICE_SAME_HANDLE(Reqs[Idx], Reqs[Next]))
+      {
+        Vars[VarCount++] = Reqs[Next]->var;
+        State[Next] = EE_SERVICE_WRITTEN;
+      }
+    }
 
-      /* In case variable value is read, reset ReadStatus flag */
-      ReadStatus = 0;
+    Status = EE_WriteVariables(EE_HANDLE_ARG_FIRST Vars, VarCount);
 
-      break;
-    }
-    else
+    /* The owned writes come before their owner */
+    for (Next = 0; Next < Count; Next++)
     {
-      /* Next address location */
-      Address = Address - 4;
+      if (!Reqs[Next]->read && (State[Next] != EE_SERVICE_DONE) && (State[Owner[Next]] == EE_SERVICE_WRITTEN))
+      {
+        State[Next] = EE_SERVICE_DONE;
+        if (Reqs[Next]->callback)
+        {
+          Reqs[Next]->callback(Reqs[Next]->var.addr, Status);
+        }
+      }
     }
   }
-
-  /* Return ReadStatus value: (0: variable exist, 1: variable doesn't exist) */
-  return ReadStatus;
 }
 
 /**
-  * @brief  Writes/upadtes variable data in EEPROM.
-  * @param  VirtAddress: Variable virtual address
-  * @param  Data: 16 bit data to be written
-  * @retval Success or error status:
-  *           - FLASH_COMPLETE: on success
-  *           - PAGE_FULL: if valid page is full
-  *           - NO_VALID_PAGE: if no valid page was found
-  *           - Flash error code: on write Flash error
+  * @brief  Runs one step of the idle work of each instance served, 
+  *   EE_Maintenance().
+  * @param  None
+  * @retval true if work was done, more may be left
   */
-ee_status_t EE_WriteVariable(ee_data_t VirtAddress, ee_data_t Data)
+static bool EE_ServiceIdle(void)
 {
-  uint16_t Status = 0;
-
-  /* Write the variable virtual address and value in the EEPROM */
-  Status = EE_VerifyPageFullWriteVariable(VirtAddress, Data);
+  bool Busy = false;
+#ifdef EE_MAINTENANCE_ENABLE
+  uint16_t Work;
+#ifdef EE_MULT_ENABLE
+  ee_handle_t* Handle;
+  uint16_t Idx;
 
-  /* In case the EEPROM active page is full */
-  if (Status == PAGE_FULL)
+  for (Idx = 0; Idx < ServiceHandleCount; Idx++)
+#endif
   {
-    /* Perform Page transfer */
-    Status = EE_PageTransfer(VirtAddress, Data);
+#ifdef EE_MULT_ENABLE
+    Handle = ServiceHandles[Idx];
+#endif
+    if ((EE_Maintenance(EE_HANDLE_ARG_FIRST &Work) == EE_SUCCESS) && (Work > 0))
+    {
+      Busy = true;
+    }
   }
+#endif
 
-  /* Return last operation status */
-  return Status;
+  return Busy;
 }
+#endif
+
+
 
+#ifdef EE_ISR_RING_ENABLE
 /**
-  * @brief  Erases PAGE0 and PAGE1 and writes VALID_PAGE header to PAGE0
-  * @param  None
-  * @retval Status of the last operation (Flash write or erase) done during
-  *         EEPROM formating
+  * @brief  Find the newest value of a variable in the ring of the writes 
+  *   queued by the interrupts. The ring is walked from the head, the walk is 
+  *   started again if EE_DrainISRWrites() released entries meanwhile, as the 
+  *   interrupts may have reused them.
+  * @param  Handle: EEPROM instance
+  * @param  VirtAddress: Variable virtual address
+  * @param  Data: receives the queued value
+  * @retval true if a write of the variable is queued
   */
-static FLASH_Status EE_Format(uint16_t initial_page)
+static bool EE_ISRLookup(ee_handle_t* Handle, ee_data_t VirtAddress, ee_data_t* Data)
 {
-  FLASH_Status FlashStatus = FLASH_COMPLETE;
-  uint16_t page_idx;
-  
-  //assert_param((IS_VALID_PAGE_INDEX(initial_page));
-  
-  for(page_idx = 0; page_idx < PAGE_NUM; page_idx++)
+  uint16_t Tail;
+  uint16_t Idx;
+  bool Found;
+
+  do
   {
-    FlashStatus = FLASH_ErasePage(PAGE_BASE_ADDRESS(page_idx));
-    if (FlashStatus != FLASH_COMPLETE)
-    {
-      return FlashStatus;
-    }
-    
-    /* Set Page0 as valid page: Write VALID_PAGE at initial_page base address */
-    if(page_idx == initial_page)
+    Tail = Handle->isr_tail;
+    Found = false;
+    for (Idx = Handle->isr_head; Idx != Tail; )
     {
-      FlashStatus = FLASH_ProgramHalfWord(PAGE_BASE_ADDRESS(page_idx), VALID_PAGE);
-      if (FlashStatus != FLASH_COMPLETE)
+      Idx = (Idx + EE_ISR_RING_SIZE - 1) % EE_ISR_RING_SIZE;
+      if (Handle->isr_ring[Idx].addr == VirtAddress)
       {
-        return FlashStatus;
+        *Data = Handle->isr_ring[Idx].data;
+        Found = true;
+        break;
       }
     }
-  }
-  
-      
-  return FlashStatus;
+  } while (Tail != Handle->isr_tail);
+
+  return Found;
 }
+#endif
 
+#ifdef EE_ISR_READ_ENABLE
 /**
-  * @brief  Find valid Page for write or read operation
-  * @param  Operation: operation to achieve on the valid page.
-  *   This parameter can be one of the following values:
-  *     @arg READ_FROM_VALID_PAGE: read operation from valid page
-  *     @arg WRITE_IN_VALID_PAGE: write operation from valid page
-  * @retval Valid page number (PAGE0 or PAGE1) or NO_VALID_PAGE in case
-  *   of no valid page was found
+  * @brief  Publish the new value of a variable to EE_ReadVariableFromISR(), 
+  *   called with the EEPROM locked. While a copy of the value table is 
+  *   updated, isr_seq designates the other one to the readers.
+  * @param  Handle: EEPROM instance
+  * @param  VirtAddress: Variable virtual address, ignored if not in the 
+  *   variable table
+  * @param  Data: newest value of the variable
+  * @retval None
   */
-static uint16_t EE_FindValidPage(uint8_t Operation)
+static void EE_PublishVariable(ee_handle_t* Handle, ee_data_t VirtAddress, ee_data_t Data)
 {
-  ee_page_status_t page_status[PAGE_NUM];
-  uint16_t page_idx;
-  uint16_t valid_page;
-  
-  /* Read all pages' status */
-  for(page_idx = 0; page_idx < PAGE_NUM; page_idx++)
+  int16_t VarIdx = EE_GetVarIndex(Handle, VirtAddress);
+
+  if (VarIdx < 0)
   {
-    page_status[page_idx] = (*(__IO uint16_t*)PAGE_BASE_ADDRESS(page_idx));
+    return;
   }
-  
-  /* Scan for a valid page */
-  switch (Operation){
-    case WRITE_IN_VALID_PAGE:       // if only VALID, return valid, if a RECEIVE after VALID, return RECEIVE
-      for(page_idx  = 0; page_idx < PAGE_NUM; page_idx++)
-      {
-        if(page_status[page_idx] == VALID_PAGE)
-        {
-          uint16_t next_page = PAGE_NEXT(page_idx);
-          if(page_status[next_page] == RECEIVE_DATA)
-          {
-            return next_page;
-          }
-          else
-          {
-            return page_idx;
-          }
-        }
-      }
-      
-      return NO_VALID_PAGE;   /* No valid Page */
 
-    case READ_FROM_VALID_PAGE:
-      for(page_idx  = 0; page_idx < PAGE_NUM; page_idx++)
-      {
-        if(page_status[page_idx] == VALID_PAGE)
-        {
-          return page_idx;
-        }
-      }
-      
-      return NO_VALID_PAGE;   /* No valid Page */
-      
-    default:
-      return PAGE0;
-      break;
-  }
+  /* Single core: the volatile accesses keep their order */
+  Handle->isr_seq++;
+  Handle->isr_value[0][VarIdx] = Data;
+  Handle->isr_seq++;
+  Handle->isr_value[1][VarIdx] = Data;
+  VAR_BIT_SET(Handle->isr_known, VarIdx);
 }
 
-
 /**
-  * @brief  Verify if active page is full and Writes variable in EEPROM.
-  * @param  VirtAddress: 16 bit virtual address of the variable
-  * @param  Data: 16 bit data to be written as variable value
-  * @retval Success or error status:
-  *           - FLASH_COMPLETE: on success
-  *           - PAGE_FULL: if valid page is full
-  *           - NO_VALID_PAGE: if no valid page was found
-  *           - Flash error code: on write Flash error
+  * @brief  Load the value table of EE_ReadVariableFromISR() from the pages and 
+  *   the write-back cache, once the pages are recovered.
+  * @param  Handle: EEPROM instance
+  * @retval None
   */
-static uint16_t EE_VerifyPageFullWriteVariable(ee_data_t VirtAddress, ee_data_t Data)
+static void EE_PublishAll(ee_handle_t* Handle)
 {
-  FLASH_Status FlashStatus = FLASH_COMPLETE;
-  uint16_t ValidPage = PAGE0;
-  uint32_t Address = PAGE0_BASE_ADDRESS;        //0x08010000;     FIXME
-  uint32_t PageEndAddress = PAGE0_END_ADDRESS;  // 0x080107FF;    // FIXME
-   
-  /* Get valid Page for write operation */
-  ValidPage = EE_FindValidPage(WRITE_IN_VALID_PAGE);
+  ee_data_t Data[EE_VAR_MAX];
+  uint8_t Found[EE_VAR_MAX];
+  uint16_t VarIdx;
 
-  /* Check if there is no valid page */
-  if (ValidPage == NO_VALID_PAGE)
+  for (VarIdx = 0; VarIdx < Handle->alloc->var_num; VarIdx++)
   {
-    return  NO_VALID_PAGE;
+    Found[VarIdx] = 0;
   }
+  EE_ReadStoredVariables(Handle, Handle->alloc->var_addr_tab, Data, Found, Handle->alloc->var_num);
 
-  /* Get the valid Page start Address */
-  Address = PAGE_BASE_ADDRESS(ValidPage);
-  /* Get the valid Page end Address */
-  PageEndAddress = PAGE_END_ADDRESS(ValidPage) - 1;  //FIXME: need some check
-  
-  /* Check each active page address starting from begining */
-  while (Address < PageEndAddress)
+  /* The variables lost to a format are not found anymore */
+  for (VarIdx = 0; VarIdx < VAR_BITMAP_SIZE; VarIdx++)
   {
-    /* Verify if Address and Address+2 contents are 0xFFFFFFFF */
-    if ((*(__IO uint32_t*)Address) == 0xFFFFFFFF)
+    Handle->isr_known[VarIdx] = 0;
+  }
+
+  for (VarIdx = 0; VarIdx < Handle->alloc->var_num; VarIdx++)
+  {
+#ifdef EE_WRITEBACK_ENABLE
+    if (VAR_BIT_TEST(Handle->cache_dirty, VarIdx))
     {
-      /* Set variable data */
-      FlashStatus = FLASH_ProgramHalfWord(Address, Data);
-      /* If program operation was failed, a Flash error code is returned */
-      if (FlashStatus != FLASH_COMPLETE)
-      {
-        return FlashStatus;
-      }
-      /* Set variable virtual address */
-      FlashStatus = FLASH_ProgramHalfWord(Address + 2, VirtAddress);
-      /* Return program operation status */
-      return FlashStatus;
+      Data[VarIdx] = Handle->cache_data[VarIdx];
+      Found[VarIdx] = 1;
     }
-    else
+#endif
+    if (Found[VarIdx])
     {
-      /* Next address location */
-      Address = Address + 4;
+      EE_PublishVariable(Handle, Handle->alloc->var_addr_tab[VarIdx], Data[VarIdx]);
     }
   }
-
-  /* Return PAGE_FULL in case the valid page is full */
-  return PAGE_FULL;
 }
+#endif
 
+#ifdef EE_RAMFUNC_ENABLE
 /**
-  * @brief  Transfers last updated variables data from the full Page to
-  *   an empty one.
-  * @param  VirtAddress: 16 bit virtual address of the variable
-  * @param  Data: 16 bit data to be written as variable value
-  * @retval Success or error status:
-  *           - FLASH_COMPLETE: on success
-  *           - PAGE_FULL: if valid page is full
-  *           - NO_VALID_PAGE: if no valid page was found
-  *           - Flash error code: on write Flash error
+  * @brief  Wait for the end of the Flash operation in progress, from SRAM: 
+  *   FLASH_WaitForLastOperation() would stall on its own fetches. Nothing 
+  *   outside of the .ramfunc section is called while the Flash is busy. 
+  *   With EE_LOWPOWER_ENABLE the timeout is EE_ERASE_TIMEOUT_MS of 
+  *   EE_GET_TICK(), otherwise FLASH_ER_PRG_TIMEOUT polls of the busy flag.
+  * @param  None
+  * @retval FLASH_COMPLETE on success, FLASH_TIMEOUT or a Flash error code otherwise
   */
-static uint16_t EE_PageTransfer(ee_data_t VirtAddress, ee_data_t Data)
+static EE_RAMFUNC FLASH_Status EE_RamWait(void)
 {
-  FLASH_Status FlashStatus = FLASH_COMPLETE;
-  uint32_t NewPageAddress = EEPROM_START_ADDRESS;   // FIXME: Not proper
-  uint32_t OldPageAddress = EEPROM_START_ADDRESS;   // FIXME: Not proper
-  uint16_t ValidPage = PAGE0, VarIdx = 0;
-  uint16_t EepromStatus = 0, ReadStatus = 0;
-
-  /* Get active Page for read operation */
-  ValidPage = EE_FindValidPage(READ_FROM_VALID_PAGE);
+#ifdef EE_LOWPOWER_ENABLE
+  uint32_t Start = EE_GET_TICK();
+#else
+  uint32_t Timeout = FLASH_ER_PRG_TIMEOUT;
+#endif
 
-  /* Set New and Old page address */
-  if (ValidPage != NO_VALID_PAGE)
+  while ((FLASH->SR & FLASH_SR_BSY) != 0)
   {
-    /* New page address where variable will be moved to */
-    NewPageAddress = PAGE_BASE_ADDRESS(PAGE_NEXT(ValidPage)); 
+#ifdef EE_LOWPOWER_ENABLE
+    if ((uint32_t)(EE_GET_TICK() - Start) >= EE_ERASE_TIMEOUT_MS)
+#else
+    if (--Timeout == 0)
+#endif
+    {
+      return FLASH_TIMEOUT;
+    }
+  }
 
-    /* Old page address where variable will be taken from */
-    OldPageAddress = PAGE_BASE_ADDRESS(ValidPage);
+  if ((FLASH->SR & FLASH_SR_WRPERR) != 0)
+  {
+    return FLASH_ERROR_WRP;
   }
-  else
+  if ((FLASH->SR & FLASH_SR_PGERR) != 0)
   {
-    return NO_VALID_PAGE;       /* No valid Page */
+    return FLASH_ERROR_PROGRAM;
   }
+  return FLASH_COMPLETE;
+}
 
-  /* Set the new Page status to RECEIVE_DATA status */
-  FlashStatus = FLASH_ProgramHalfWord(NewPageAddress, RECEIVE_DATA);
-  /* If program operation was failed, a Flash error code is returned */
-  if (FlashStatus != FLASH_COMPLETE)
+/**
+  * @brief  Program a half word or a word from SRAM, like FLASH_ProgramHalfWord() 
+  *   and FLASH_ProgramWord() do. The error flags, reported by the wait of the 
+  *   operation which set them, are cleared before the program starts.
+  * @param  Address: address to program, half word aligned
+  * @param  Data: data to program, the low half word first
+  * @param  HalfWords: 1 for a half word, 2 for a word
+  * @retval FLASH_COMPLETE on success, FLASH_TIMEOUT or a Flash error code otherwise
+  */
+static EE_RAMFUNC FLASH_Status EE_RamProgram(uint32_t Address, uint32_t Data, uint16_t HalfWords)
+{
+  FLASH_Status FlashStatus = EE_RamWait();
+
+  if (FlashStatus == FLASH_TIMEOUT)
   {
     return FlashStatus;
   }
 
-  /* Write the variable passed as parameter in the new active page */
-  EepromStatus = EE_VerifyPageFullWriteVariable(VirtAddress, Data);
-  /* If program operation was failed, a Flash error code is returned */
-  if (EepromStatus != FLASH_COMPLETE)
+  FLASH->SR = FLASH_SR_EOP | FLASH_SR_PGERR | FLASH_SR_WRPERR;
+  FlashStatus = FLASH_COMPLETE;
+  FLASH->CR |= FLASH_CR_PG;
+  while ((HalfWords-- > 0) && (FlashStatus == FLASH_COMPLETE))
   {
-    return EepromStatus;
+    *(__IO uint16_t*)Address = (uint16_t)Data;
+    FlashStatus = EE_RamWait();
+    Address += 2;
+    Data >>= 16;
+  }
+  FLASH->CR &= ~FLASH_CR_PG;
+
+  return FlashStatus;
+}
+
+/**
+  * @brief  Erase a page from SRAM, like FLASH_ErasePage() does. The error 
+  *   flags are cleared before the erase starts, as in EE_RamProgram().
+  * @param  PageAddress: address of the page to erase
+  * @retval FLASH_COMPLETE on success, FLASH_TIMEOUT or a Flash error code otherwise
+  */
+static EE_RAMFUNC FLASH_Status EE_RamErasePage(uint32_t PageAddress)
+{
+  FLASH_Status FlashStatus = EE_RamWait();
+#ifdef EE_LOWPOWER_ENABLE
+  uint32_t Scr = SCB->SCR;
+#endif
+
+  if (FlashStatus == FLASH_TIMEOUT)
+  {
+    return FlashStatus;
   }
 
-  /* Transfer process: transfer variables from old to the new active page */
-  for (VarIdx = 0; VarIdx < NB_OF_VAR; VarIdx++)
+  FLASH->SR = FLASH_SR_EOP | FLASH_SR_PGERR | FLASH_SR_WRPERR;
+#ifdef EE_LOWPOWER_ENABLE
+  /* The end of the erase sets FLASH_IRQn pending, which wakes WFE */
+  SCB->SCR = Scr | SCB_SCR_SEVONPEND_Msk;
+  FLASH->CR |= FLASH_CR_EOPIE | FLASH_CR_ERRIE;
+#endif
+  FLASH->CR |= FLASH_CR_PER;
+  FLASH->AR = PageAddress;
+  FLASH->CR |= FLASH_CR_STRT;
+#ifdef EE_LOWPOWER_ENABLE
+  FlashStatus = EE_RamSleep();
+  FLASH->CR &= ~(FLASH_CR_PER | FLASH_CR_EOPIE | FLASH_CR_ERRIE);
+  FLASH->SR = FLASH_SR_EOP | FLASH_SR_PGERR | FLASH_SR_WRPERR;
+  NVIC->ICPR[0] = 1UL << FLASH_IRQn;
+  SCB->SCR = Scr;
+#else
+  FlashStatus = EE_RamWait();
+  FLASH->CR &= ~FLASH_CR_PER;
+#endif
+
+  return FlashStatus;
+}
+
+#ifdef EE_LOWPOWER_ENABLE
+/**
+  * @brief  Sleep until the end of the page erase in progress, from SRAM. The 
+  *   EOP and ERR interrupts are enabled in the Flash but not in the NVIC, with 
+  *   SEVONPEND their pending state wakes WFE without running a handler. The 
+  *   other interrupts are served as usual and wake it as well, the SysTick 
+  *   ones let the timeout expire.
+  * @note   The programs, tens of microseconds long, keep polling in EE_RamWait() 
+  *   with the same timeout.
+  * @param  None
+  * @retval FLASH_COMPLETE on success, FLASH_TIMEOUT or a Flash error code otherwise
+  */
+static EE_RAMFUNC FLASH_Status EE_RamSleep(void)
+{
+  uint32_t Start = EE_GET_TICK();
+
+  while ((FLASH->SR & FLASH_SR_BSY) != 0)
   {
-    if (VirtAddVarTab[VarIdx] != VirtAddress)  /* Check each variable except the one passed as parameter */
+    if ((uint32_t)(EE_GET_TICK() - Start) >= EE_ERASE_TIMEOUT_MS)
     {
-      /* Read the other last variable updates */
-      ReadStatus = EE_ReadVariable(VirtAddVarTab[VarIdx], &DataVar);
-      /* In case variable corresponding to the virtual address was found */
-      if (ReadStatus != 0x1)
-      {
-        /* Transfer the variable to the new active page */
-        EepromStatus = EE_VerifyPageFullWriteVariable(VirtAddVarTab[VarIdx], DataVar);
-        /* If program operation was failed, a Flash error code is returned */
-        if (EepromStatus != FLASH_COMPLETE)
-        {
-          return EepromStatus;
-        }
-      }
+      return FLASH_TIMEOUT;
     }
+    __WFE();
   }
 
-  /* Erase the old Page: Set old Page status to ERASED status */
-  FlashStatus = FLASH_ErasePage(OldPageAddress);
-  /* If erase operation was failed, a Flash error code is returned */
-  if (FlashStatus != FLASH_COMPLETE)
+  return EE_RamWait();
+}
+#endif
+#endif
+
+#ifdef EE_CRC_ENABLE
+/**
+  * @brief  Compute the CRC of a record with the CRC unit.
+  * @param  VirtAddress: Variable virtual address
+  * @param  Data: Variable data
+  * @retval CRC-32 of the data then the virtual address
+  */
+static uint32_t EE_RecordCrc(ee_data_t VirtAddress, ee_data_t Data)
+{
+  CRC_ResetDR();
+  CRC_CalcCRC((uint32_t)Data);
+  
+  return CRC_CalcCRC((uint32_t)VirtAddress);
+}
+
+/**
+  * @brief  Check the integrity of a record, the ones sealed with their page 
+  *   are not checked again.
+  * @param  Handle: EEPROM instance
+  * @param  Address: start of the record
+  * @retval true if the record can be used
+  */
+static bool EE_RecordCheck(ee_handle_t* Handle, uint32_t Address)
+{
+  if ((Address >= Handle->sealed_start) && (Address < Handle->sealed_end))
   {
-    return FlashStatus;
+    return true;
   }
+  
+  return (*(__IO uint32_t*)(Address + EE_CRC_OFFSET) == 
+          EE_RecordCrc(EE_READ_DATA(Address + EE_DATA_SIZE), EE_READ_DATA(Address)));
+}
 
-  /* Set new Page status to VALID_PAGE status */
-  FlashStatus = FLASH_ProgramHalfWord(NewPageAddress, VALID_PAGE);
-  /* If program operation was failed, a Flash error code is returned */
-  if (FlashStatus != FLASH_COMPLETE)
+/**
+  * @brief  Seal a page just committed with the CRC of its records, once each 
+  *   of them passed its own check. A page holding a torn record is left 
+  *   unsealed and its records keep being checked one by one.
+  * @param  Handle: EEPROM instance
+  * @param  Page: page committed
+  * @retval FLASH_COMPLETE on success, a Flash error code otherwise
+  */
+static FLASH_Status EE_SealPage(ee_handle_t* Handle, uint16_t Page)
+{
+  FLASH_Status FlashStatus;
+  uint32_t PageStartAddress = EE_PAGE_BASE(Handle, Page);
+  uint32_t EndAddress = EE_FindFreeSlot(Handle, Page);
+  uint32_t Address;
+  uint32_t Crc;
+  
+  /* Nothing to seal, or sealed before a reset */
+  if ((EndAddress == PageStartAddress + EE_HEADER_SIZE) || (EE_PAGE_SEAL_END(Handle, Page) != 0xFFFF))
   {
-    return FlashStatus;
+    return FLASH_COMPLETE;
   }
-
-  /* Return last operation flash status */
+  
+  for (Address = PageStartAddress + EE_HEADER_SIZE; Address < EndAddress; Address += EE_RECORD_SIZE)
+  {
+    if (*(__IO uint32_t*)(Address + EE_CRC_OFFSET) != 
+        EE_RecordCrc(EE_READ_DATA(Address + EE_DATA_SIZE), EE_READ_DATA(Address)))
+    {
+      return FLASH_COMPLETE;
+    }
+  }
+  
+  CRC_ResetDR();
+  Crc = CRC_CalcBlockCRC((uint32_t*)(PageStartAddress + EE_HEADER_SIZE), (EndAddress - PageStartAddress - EE_HEADER_SIZE) / 4);
+  
+  /* The end offset comes last, a torn seal fails the check */
+  FlashStatus = EE_PROGRAM_WORD(PageStartAddress + EE_SEAL_CRC_OFFSET, Crc);
+  if (FlashStatus == FLASH_COMPLETE)
+  {
+    FlashStatus = EE_PROGRAM_HALFWORD(PageStartAddress + EE_SEAL_END_OFFSET, (uint16_t)(EndAddress - PageStartAddress));
+  }
+  
+  if (FlashStatus == FLASH_COMPLETE)
+  {
+    Handle->sealed_start = PageStartAddress + EE_HEADER_SIZE;
+    Handle->sealed_end = EndAddress;
+  }
+  
   return FlashStatus;
 }
 
-
+/**
+  * @brief  Check the seal of a page in one pass of the CRC unit, its records 
+  *   are then vouched for. The records appended since the seal and the ones of 
+  *   a page without a valid seal are checked one by one.
+  * @param  Handle: EEPROM instance
+  * @param  Page: page to check, NO_VALID_PAGE for none
+  * @retval None
+  */
+static void EE_SealCheck(ee_handle_t* Handle, uint16_t Page)
+{
+  uint32_t PageStartAddress;
+  uint16_t End;
+  
+  Handle->sealed_start = 0;
+  Handle->sealed_end = 0;
+  
+  if (Page == NO_VALID_PAGE)
+  {
+    return;
+  }
+  
+  PageStartAddress = EE_PAGE_BASE(Handle, Page);
+  End = EE_PAGE_SEAL_END(Handle, Page);
+  if ((End <= EE_HEADER_SIZE) || (End > PAGE_SIZE) || ((End % EE_RECORD_SIZE) != 0))
+  {
+    return;
+  }
+  
+  CRC_ResetDR();
+  if (CRC_CalcBlockCRC((uint32_t*)(PageStartAddress + EE_HEADER_SIZE), (End - EE_HEADER_SIZE) / 4) == EE_PAGE_SEAL_CRC(Handle, Page))
+  {
+    Handle->sealed_start = PageStartAddress + EE_HEADER_SIZE;
+    Handle->sealed_end = PageStartAddress + End;
+  }
+}
+#endif
 
 /**
   * @}
@@ -0,0 +1,53 @@
+#!/bin/sh
+# Check of the code run from SRAM while the Flash is busy, on the image linked
+# by the test_ramfunc rule: the Flash program and erase functions are in the
+# .ramfunc section, and no call or branch from that section leaves it. A
+# branch to the Flash would stall on the fetch, or fault during an erase.
+#
+# Usage: check_ramfunc.sh <image> <map>, OBJDUMP and NM may name the tools of
+# a cross toolchain.
+
+IMAGE=$1
+MAP=$2
+OBJDUMP=${OBJDUMP:-objdump}
+NM=${NM:-nm}
+FUNCS="EE_RamWait EE_RamProgram EE_RamErasePage EE_RamSleep"
+FAIL=0
+
+# Output section in the map: name, then address and size on the same line
+set -- $(awk '$1 == ".ramfunc" && $2 ~ /^0x/ { print $2, $3; exit }' "$MAP")
+if [ $# -ne 2 ]; then
+  echo "check_ramfunc: no .ramfunc section in $MAP"
+  exit 1
+fi
+START=$(($1))
+END=$(($1 + $2))
+
+for f in $FUNCS; do
+  ADDR=$($NM "$IMAGE" | awk -v f="$f" '$3 == f { print $1; exit }')
+  if [ -z "$ADDR" ]; then
+    echo "check_ramfunc: $f not found in $IMAGE"
+    FAIL=1
+  elif [ $((0x$ADDR)) -lt $START ] || [ $((0x$ADDR)) -ge $END ]; then
+    echo "check_ramfunc: $f at 0x$ADDR is outside .ramfunc"
+    FAIL=1
+  fi
+done
+
+# Every direct call or branch target, "<address> <symbol>" in the disassembly
+$OBJDUMP -d -j .ramfunc "$IMAGE" | \
+  awk '/^ *[0-9a-f]+:/ && match($0, /[0-9a-f]+ <[^>]+>$/) { print substr($0, RSTART) }' | \
+  sort -u > "$IMAGE.targets"
+while read -r ADDR SYM; do
+  if [ $((0x$ADDR)) -lt $START ] || [ $((0x$ADDR)) -ge $END ]; then
+    echo "check_ramfunc: .ramfunc branches to $SYM at 0x$ADDR"
+    FAIL=1
+  fi
+done < "$IMAGE.targets"
+rm -f "$IMAGE.targets"
+
+if [ $FAIL -ne 0 ]; then
+  echo "check_ramfunc: FAILED"
+  exit 1
+fi
+echo "check_ramfunc: passed"
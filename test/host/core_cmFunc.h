@@ -0,0 +1,20 @@
+/**
+  ******************************************************************************
+  * @file    test/host/core_cmFunc.h
+  * @brief   Host stand-in for the CMSIS core register access functions, the
+  *          interrupt mask is a variable of the simulation, see sim_flash.c.
+  ******************************************************************************
+  */
+#ifndef __CORE_CMFUNC_H
+#define __CORE_CMFUNC_H
+
+#include <stdint.h>
+
+extern volatile uint32_t SimPrimask;
+
+static inline void __enable_irq(void)               { SimPrimask = 0; }
+static inline void __disable_irq(void)              { SimPrimask = 1; }
+static inline uint32_t __get_PRIMASK(void)          { return SimPrimask; }
+static inline void __set_PRIMASK(uint32_t priMask)  { SimPrimask = priMask; }
+
+#endif /* __CORE_CMFUNC_H */
@@ -0,0 +1,20 @@
+/**
+  ******************************************************************************
+  * @file    test/host/core_cmInstr.h
+  * @brief   Host stand-in for the CMSIS core instruction intrinsics, found
+  *          before CMSIS/Include so that core_cm0.h builds for the host.
+  ******************************************************************************
+  */
+#ifndef __CORE_CMINSTR_H
+#define __CORE_CMINSTR_H
+
+/* The barriers only order the compiler, the hints do nothing */
+#define __NOP()   __asm volatile ("" ::: "memory")
+#define __WFI()   __asm volatile ("" ::: "memory")
+#define __WFE()   __asm volatile ("" ::: "memory")
+#define __SEV()   __asm volatile ("" ::: "memory")
+#define __ISB()   __asm volatile ("" ::: "memory")
+#define __DSB()   __asm volatile ("" ::: "memory")
+#define __DMB()   __asm volatile ("" ::: "memory")
+
+#endif /* __CORE_CMINSTR_H */
@@ -0,0 +1,19 @@
+/**
+  ******************************************************************************
+  * @file    test/host/stm32f0xx_conf.h
+  * @brief   Peripheral driver selection of the host tests, the drivers used by
+  *          the EEPROM emulation are simulated by sim_flash.c.
+  ******************************************************************************
+  */
+#ifndef __STM32F0XX_CONF_H
+#define __STM32F0XX_CONF_H
+
+#include "stm32f0xx_crc.h"
+#include "stm32f0xx_flash.h"
+#include "stm32f0xx_misc.h"
+#include "stm32f0xx_rcc.h"
+#include "stm32f0xx_syscfg.h"
+
+#define assert_param(expr) ((void)0)
+
+#endif /* __STM32F0XX_CONF_H */
@@ -0,0 +1,300 @@
+/**
+  ******************************************************************************
+  * @file    test/sim_flash.c
+  * @brief   Host simulation of the STM32F0 Flash, its controller registers and
+  *          the CRC unit. The Flash and the FLASH registers are mapped at their
+  *          device addresses so that the library reads them directly.
+  ******************************************************************************
+  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "stm32f0xx.h"
+#include "sim_flash.h"
+
+long SimPrograms;
+long SimErases;
+long SimStray;
+long SimCutAfter = -1;
+jmp_buf SimCutJmp;
+long SimTearFrom = -1;
+long SimTearTo = SIM_PAGE_SIZE;
+long SimFailErase = -1;
+void (*SimHook)(void);
+long SimProgramTicks = 2;
+long SimEraseTicks = 40;
+void (*SimIrq)(void);
+volatile uint32_t SimPrimask;
+uint32_t SimTick;
+
+static uint32_t SimCrc = 0xFFFFFFFF;
+static uint32_t SimSr;
+static long SimOpTicks = -1;
+static int SimOpErase;
+
+static void Sim_Map(uint32_t Address, uint32_t Size)
+{
+  void* p = mmap((void*)(uintptr_t)Address, Size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+
+  if (p == MAP_FAILED)
+  {
+    perror("mmap");
+    exit(2);
+  }
+}
+
+/* Count down to the power cut, true when the current operation is cut */
+static int Sim_Cut(void)
+{
+  if (SimCutAfter < 0)
+  {
+    return 0;
+  }
+  return SimCutAfter-- == 0;
+}
+
+static int Sim_InFlash(uint32_t Address, uint32_t Size)
+{
+  return (Address >= SIM_FLASH_BASE) && (Address + Size <= SIM_FLASH_BASE + SIM_FLASH_SIZE);
+}
+
+void Sim_Init(void)
+{
+  Sim_Map(SIM_FLASH_BASE, SIM_FLASH_SIZE);
+  Sim_Map(FLASH_R_BASE & ~0xFFFu, 0x1000);
+  Sim_Map(SCS_BASE & ~0xFFFu, 0x1000);
+  Sim_EraseAll();
+}
+
+void Sim_EraseAll(void)
+{
+  memset((void*)(uintptr_t)SIM_FLASH_BASE, 0xFF, SIM_FLASH_SIZE);
+  SimPrograms = SimErases = SimStray = 0;
+  SimCutAfter = SimFailErase = SimTearFrom = -1;
+  SimTearTo = SIM_PAGE_SIZE;
+  SimOpTicks = -1;
+  SimSr = FLASH->SR = 0;
+}
+
+/* The registers are memory: SR differing from the flags the controller holds
+   was written, and the flags written one are cleared. A write of the value
+   the controller holds is missed, the library never clears a flag that way */
+static void Sim_SyncSr(void)
+{
+  uint32_t Written = FLASH->SR;
+
+  if (Written != SimSr)
+  {
+    SimSr &= ~(Written & (FLASH_SR_EOP | FLASH_SR_PGERR | FLASH_SR_WRPERR));
+  }
+  FLASH->SR = SimSr;
+}
+
+/* One time step of the FLASH controller. The halfword written with PG set is
+   already in the Flash, the erase started with PER and STRT is done at the
+   end of its duration, even if PER is cleared meanwhile. The end raises EOP
+   or PGERR, and the interrupt. The flags stay set until written one, see
+   Sim_SyncSr(). Returns 0 when no operation is in progress */
+int Sim_Tick(void)
+{
+  uint32_t Base;
+
+  Sim_SyncSr();
+  if (SimOpTicks < 0)
+  {
+    SimOpErase = ((FLASH->CR & FLASH_CR_PER) != 0) && ((FLASH->CR & FLASH_CR_STRT) != 0);
+    if (!SimOpErase && ((FLASH->CR & FLASH_CR_PG) == 0))
+    {
+      return 0;
+    }
+    SimOpTicks = SimOpErase ? SimEraseTicks : SimProgramTicks;
+    SimSr |= FLASH_SR_BSY;
+    FLASH->SR = SimSr;
+  }
+  if (SimOpTicks-- > 0)
+  {
+    return 1;
+  }
+
+  SimOpTicks = -1;
+  SimSr = (SimSr & ~FLASH_SR_BSY) | FLASH_SR_EOP;
+  if (SimOpErase)
+  {
+    Base = FLASH->AR & ~(SIM_PAGE_SIZE - 1);
+    FLASH->CR &= ~FLASH_CR_STRT;
+    if (!Sim_InFlash(Base, SIM_PAGE_SIZE))
+    {
+      SimStray++;
+      SimSr = (SimSr & ~FLASH_SR_EOP) | FLASH_SR_PGERR;
+    }
+    else if ((SimFailErase >= 0) && (SimFailErase-- == 0))
+    {
+      SimSr = (SimSr & ~FLASH_SR_EOP) | FLASH_SR_PGERR;
+    }
+    else
+    {
+      memset((void*)(uintptr_t)Base, 0xFF, SIM_PAGE_SIZE);
+      SimErases++;
+    }
+  }
+  else
+  {
+    SimPrograms++;
+  }
+  FLASH->SR = SimSr;
+  if ((SimIrq != 0) && ((FLASH->CR & ((SimSr & FLASH_SR_EOP) ? FLASH_CR_EOPIE : FLASH_CR_ERRIE)) != 0))
+  {
+    SimIrq();
+    Sim_SyncSr();
+  }
+  return 1;
+}
+
+uint32_t Sim_GetTick(void)
+{
+  Sim_Tick();
+  return ++SimTick;
+}
+
+void FLASH_Unlock(void)
+{
+}
+
+void FLASH_Lock(void)
+{
+}
+
+FLASH_Status FLASH_ProgramHalfWord(uint32_t Address, uint16_t Data)
+{
+  volatile uint16_t* p = (volatile uint16_t*)(uintptr_t)Address;
+
+  if (!Sim_InFlash(Address, 2))
+  {
+    SimStray++;
+    return FLASH_ERROR_PROGRAM;
+  }
+  if (Sim_Cut())
+  {
+    if ((SimTearFrom >= 0) && ((long)(Address % SIM_PAGE_SIZE) >= SimTearFrom) &&
+        ((long)(Address % SIM_PAGE_SIZE) < SimTearTo) && !(Address & 1) && ((*p == 0xFFFF) || (Data == 0)))
+    {
+      *p &= (uint16_t)(Data | (rand() & rand() & rand()));
+    }
+    longjmp(SimCutJmp, 1);
+  }
+  /* A halfword is programmed once after an erase, zero can always be written */
+  if ((Address & 1) || ((*p != 0xFFFF) && (Data != 0)))
+  {
+    return FLASH_ERROR_PROGRAM;
+  }
+  *p = Data;
+  SimPrograms++;
+  if (SimHook)
+  {
+    SimHook();
+  }
+  return FLASH_COMPLETE;
+}
+
+FLASH_Status FLASH_ProgramWord(uint32_t Address, uint32_t Data)
+{
+  FLASH_Status Status = FLASH_ProgramHalfWord(Address, (uint16_t)Data);
+
+  if (Status != FLASH_COMPLETE)
+  {
+    return Status;
+  }
+  return FLASH_ProgramHalfWord(Address + 2, (uint16_t)(Data >> 16));
+}
+
+FLASH_Status FLASH_ErasePage(uint32_t Page_Address)
+{
+  uint32_t Base = Page_Address & ~(SIM_PAGE_SIZE - 1);
+
+  if (!Sim_InFlash(Base, SIM_PAGE_SIZE))
+  {
+    SimStray++;
+    return FLASH_ERROR_PROGRAM;
+  }
+  if (Sim_Cut())
+  {
+    memset((void*)(uintptr_t)Base, 0xFF, (size_t)(rand() % SIM_PAGE_SIZE));
+    longjmp(SimCutJmp, 1);
+  }
+  if ((SimFailErase >= 0) && (SimFailErase-- == 0))
+  {
+    return FLASH_ERROR_PROGRAM;
+  }
+  memset((void*)(uintptr_t)Base, 0xFF, SIM_PAGE_SIZE);
+  SimErases++;
+  if (SimHook)
+  {
+    SimHook();
+  }
+  return FLASH_COMPLETE;
+}
+
+FLASH_Status FLASH_WaitForLastOperation(uint32_t Timeout)
+{
+  return FLASH_COMPLETE;
+}
+
+void FLASH_ITConfig(uint32_t FLASH_IT, FunctionalState NewState)
+{
+  if (NewState != DISABLE)
+  {
+    FLASH->CR |= FLASH_IT;
+  }
+  else
+  {
+    FLASH->CR &= ~FLASH_IT;
+  }
+}
+
+/* CRC unit in its reset configuration: CRC-32, polynomial 0x04C11DB7 */
+void CRC_ResetDR(void)
+{
+  SimCrc = 0xFFFFFFFF;
+}
+
+uint32_t CRC_CalcCRC(uint32_t CRC_Data)
+{
+  int Bit;
+
+  SimCrc ^= CRC_Data;
+  for (Bit = 0; Bit < 32; Bit++)
+  {
+    SimCrc = (SimCrc & 0x80000000u) ? (SimCrc << 1) ^ 0x04C11DB7u : (SimCrc << 1);
+  }
+  return SimCrc;
+}
+
+uint32_t CRC_CalcBlockCRC(uint32_t pBuffer[], uint32_t BufferLength)
+{
+  uint32_t Idx;
+
+  for (Idx = 0; Idx < BufferLength; Idx++)
+  {
+    CRC_CalcCRC(pBuffer[Idx]);
+  }
+  return SimCrc;
+}
+
+uint32_t CRC_GetCRC(void)
+{
+  return SimCrc;
+}
+
+void RCC_AHBPeriphClockCmd(uint32_t RCC_AHBPeriph, FunctionalState NewState)
+{
+}
+
+void RCC_APB2PeriphClockCmd(uint32_t RCC_APB2Periph, FunctionalState NewState)
+{
+}
+
+void SYSCFG_MemoryRemapConfig(uint32_t SYSCFG_MemoryRemap)
+{
+}
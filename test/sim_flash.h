@@ -0,0 +1,69 @@
+/**
+  ******************************************************************************
+  * @file    test/sim_flash.h
+  * @brief   Host simulation of the STM32F0 Flash, its controller registers and
+  *          the CRC unit, with power cut and erase failure injection.
+  ******************************************************************************
+  */
+#ifndef __SIM_FLASH_H
+#define __SIM_FLASH_H
+
+#include <setjmp.h>
+#include <stdint.h>
+
+/* Simulated Flash, it holds every EEPROM allocation of the tests and the
+   addresses a page index out of range would point to */
+#define SIM_FLASH_BASE      ((uint32_t)0x08000000)
+#define SIM_FLASH_SIZE      ((uint32_t)0x00040000)
+#define SIM_PAGE_SIZE       ((uint32_t)0x00000400)
+
+/* Flash operations done, programs and erases outside the EEPROM range */
+extern long SimPrograms;
+extern long SimErases;
+extern long SimStray;
+
+/* Power cut: the operation number SimCutAfter from now does not complete and
+   SimCutJmp is long jumped to, -1 for none. A cut erase leaves the start of
+   the page erased and the rest untouched */
+extern long SimCutAfter;
+extern jmp_buf SimCutJmp;
+
+/* Torn programs: a cut program at offsets SimTearFrom to SimTearTo excluded
+   of a page leaves the halfword partly programmed instead of untouched,
+   SimTearFrom -1 for none, SimTearTo the page size by default. Each bit it
+   clears stays at one with a probability of 1/8, as when the cut comes late
+   in the program. The record CRC detects them in the records, the recovery
+   copes with them in the page header */
+extern long SimTearFrom;
+extern long SimTearTo;
+
+/* Erase failure: the erase number SimFailErase from now returns
+   FLASH_ERROR_PROGRAM, or ends with PGERR when started through FLASH->CR,
+   and leaves the page untouched, -1 for none */
+extern long SimFailErase;
+
+/* Called after each completed program or erase, NULL for none */
+extern void (*SimHook)(void);
+
+/* Register level operations, started through FLASH->CR as the interrupt
+   driven engine does: duration in Sim_Tick() calls of a halfword program and
+   of a page erase, and the FLASH interrupt handler called on their end when
+   EOPIE is set */
+extern long SimProgramTicks;
+extern long SimEraseTicks;
+extern void (*SimIrq)(void);
+
+/* Millisecond time base of the builds defining EE_GET_TICK(), which include
+   this header in the library with -include */
+extern uint32_t SimTick;
+
+void Sim_Init(void);
+void Sim_EraseAll(void);
+int Sim_Tick(void);
+
+/* EE_GET_TICK() of the builds waiting on the time base for the end of the
+   Flash operations: each read is a millisecond, a Sim_Tick() of the FLASH
+   controller, and returns SimTick */
+uint32_t Sim_GetTick(void);
+
+#endif /* __SIM_FLASH_H */
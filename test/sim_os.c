@@ -0,0 +1,335 @@
+/**
+  ******************************************************************************
+  * @file    test/sim_os.c
+  * @brief   Host CMSIS-RTOS of the builds defining EE_RTOS_ENABLE: the threads
+  *          are POSIX threads and the kernel objects the library and the tests
+  *          use wait on a single lock and condition. A thread waiting on a
+  *          semaphore runs the FLASH controller meanwhile, one Sim_Tick() per
+  *          millisecond of its timeout, so that a program or an erase started
+  *          through the registers ends and its interrupt releases the semaphore.
+  ******************************************************************************
+  */
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "cmsis_os.h"
+#include "sim_flash.h"
+
+struct os_thread_cb {
+  pthread_t     id;
+  os_pthread    function;
+  void const*   argument;
+  int32_t       signals;
+};
+
+struct os_mutex_cb {
+  pthread_mutex_t mutex;
+};
+
+struct os_semaphore_cb {
+  int32_t       count;
+};
+
+struct os_mailQ_cb {
+  uint32_t      size;
+  uint32_t      item_size;
+  uint8_t*      pool;
+  uint8_t*      used;
+  void**        fifo;
+  uint32_t      head;
+  uint32_t      count;
+};
+
+static pthread_mutex_t OsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t OsCond = PTHREAD_COND_INITIALIZER;
+static volatile int OsRunning;
+static __thread struct os_thread_cb* OsSelf;
+
+/* Wait on the condition, for a millisecond if Tick, with OsLock held */
+static void Os_Wait(int Tick)
+{
+  struct timespec Until;
+
+  if (!Tick)
+  {
+    pthread_cond_wait(&OsCond, &OsLock);
+    return;
+  }
+  clock_gettime(CLOCK_REALTIME, &Until);
+  Until.tv_nsec += 1000000;
+  if (Until.tv_nsec >= 1000000000)
+  {
+    Until.tv_sec++;
+    Until.tv_nsec -= 1000000000;
+  }
+  pthread_cond_timedwait(&OsCond, &OsLock, &Until);
+}
+
+osStatus osKernelInitialize(void)
+{
+  return osOK;
+}
+
+osStatus osKernelStart(void)
+{
+  OsRunning = 1;
+  return osOK;
+}
+
+int32_t osKernelRunning(void)
+{
+  return OsRunning;
+}
+
+static void* Os_ThreadEntry(void* Cb)
+{
+  OsSelf = (struct os_thread_cb*)Cb;
+  OsSelf->function(OsSelf->argument);
+  return NULL;
+}
+
+osThreadId osThreadCreate(const osThreadDef_t* thread_def, void* argument)
+{
+  struct os_thread_cb* Cb = calloc(1, sizeof(*Cb));
+
+  Cb->function = thread_def->pthread;
+  Cb->argument = argument;
+  if (pthread_create(&Cb->id, NULL, Os_ThreadEntry, Cb) != 0)
+  {
+    free(Cb);
+    return NULL;
+  }
+  pthread_detach(Cb->id);
+  return Cb;
+}
+
+/* Threads not created by osThreadCreate(), the main one, get an id here */
+osThreadId osThreadGetId(void)
+{
+  if (OsSelf == NULL)
+  {
+    OsSelf = calloc(1, sizeof(*OsSelf));
+    OsSelf->id = pthread_self();
+  }
+  return OsSelf;
+}
+
+osStatus osThreadYield(void)
+{
+  sched_yield();
+  return osOK;
+}
+
+osStatus osDelay(uint32_t millisec)
+{
+  usleep(millisec * 1000);
+  return osOK;
+}
+
+int32_t osSignalSet(osThreadId thread_id, int32_t signals)
+{
+  int32_t Previous;
+
+  pthread_mutex_lock(&OsLock);
+  Previous = thread_id->signals;
+  thread_id->signals |= signals;
+  pthread_cond_broadcast(&OsCond);
+  pthread_mutex_unlock(&OsLock);
+  return Previous;
+}
+
+osEvent osSignalWait(int32_t signals, uint32_t millisec)
+{
+  osThreadId Self = osThreadGetId();
+  osEvent Event;
+  uint32_t Waited = 0;
+
+  pthread_mutex_lock(&OsLock);
+  while ((Self->signals & signals) != signals)
+  {
+    if (Waited == millisec)
+    {
+      pthread_mutex_unlock(&OsLock);
+      Event.status = (millisec == 0) ? osOK : osEventTimeout;
+      return Event;
+    }
+    Os_Wait(millisec != osWaitForever);
+    Waited += (millisec != osWaitForever);
+  }
+  Self->signals &= ~signals;
+  pthread_mutex_unlock(&OsLock);
+  Event.status = osEventSignal;
+  Event.value.signals = signals;
+  return Event;
+}
+
+osMutexId osMutexCreate(const osMutexDef_t* mutex_def)
+{
+  struct os_mutex_cb* Cb = calloc(1, sizeof(*Cb));
+  pthread_mutexattr_t Attr;
+
+  pthread_mutexattr_init(&Attr);
+  pthread_mutexattr_settype(&Attr, PTHREAD_MUTEX_ERRORCHECK);
+  pthread_mutex_init(&Cb->mutex, &Attr);
+  pthread_mutexattr_destroy(&Attr);
+  return Cb;
+}
+
+osStatus osMutexWait(osMutexId mutex_id, uint32_t millisec)
+{
+  if (millisec == 0)
+  {
+    return (pthread_mutex_trylock(&mutex_id->mutex) == 0) ? osOK : osErrorResource;
+  }
+  /* The mutexes are not recursive, a thread taking one twice is a bug */
+  if (pthread_mutex_lock(&mutex_id->mutex) != 0)
+  {
+    fprintf(stderr, "FAIL: mutex taken twice by a thread\n");
+    abort();
+  }
+  return osOK;
+}
+
+osStatus osMutexRelease(osMutexId mutex_id)
+{
+  pthread_mutex_unlock(&mutex_id->mutex);
+  return osOK;
+}
+
+osSemaphoreId osSemaphoreCreate(const osSemaphoreDef_t* semaphore_def, int32_t count)
+{
+  struct os_semaphore_cb* Cb = calloc(1, sizeof(*Cb));
+
+  Cb->count = count;
+  return Cb;
+}
+
+/* Returns the tokens available before the one taken, 0 on a timeout */
+int32_t osSemaphoreWait(osSemaphoreId semaphore_id, uint32_t millisec)
+{
+  uint32_t Waited = 0;
+  int32_t Count;
+
+  pthread_mutex_lock(&OsLock);
+  while (semaphore_id->count == 0)
+  {
+    if (Waited == millisec)
+    {
+      pthread_mutex_unlock(&OsLock);
+      return 0;
+    }
+    /* The interrupt of the operation ending in this tick releases the lock */
+    pthread_mutex_unlock(&OsLock);
+    if (Sim_Tick())
+    {
+      pthread_mutex_lock(&OsLock);
+    }
+    else
+    {
+      pthread_mutex_lock(&OsLock);
+      if (semaphore_id->count == 0)
+      {
+        Os_Wait(1);
+      }
+    }
+    Waited += (millisec != osWaitForever);
+  }
+  Count = semaphore_id->count--;
+  pthread_mutex_unlock(&OsLock);
+  return Count;
+}
+
+osStatus osSemaphoreRelease(osSemaphoreId semaphore_id)
+{
+  pthread_mutex_lock(&OsLock);
+  semaphore_id->count++;
+  pthread_cond_broadcast(&OsCond);
+  pthread_mutex_unlock(&OsLock);
+  return osOK;
+}
+
+osMailQId osMailCreate(const osMailQDef_t* queue_def, osThreadId thread_id)
+{
+  struct os_mailQ_cb* Cb = calloc(1, sizeof(*Cb));
+
+  Cb->size = queue_def->queue_sz;
+  Cb->item_size = queue_def->item_sz;
+  Cb->pool = calloc(Cb->size, Cb->item_size);
+  Cb->used = calloc(Cb->size, 1);
+  Cb->fifo = calloc(Cb->size, sizeof(void*));
+  return Cb;
+}
+
+void* osMailAlloc(osMailQId queue_id, uint32_t millisec)
+{
+  uint32_t Waited = 0;
+  uint32_t Idx;
+
+  pthread_mutex_lock(&OsLock);
+  for (;;)
+  {
+    for (Idx = 0; (Idx < queue_id->size) && queue_id->used[Idx]; Idx++)
+    {
+    }
+    if (Idx < queue_id->size)
+    {
+      queue_id->used[Idx] = 1;
+      pthread_mutex_unlock(&OsLock);
+      return queue_id->pool + Idx * queue_id->item_size;
+    }
+    if (Waited == millisec)
+    {
+      pthread_mutex_unlock(&OsLock);
+      return NULL;
+    }
+    Os_Wait(millisec != osWaitForever);
+    Waited += (millisec != osWaitForever);
+  }
+}
+
+osStatus osMailPut(osMailQId queue_id, void* mail)
+{
+  pthread_mutex_lock(&OsLock);
+  queue_id->fifo[(queue_id->head + queue_id->count++) % queue_id->size] = mail;
+  pthread_cond_broadcast(&OsCond);
+  pthread_mutex_unlock(&OsLock);
+  return osOK;
+}
+
+osEvent osMailGet(osMailQId queue_id, uint32_t millisec)
+{
+  osEvent Event;
+  uint32_t Waited = 0;
+
+  pthread_mutex_lock(&OsLock);
+  while (queue_id->count == 0)
+  {
+    if (Waited == millisec)
+    {
+      pthread_mutex_unlock(&OsLock);
+      Event.status = (millisec == 0) ? osOK : osEventTimeout;
+      return Event;
+    }
+    Os_Wait(millisec != osWaitForever);
+    Waited += (millisec != osWaitForever);
+  }
+  Event.status = osEventMail;
+  Event.value.p = queue_id->fifo[queue_id->head];
+  Event.def.mail_id = queue_id;
+  queue_id->head = (queue_id->head + 1) % queue_id->size;
+  queue_id->count--;
+  pthread_mutex_unlock(&OsLock);
+  return Event;
+}
+
+osStatus osMailFree(osMailQId queue_id, void* mail)
+{
+  pthread_mutex_lock(&OsLock);
+  queue_id->used[((uint8_t*)mail - queue_id->pool) / queue_id->item_size] = 0;
+  pthread_cond_broadcast(&OsCond);
+  pthread_mutex_unlock(&OsLock);
+  return osOK;
+}
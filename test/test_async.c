@@ -0,0 +1,184 @@
+/**
+  ******************************************************************************
+  * @file    test/test_async.c
+  * @brief   Interrupt driven asynchronous writes against the simulated FLASH
+  *          controller: the programs and the erases end after their modeled
+  *          duration with EOP and the interrupt. The reads issued while writes
+  *          are queued return the queued values, every request is completed
+  *          through its callback and the Flash holds the same values after a
+  *          new initialization. The page scans of the reads run with the
+  *          interrupts enabled: a timer signal, standing for the interrupts,
+  *          runs the controller in the middle of them, page transfers included.
+  ******************************************************************************
+  */
+#include <signal.h>
+#include <sys/time.h>
+#include "test_util.h"
+
+#define STEPS       30000
+#define READ_STEPS  200000
+
+static long Queued;
+static long Completed;
+static long CompletedFailed;
+
+static void Done(ee_data_t VirtAddress, ee_status_t Status)
+{
+  Completed++;
+  if (Status != EE_SUCCESS)
+  {
+    CompletedFailed++;
+  }
+}
+
+/* Timer signal: the FLASH controller runs unless the interrupts are masked */
+static volatile int InRead;
+static volatile long SignalsMasked;
+static volatile long SignalsRun;
+static volatile long ErasesInRead;
+
+static void Timer(int Signal)
+{
+  long Erases = SimErases;
+
+  if (InRead)
+  {
+    if (SimPrimask != 0)
+    {
+      SignalsMasked++;
+      return;
+    }
+    SignalsRun++;
+  }
+  if ((SimPrimask == 0) && Sim_Tick() && InRead)
+  {
+    ErasesInRead += (SimErases != Erases);
+  }
+}
+
+static void Set_Timer(long Microseconds)
+{
+  struct itimerval Timer = {{0, Microseconds}, {0, Microseconds}};
+
+  setitimer(ITIMER_REAL, &Timer, NULL);
+}
+
+/* Run the controller until the engine is idle */
+static void Drain(void)
+{
+  while (EE_Busy())
+  {
+    if (!Sim_Tick())
+    {
+      CHECK(0, "the engine waits without a Flash operation in progress");
+      exit(1);
+    }
+  }
+}
+
+int main(void)
+{
+  long n;
+  int Idx;
+  int Ticks;
+  int Status;
+  long Erases;
+  ee_data_t Data;
+
+  Test_Setup();
+  SimIrq = EE_FLASH_IRQHandler;
+  srand(9);
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "init");
+
+  for (n = 0; n < STEPS; n++)
+  {
+    Idx = rand() % NB_OF_VAR;
+    Data = (ee_data_t)rand();
+
+    if (rand() % 8 != 0)
+    {
+      Status = EE_WriteVariableAsync(&Eeprom, VirtAddVarTab[Idx], Data, Done);
+      CHECK((Status == EE_SUCCESS) || (Status == QUEUE_FULL), "async write %ld status %d", n, Status);
+      if (Status == EE_SUCCESS)
+      {
+        TestModel[Idx] = Data;
+        Queued++;
+      }
+    }
+    else
+    {
+      /* A blocking write waits for the queued requests */
+      Drain();
+      CHECK(EE_WriteVariable(&Eeprom, VirtAddVarTab[Idx], Data) == EE_SUCCESS, "write %ld", n);
+      TestModel[Idx] = Data;
+    }
+
+    /* The reads return the queued values while the Flash catches up */
+    for (Ticks = rand() % 4; Ticks > 0; Ticks--)
+    {
+      Sim_Tick();
+    }
+    if (n % 16 == 0)
+    {
+      Test_Verify("queued");
+    }
+
+    if (n % 2000 == 0)
+    {
+      Drain();
+      CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "init at %ld", n);
+      Test_Verify("init");
+    }
+  }
+
+  /* A page transfer spans erases without blocking the caller */
+  Erases = SimErases;
+  for (n = 0; (SimErases == Erases) && (n < 100000); n++)
+  {
+    Idx = (int)(n % NB_OF_VAR);
+    if (EE_WriteVariableAsync(&Eeprom, VirtAddVarTab[Idx], (ee_data_t)n, Done) == EE_SUCCESS)
+    {
+      TestModel[Idx] = (ee_data_t)n;
+      Queued++;
+    }
+    if (EE_Busy() && (FLASH->CR & FLASH_CR_PER))
+    {
+      CHECK(FLASH->CR & FLASH_CR_EOPIE, "erase without the EOP interrupt");
+      Test_Verify("erase");
+    }
+    Sim_Tick();
+  }
+  CHECK(SimErases > Erases, "no erase");
+
+  /* The controller runs from the timer only, in the middle of the reads */
+  Drain();
+  signal(SIGALRM, Timer);
+  Set_Timer(20);
+  for (n = 0; (n < READ_STEPS) && (ErasesInRead < 4); n++)
+  {
+    Idx = rand() % NB_OF_VAR;
+    Data = (ee_data_t)rand();
+    if (EE_WriteVariableAsync(&Eeprom, VirtAddVarTab[Idx], Data, Done) == EE_SUCCESS)
+    {
+      TestModel[Idx] = Data;
+      Queued++;
+    }
+    InRead = 1;
+    Test_Verify("interrupted read");
+    InRead = 0;
+  }
+  Set_Timer(0);
+  CHECK(SignalsMasked < SignalsRun, "interrupts masked for %ld of %ld signals during the reads",
+        SignalsMasked, SignalsMasked + SignalsRun);
+  CHECK(ErasesInRead == 4, "%ld page transfers during the reads", ErasesInRead);
+
+  Drain();
+  Test_Verify("end");
+  CHECK(Completed == Queued, "%ld requests queued, %ld completed", Queued, Completed);
+  CHECK(CompletedFailed == 0, "%ld requests failed", CompletedFailed);
+  CHECK(SimStray == 0, "%ld operations outside the Flash", SimStray);
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "final init");
+  Test_Verify("final");
+
+  return Test_Report("test_async");
+}
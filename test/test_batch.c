@@ -0,0 +1,81 @@
+/**
+  ******************************************************************************
+  * @file    test/test_batch.c
+  * @brief   Batch writes filling the page: for each position of the last
+  *          slot in the batch, EE_WriteVariables() writes the variables that
+  *          fit, then does a single transfer taking the rest, and the new page
+  *          holds one record per variable. Within a batch, the last value of
+  *          an address given twice wins.
+  ******************************************************************************
+  */
+#include "test_util.h"
+
+#define BATCH       12
+
+int main(void)
+{
+  ee_var_t Vars[BATCH];
+  int VarIdx[BATCH];
+  int Fit;
+  int Free;
+  int Idx;
+  long n = 0;
+
+  Test_Setup();
+  srand(5);
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "init");
+
+  /* Every variable has a record, a transfer copies all of them */
+  for (Idx = 0; Idx < NB_OF_VAR; Idx++)
+  {
+    CHECK(EE_WriteVariable(&Eeprom, VirtAddVarTab[Idx], (ee_data_t)n) == EE_SUCCESS, "write %d", Idx);
+    TestModel[Idx] = (ee_data_t)n++;
+  }
+
+  /* The batch writes BATCH - 1 records, the first one is overwritten */
+  for (Fit = 0; Fit < BATCH - 1; Fit++)
+  {
+    uint16_t Page;
+    long Erases;
+
+    /* Leave room for Fit records of the batch */
+    do
+    {
+      Free = (int)((TEST_PAGE_ADDRESS(Eeprom.write_page + 1) - Eeprom.write_address) / TEST_RECORD_SIZE);
+      if (Free > Fit)
+      {
+        Idx = rand() % NB_OF_VAR;
+        CHECK(EE_WriteVariable(&Eeprom, VirtAddVarTab[Idx], (ee_data_t)n) == EE_SUCCESS, "fill %ld", n);
+        TestModel[Idx] = (ee_data_t)n++;
+      }
+    } while (Free != Fit);
+
+    /* Distinct variables but the last one, which repeats the first */
+    for (Idx = 0; Idx < BATCH; Idx++)
+    {
+      VarIdx[Idx] = (Idx == BATCH - 1) ? VarIdx[0] : (Fit * 5 + Idx) % NB_OF_VAR;
+      Vars[Idx].addr = VirtAddVarTab[VarIdx[Idx]];
+      Vars[Idx].data = (ee_data_t)n++;
+    }
+
+    Page = Eeprom.write_page;
+    Erases = SimErases;
+    CHECK(EE_WriteVariables(&Eeprom, Vars, BATCH) == EE_SUCCESS, "batch with %d slots left", Fit);
+    for (Idx = 0; Idx < BATCH; Idx++)
+    {
+      TestModel[VarIdx[Idx]] = Vars[Idx].data;
+    }
+
+    CHECK(Eeprom.write_page != Page, "batch with %d slots left: no transfer", Fit);
+    CHECK(SimErases - Erases == 1, "batch with %d slots left: %ld erases", Fit, SimErases - Erases);
+    CHECK(Test_CountRecords(Eeprom.write_page) == NB_OF_VAR, "batch with %d slots left: %d records in the new page",
+          Fit, Test_CountRecords(Eeprom.write_page));
+    Test_Verify("batch");
+  }
+
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "reinit");
+  Test_Verify("reinit");
+  CHECK(SimStray == 0, "%ld Flash operations outside the EEPROM", SimStray);
+
+  return Test_Report("test_batch");
+}
@@ -0,0 +1,43 @@
+/**
+  ******************************************************************************
+  * @file    test/test_blank.c
+  * @brief   Blank check before the erases: EE_Init() formats a blank Flash and
+  *          takes over a valid page without erasing the pages which read
+  *          erased already, while an erased page holding a stray programmed
+  *          word is erased again.
+  ******************************************************************************
+  */
+#include "test_util.h"
+
+int main(void)
+{
+  uint32_t Stray;
+  long n;
+  int Idx;
+
+  Test_Setup();
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "init");
+  CHECK(SimErases == 0, "format of a blank Flash: %ld erases", SimErases);
+
+  /* The page transfer erases the page it leaves */
+  for (n = 0; SimErases == 0; n++)
+  {
+    Idx = (int)(n % NB_OF_VAR);
+    CHECK(EE_WriteVariable(&Eeprom, VirtAddVarTab[Idx], (ee_data_t)n) == EE_SUCCESS, "write %ld", n);
+    TestModel[Idx] = (ee_data_t)n;
+  }
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "reinit");
+  CHECK(SimErases == 1, "init: %ld erases of blank pages", SimErases - 1);
+  Test_Verify("reinit");
+
+  /* A word programmed at the end of the next page, its header reads erased */
+  Stray = TEST_PAGE_ADDRESS((Eeprom.read_page + 1) % PAGE_NUM + 1) - 4;
+  *(uint32_t*)(uintptr_t)Stray = 0;
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "init over a stray word");
+  CHECK(SimErases == 2, "init over a stray word: %ld erases", SimErases - 1);
+  CHECK(*(uint32_t*)(uintptr_t)Stray == 0xFFFFFFFF, "stray word left");
+  Test_Verify("stray word");
+  CHECK(SimStray == 0, "%ld Flash operations outside the EEPROM", SimStray);
+
+  return Test_Report("test_blank");
+}
@@ -0,0 +1,242 @@
+/**
+  ******************************************************************************
+  * @file    test/test_blob.c
+  * @brief   Blob records: a blob reads back as written, its overwrites replace
+  *          it, the page transfers copy only its newest version, blobs longer
+  *          than EE_BLOB_MAX_LENGTH are refused, and a power cut during a blob
+  *          write leaves either the old or the new version. Built once more
+  *          with EE_BLOB_KEYS_MAX set to 1, and once with EE_CRC_ENABLE, see
+  *          the Makefile, these builds keep track of a single blob key in the
+  *          transfers and search the new page for the other.
+  ******************************************************************************
+  */
+#include <string.h>
+#include "test_util.h"
+
+#ifndef EE_BLOB_ENABLE
+  #error("test_blob needs EE_BLOB_ENABLE")
+#endif
+
+#ifdef EE_CRC_ENABLE
+#define TEST_NAME   "test_blob_crc"
+#elif (EE_BLOB_KEYS_MAX == 1)
+#define TEST_NAME   "test_blob_keys"
+#else
+#define TEST_NAME   "test_blob"
+#endif
+
+#define BLOBS       2
+#define WRITES      3000
+#define CUTS        1000
+
+/* Longest blob of the random writes: the newest version of each one and a 
+   record of each variable fit in a page */
+#define BLOB_RECORDS  ((TEST_PAGE_RECORDS - NB_OF_VAR) / BLOBS - 3)
+#define BLOB_MAX      ((BLOB_RECORDS * TEST_DATA_SIZE < EE_BLOB_MAX_LENGTH) ? BLOB_RECORDS * TEST_DATA_SIZE : EE_BLOB_MAX_LENGTH)
+
+/* Operations allowed before the cut, a blob write and a page transfer */
+#define CUT_RANGE   (2 * TEST_PAGE_RECORDS)
+
+static const ee_data_t Keys[BLOBS] = { 0x2000, 0x2001 };
+
+/* Model of the blobs, Length 0 if never written */
+static uint8_t Model[BLOBS][EE_BLOB_MAX_LENGTH];
+static uint16_t ModelLength[BLOBS];
+
+static uint8_t New[EE_BLOB_MAX_LENGTH];
+
+static void Fill(uint8_t* Buffer, uint16_t Length)
+{
+  uint16_t Idx;
+
+  for (Idx = 0; Idx < Length; Idx++)
+  {
+    Buffer[Idx] = (uint8_t)rand();
+  }
+}
+
+static void Verify_Blobs(const char* Tag)
+{
+  uint8_t Buffer[EE_BLOB_MAX_LENGTH + 1];
+  uint16_t Length;
+  int Blob;
+  int Status;
+
+  for (Blob = 0; Blob < BLOBS; Blob++)
+  {
+    if (ModelLength[Blob] == 0)
+    {
+      CHECK(EE_BlobSize(&Eeprom, Keys[Blob], &Length) == 1, "%s: blob %d should be missing", Tag, Blob);
+      CHECK(EE_BlobRead(&Eeprom, Keys[Blob], Buffer, sizeof(Buffer)) == 1, "%s: blob %d should be missing", Tag, Blob);
+      continue;
+    }
+    Status = EE_BlobSize(&Eeprom, Keys[Blob], &Length);
+    CHECK((Status == 0) && (Length == ModelLength[Blob]), "%s: blob %d size %u, status %d, expected %u",
+          Tag, Blob, Length, Status, ModelLength[Blob]);
+    Status = EE_BlobRead(&Eeprom, Keys[Blob], Buffer, ModelLength[Blob] - 1);
+    CHECK(Status == BUFFER_TOO_SMALL, "%s: blob %d read in a short buffer, status %d", Tag, Blob, Status);
+    memset(Buffer, 0, sizeof(Buffer));
+    Status = EE_BlobRead(&Eeprom, Keys[Blob], Buffer, ModelLength[Blob]);
+    CHECK((Status == 0) && (memcmp(Buffer, Model[Blob], ModelLength[Blob]) == 0), "%s: blob %d content, status %d",
+          Tag, Blob, Status);
+  }
+}
+
+/* Key records of a blob in a page, one per version */
+static int Count_Versions(uint16_t Page, ee_data_t Key)
+{
+  uint32_t Address = TEST_PAGE_ADDRESS(Page) + TEST_HEADER_SIZE;
+  uint32_t End = Address + Test_CountRecords(Page) * TEST_RECORD_SIZE;
+  int Count = 0;
+
+  for (; Address < End; Address += TEST_RECORD_SIZE)
+  {
+    if ((*(ee_data_t*)(uintptr_t)(Address + TEST_DATA_SIZE) == EE_BLOB_TAG_KEY) &&
+        (*(ee_data_t*)(uintptr_t)Address == Key))
+    {
+      Count++;
+    }
+  }
+  return Count;
+}
+
+static void Write_Blob(int Blob, uint16_t Length)
+{
+  Fill(New, Length);
+  CHECK(EE_BlobWrite(&Eeprom, Keys[Blob], New, Length) == EE_SUCCESS, "blob %d write of %u bytes", Blob, Length);
+  memcpy(Model[Blob], New, Length);
+  ModelLength[Blob] = Length;
+}
+
+/* EE_Init(), cut again now and then until it completes */
+static int Recover(void)
+{
+  volatile int Attempts = 0;
+
+  if (setjmp(SimCutJmp) != 0)
+  {
+    Attempts++;
+  }
+  SimCutAfter = (Attempts < 8) && (rand() % 2 == 0) ? rand() % 16 : -1;
+  return EE_Init(&Eeprom);
+}
+
+int main(void)
+{
+  uint8_t Buffer[EE_BLOB_MAX_LENGTH];
+  ee_stats_t Before;
+  ee_stats_t After;
+  volatile long Cuts = 0;
+  volatile int Blob;
+  volatile uint16_t Length;
+  uint16_t StoredLength;
+  uint16_t Page;
+  long Erases;
+  long Transfers = 0;
+  long n;
+  int Idx;
+  int Status;
+
+  Test_Setup();
+  srand(12);
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "init");
+  Verify_Blobs("init");
+
+  /* Write, overwrite with other lengths, up to the limit */
+  /* A blob counts as one write, whatever its number of records */
+  EE_GetStats(&Eeprom, &Before);
+  Write_Blob(0, 1);
+  Write_Blob(1, 5 * TEST_DATA_SIZE);
+  EE_GetStats(&Eeprom, &After);
+  CHECK(After.write_count - Before.write_count == 2, "%lu writes counted for 2 blobs",
+        (unsigned long)(After.write_count - Before.write_count));
+  Verify_Blobs("first");
+  Write_Blob(0, EE_BLOB_MAX_LENGTH);
+  Verify_Blobs("longest");
+  Write_Blob(0, BLOB_MAX);
+  Write_Blob(1, 37);
+  Verify_Blobs("overwrite");
+  Fill(New, EE_BLOB_MAX_LENGTH);
+  CHECK(EE_BlobWrite(&Eeprom, Keys[1], New, EE_BLOB_MAX_LENGTH + 1) == PAGE_FULL, "blob over the limit");
+  Verify_Blobs("over the limit");
+
+  /* Variables and blobs mixed: after each transfer, one version of each blob */
+  EE_GetStats(&Eeprom, &Before);
+  for (n = 0; n < WRITES; n++)
+  {
+    Page = Eeprom.write_page;
+    Erases = SimErases;
+    if (rand() % 8 == 0)
+    {
+      Write_Blob(rand() % BLOBS, (uint16_t)(1 + rand() % BLOB_MAX));
+    }
+    else
+    {
+      Idx = rand() % NB_OF_VAR;
+      Status = EE_WriteVariable(&Eeprom, VirtAddVarTab[Idx], (ee_data_t)n);
+      CHECK(Status == EE_SUCCESS, "write %ld status %d", n, Status);
+      TestModel[Idx] = (ee_data_t)n;
+    }
+    if ((Eeprom.write_page != Page) && (SimErases != Erases))
+    {
+      Transfers++;
+      for (Idx = 0; Idx < BLOBS; Idx++)
+      {
+        CHECK(Count_Versions(Eeprom.write_page, Keys[Idx]) == 1, "write %ld: blob %d has %d versions after a transfer",
+              n, Idx, Count_Versions(Eeprom.write_page, Keys[Idx]));
+      }
+    }
+  }
+  CHECK(Transfers > 0, "no transfer");
+  EE_GetStats(&Eeprom, &After);
+  CHECK(After.write_count - Before.write_count == WRITES, "%lu writes counted for %d blobs and variables",
+        (unsigned long)(After.write_count - Before.write_count), WRITES);
+  Test_Verify("mixed");
+  Verify_Blobs("mixed");
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "reinit");
+  Test_Verify("reinit");
+  Verify_Blobs("reinit");
+
+  /* Power cuts during the blob writes */
+#ifdef EE_CRC_ENABLE
+  SimTearFrom = 0;
+#endif
+  while (Cuts < CUTS)
+  {
+    Blob = rand() % BLOBS;
+    Length = (uint16_t)(1 + rand() % BLOB_MAX);
+    Fill(New, Length);
+    if (setjmp(SimCutJmp) == 0)
+    {
+      SimCutAfter = rand() % CUT_RANGE;
+      CHECK(EE_BlobWrite(&Eeprom, Keys[Blob], New, Length) == EE_SUCCESS, "blob %d write", Blob);
+      SimCutAfter = -1;
+      memcpy(Model[Blob], New, Length);
+      ModelLength[Blob] = Length;
+      continue;
+    }
+
+    /* The blob holds its old version or the new one */
+    Cuts++;
+    Status = Recover();
+    CHECK(Status == EE_SUCCESS, "recovery %ld status %d", Cuts, Status);
+    SimCutAfter = -1;
+    Status = EE_BlobRead(&Eeprom, Keys[Blob], Buffer, sizeof(Buffer));
+    if ((Status == 0) && (memcmp(Buffer, New, Length) == 0) &&
+        (EE_BlobSize(&Eeprom, Keys[Blob], &StoredLength) == 0) && (StoredLength == Length))
+    {
+      memcpy(Model[Blob], New, Length);
+      ModelLength[Blob] = Length;
+    }
+    Verify_Blobs("cut");
+    Test_Verify("cut");
+  }
+  SimTearFrom = -1;
+
+  CHECK(SimStray == 0, "%ld Flash operations outside the EEPROM", SimStray);
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "final init");
+  Test_Verify("final");
+  Verify_Blobs("final");
+
+  return Test_Report(TEST_NAME);
+}
@@ -0,0 +1,67 @@
+/**
+  ******************************************************************************
+  * @file    test/test_erasefail.c
+  * @brief   Failed erases: the page left behind is neither valid nor blank and
+  *          the transfers must not select it, nor a page out of the allocation
+  *          when no other page is erased. The write reporting the failure
+  *          succeeds when it is retried, the page is erased again.
+  ******************************************************************************
+  */
+#include "test_util.h"
+
+#define WRITES      20000
+
+static void Run(uint16_t PageNum)
+{
+  long n;
+  int Idx;
+  int Status;
+  long Failures = 0;
+
+  Test_Setup();
+  EmulatedChips[0].page_num = PageNum;
+  srand(13);
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "%u pages: init", PageNum);
+
+  for (n = 0; n < WRITES; n++)
+  {
+    Idx = rand() % NB_OF_VAR;
+    if (rand() % 64 == 0)
+    {
+      SimFailErase = 0;
+    }
+
+    Status = EE_WriteVariable(&Eeprom, VirtAddVarTab[Idx], (ee_data_t)n);
+    if (Status == FLASH_ERROR_PROGRAM)
+    {
+      /* The value may be stored or not, the erase is tried again by the retry */
+      Failures++;
+      Status = EE_WriteVariable(&Eeprom, VirtAddVarTab[Idx], (ee_data_t)n);
+    }
+    CHECK(Status == EE_SUCCESS, "%u pages: write %ld status %d", PageNum, n, Status);
+    TestModel[Idx] = (ee_data_t)n;
+
+    if (n % 1000 == 0)
+    {
+      SimFailErase = -1;
+      CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "%u pages: init at %ld", PageNum, n);
+      Test_Verify("init");
+    }
+  }
+
+  CHECK(Failures > 0, "%u pages: no erase failed", PageNum);
+  CHECK(SimStray == 0, "%u pages: %ld operations outside the Flash", PageNum, SimStray);
+  Test_Verify("end");
+  SimFailErase = -1;
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "%u pages: final init", PageNum);
+  Test_Verify("final");
+}
+
+int main(void)
+{
+  Run(2);
+  Run(3);
+  Run(PAGE_NUM);
+
+  return Test_Report("test_erasefail");
+}
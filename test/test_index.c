@@ -0,0 +1,75 @@
+/**
+  ******************************************************************************
+  * @file    test/test_index.c
+  * @brief   RAM index during the page transfers: after each Flash operation,
+  *          as a reader running without the lock would see it, every variable
+  *          written has an index entry pointing to a record holding its value,
+  *          in the old page until its record is copied, then in the new one.
+  *          Built for 16 and 32 bit data, see the Makefile.
+  ******************************************************************************
+  */
+#include "test_util.h"
+
+#ifndef EE_INDEX_ENABLE
+  #error("test_index needs EE_INDEX_ENABLE")
+#endif
+
+#define WRITES      20000
+
+#if (EE_DATA_32BIT == EE_DATA_WIDTH)
+#define TEST_NAME   "test_index_32"
+#else
+#define TEST_NAME   "test_index"
+#endif
+
+/* Variable being written, its entry may hold the old or the new value */
+static int Writing = -1;
+static long Checks;
+
+static void Check_Index(void)
+{
+  uint16_t Entry;
+  ee_data_t Data;
+  int Idx;
+
+  Checks++;
+  CHECK(Eeprom.read_page != NO_VALID_PAGE, "no valid page for the index reads");
+  for (Idx = 0; Idx < NB_OF_VAR; Idx++)
+  {
+    if ((Idx == Writing) || (TestModel[Idx] == TEST_MISSING))
+    {
+      continue;
+    }
+    Entry = Eeprom.index_offset[Idx];
+    Data = *(ee_data_t*)(uintptr_t)(EEPROM_START_ADDRESS + (uint32_t)Entry * TEST_RECORD_SIZE);
+    CHECK((Entry != 0) && (Data == (ee_data_t)TestModel[Idx]),
+          "variable %d: entry %u reads %lu, expected %ld", Idx, Entry, (unsigned long)Data, TestModel[Idx]);
+  }
+}
+
+int main(void)
+{
+  long n;
+
+  Test_Setup();
+  srand(19);
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "init");
+
+  SimHook = Check_Index;
+  for (n = 0; n < WRITES; n++)
+  {
+    Writing = rand() % NB_OF_VAR;
+    CHECK(EE_WriteVariable(&Eeprom, VirtAddVarTab[Writing], (ee_data_t)n) == EE_SUCCESS, "write %ld", n);
+    TestModel[Writing] = (ee_data_t)n;
+    Writing = -1;
+    Check_Index();
+  }
+  SimHook = 0;
+
+  CHECK(SimErases > 0, "no transfer");
+  Test_Verify("end");
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "final init");
+  Test_Verify("final");
+
+  return Test_Report(TEST_NAME);
+}
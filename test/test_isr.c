@@ -0,0 +1,188 @@
+/**
+  ******************************************************************************
+  * @file    test/test_isr.c
+  * @brief   Writes from interrupts: an interrupt run after the Flash operations,
+  *          page transfers included, queues writes of its own variables with
+  *          EE_WriteVariableFromISR() while the thread writes the others. The
+  *          queued values read back at once, a full ring refuses the write,
+  *          the thread writes and EE_DrainISRWrites() take them to the Flash,
+  *          EE_Flush() as well, and they survive a reset. With
+  *          EE_WRITEBACK_ENABLE they go through the cache. With
+  *          EE_ISR_READ_ENABLE, the interrupt also reads every variable with
+  *          EE_ReadVariableFromISR(): it gets the newest value, or the
+  *          previous one of a variable the thread is writing.
+  ******************************************************************************
+  */
+#include <string.h>
+#include "test_util.h"
+
+#ifndef EE_ISR_RING_ENABLE
+  #error("test_isr needs EE_ISR_RING_ENABLE")
+#endif
+
+#if defined(EE_ISR_READ_ENABLE)
+#define TEST_NAME   "test_isr_read"
+#elif defined(EE_WRITEBACK_ENABLE)
+#define TEST_NAME   "test_isr_writeback"
+#else
+#define TEST_NAME   "test_isr"
+#endif
+
+#define WRITES      5000
+
+/* The last ISR_VARS variables are written by the interrupt only */
+#define ISR_VARS    5
+#define THREAD_VARS (NB_OF_VAR - ISR_VARS)
+
+static long IsrData = 0x4000;
+static long IsrQueued;
+static long IsrFull;
+static long IsrInTransfer;
+
+#ifdef EE_ISR_READ_ENABLE
+/* Values before the thread operation in progress */
+static long Previous[NB_OF_VAR];
+static long IsrReads;
+
+/* Every variable reads its value, or its previous one while it is written */
+static void Isr_Read(void)
+{
+  ee_data_t Value;
+  int Idx;
+  int Status;
+
+  for (Idx = 0; Idx < NB_OF_VAR; Idx++)
+  {
+    Value = 0;
+    Status = EE_ReadVariableFromISR(&Eeprom, VirtAddVarTab[Idx], &Value);
+    if (Status == 1)
+    {
+      CHECK((TestModel[Idx] == TEST_MISSING) || (Previous[Idx] == TEST_MISSING),
+            "read from the interrupt: variable %d missing", Idx);
+    }
+    else
+    {
+      CHECK((Status == 0) && ((Value == (ee_data_t)TestModel[Idx]) || (Value == (ee_data_t)Previous[Idx])),
+            "read from the interrupt: variable %d read %lu status %d, expected %ld or %ld",
+            Idx, (unsigned long)Value, Status, TestModel[Idx], Previous[Idx]);
+    }
+  }
+  IsrReads++;
+}
+#endif
+
+/* Interrupt taken after a Flash operation, one time out of three */
+static void Isr(void)
+{
+  int Idx = THREAD_VARS + rand() % ISR_VARS;
+  int Status;
+#ifdef EE_ISR_READ_ENABLE
+  ee_data_t Data;
+
+  Isr_Read();
+#endif
+  if (rand() % 3 != 0)
+  {
+    return;
+  }
+
+  Status = EE_WriteVariableFromISR(&Eeprom, VirtAddVarTab[Idx], (ee_data_t)IsrData);
+  if (Status == QUEUE_FULL)
+  {
+    IsrFull++;
+    return;
+  }
+  CHECK(Status == EE_SUCCESS, "write from the interrupt status %d", Status);
+  TestModel[Idx] = (ee_data_t)IsrData++;
+#ifdef EE_ISR_READ_ENABLE
+  Previous[Idx] = TestModel[Idx];
+  CHECK((EE_ReadVariableFromISR(&Eeprom, VirtAddVarTab[Idx], &Data) == 0) && (Data == (ee_data_t)TestModel[Idx]),
+        "queued value not read from the interrupt");
+#endif
+  IsrQueued++;
+  if (Eeprom.write_page != Eeprom.read_page)
+  {
+    IsrInTransfer++;
+  }
+}
+
+/* Power on reset: the RAM state is lost, the Flash is read again */
+static void Reset(void)
+{
+  memset(&Eeprom, 0, sizeof(Eeprom));
+  Eeprom.alloc = &EmulatedChips[0];
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "init");
+}
+
+int main(void)
+{
+  ee_var_t Vars[3];
+  long n;
+  int Idx;
+  int Status;
+
+  Test_Setup();
+  srand(21);
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "init");
+
+  SimHook = Isr;
+  for (n = 0; n < WRITES; n++)
+  {
+#ifdef EE_ISR_READ_ENABLE
+    memcpy(Previous, TestModel, sizeof(Previous));
+#endif
+    Idx = rand() % THREAD_VARS;
+    switch (rand() % 8)
+    {
+    case 0:
+      Status = EE_DrainISRWrites(&Eeprom);
+      CHECK(Status == EE_SUCCESS, "drain %ld status %d", n, Status);
+      break;
+    case 1:
+      for (Status = 0; Status < 3; Status++)
+      {
+        Vars[Status].addr = VirtAddVarTab[(Idx + Status) % THREAD_VARS];
+        Vars[Status].data = (ee_data_t)(n + Status);
+        TestModel[(Idx + Status) % THREAD_VARS] = (ee_data_t)(n + Status);
+      }
+      Status = EE_WriteVariables(&Eeprom, Vars, 3);
+      CHECK(Status == EE_SUCCESS, "batch %ld status %d", n, Status);
+      break;
+    default:
+      TestModel[Idx] = (ee_data_t)n;
+      Status = EE_WriteVariable(&Eeprom, VirtAddVarTab[Idx], (ee_data_t)n);
+      CHECK(Status == EE_SUCCESS, "write %ld status %d", n, Status);
+      break;
+    }
+
+    /* The values queued by the interrupt are read back before they are written */
+    Test_Verify("write");
+  }
+  SimHook = 0;
+  CHECK(IsrQueued > WRITES / 2, "%ld writes queued by the interrupt", IsrQueued);
+  CHECK(IsrInTransfer > 0, "no write queued during a page transfer");
+  CHECK(IsrFull > 0, "the ring was never full");
+  CHECK(SimErases > 2 * PAGE_NUM, "%ld erases", SimErases);
+
+  /* Queued writes do not reach the Flash until they are drained or flushed */
+  CHECK(EE_WriteVariableFromISR(&Eeprom, VirtAddVarTab[THREAD_VARS], 0x1234) == EE_SUCCESS, "last write from the interrupt");
+  TestModel[THREAD_VARS] = 0x1234;
+  Test_Verify("queued");
+  CHECK(EE_DrainISRWrites(&Eeprom) == EE_SUCCESS, "last drain");
+  CHECK(Eeprom.isr_head == Eeprom.isr_tail, "entries left in the ring");
+  CHECK(EE_WriteVariableFromISR(&Eeprom, VirtAddVarTab[THREAD_VARS + 1], 0x5678) == EE_SUCCESS, "write before the flush");
+  TestModel[THREAD_VARS + 1] = 0x5678;
+  CHECK(EE_Flush(&Eeprom) == EE_SUCCESS, "flush");
+  CHECK(Eeprom.isr_head == Eeprom.isr_tail, "entries left in the ring after the flush");
+  Reset();
+  Test_Verify("reset");
+#ifdef EE_ISR_READ_ENABLE
+  CHECK(IsrReads > WRITES, "%ld reads from the interrupt", IsrReads);
+  memcpy(Previous, TestModel, sizeof(Previous));
+  Isr_Read();
+  CHECK(EE_ReadVariableFromISR(&Eeprom, 0x0FFF, &Vars[0].data) == 1, "variable out of the table read from the interrupt");
+#endif
+  CHECK(SimStray == 0, "%ld Flash operations outside the EEPROM", SimStray);
+
+  return Test_Report(TEST_NAME);
+}
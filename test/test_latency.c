@@ -0,0 +1,103 @@
+/**
+  ******************************************************************************
+  * @file    test/test_latency.c
+  * @brief   Write latency benchmark: the cost of an append must not depend on
+  *          how full the page is. Each append costs a halfword program per
+  *          halfword of the record and its time, the median per tenth of the
+  *          page, stays flat from the first record to the last.
+  ******************************************************************************
+  */
+#include <string.h>
+#include <time.h>
+#include "test_util.h"
+
+#define BUCKETS     10
+#define PAGE_FILLS  200
+#define MAX_SAMPLES (PAGE_FILLS * (TEST_PAGE_RECORDS / BUCKETS + 1))
+
+/* Tolerated ratio of the slowest tenth to the fastest */
+#define FLAT_RATIO  2.0
+
+static double Samples[BUCKETS][MAX_SAMPLES];
+static int SampleCount[BUCKETS];
+
+static double Now(void)
+{
+  struct timespec Ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &Ts);
+  return Ts.tv_sec * 1e9 + Ts.tv_nsec;
+}
+
+static int Compare(const void* a, const void* b)
+{
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+
+  return (x > y) - (x < y);
+}
+
+int main(void)
+{
+  double Median[BUCKETS];
+  double Fastest = 1e30;
+  double Slowest = 0;
+  int Bucket;
+  long n;
+
+  Test_Setup();
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "init");
+
+  for (n = 0; SampleCount[BUCKETS - 1] < MAX_SAMPLES - 1 && n < 10000000; n++)
+  {
+    int Idx = (int)(n % NB_OF_VAR);
+    uint16_t Page = Eeprom.write_page;
+    uint32_t Offset = Eeprom.write_address - (EEPROM_START_ADDRESS + Page * PAGE_SIZE);
+    long Programs = SimPrograms;
+    long Erases = SimErases;
+    double Start = Now();
+    double Elapsed;
+
+    CHECK(EE_WriteVariable(&Eeprom, VirtAddVarTab[Idx], (ee_data_t)n) == EE_SUCCESS, "write %ld", n);
+    Elapsed = Now() - Start;
+    TestModel[Idx] = (ee_data_t)n;
+
+    /* The writes which transfer the page are not appends */
+    if ((Eeprom.write_page != Page) || (SimErases != Erases))
+    {
+      continue;
+    }
+    CHECK(SimPrograms - Programs == TEST_RECORD_SIZE / 2, "append %ld took %ld programs", n, SimPrograms - Programs);
+
+    Bucket = (int)(Offset * BUCKETS / PAGE_SIZE);
+    if (SampleCount[Bucket] < MAX_SAMPLES)
+    {
+      Samples[Bucket][SampleCount[Bucket]++] = Elapsed;
+    }
+  }
+  Test_Verify("end");
+
+  printf("fill    median ns  samples\n");
+  for (Bucket = 0; Bucket < BUCKETS; Bucket++)
+  {
+    CHECK(SampleCount[Bucket] > 0, "no sample at %d0%%", Bucket);
+    if (SampleCount[Bucket] == 0)
+    {
+      continue;
+    }
+    qsort(Samples[Bucket], SampleCount[Bucket], sizeof(double), Compare);
+    Median[Bucket] = Samples[Bucket][SampleCount[Bucket] / 2];
+    printf("%3d%%  %10.0f  %8d\n", Bucket * 100 / BUCKETS, Median[Bucket], SampleCount[Bucket]);
+    if (Median[Bucket] < Fastest)
+    {
+      Fastest = Median[Bucket];
+    }
+    if (Median[Bucket] > Slowest)
+    {
+      Slowest = Median[Bucket];
+    }
+  }
+  CHECK(Slowest <= Fastest * FLAT_RATIO, "latency grows with the fill: %.0f ns to %.0f ns", Fastest, Slowest);
+
+  return Test_Report("test_latency");
+}
@@ -0,0 +1,161 @@
+/**
+  ******************************************************************************
+  * @file    test/test_legacy.c
+  * @brief   Migration of the pages written before the page header: a status
+  *          halfword then records of a data and a virtual address halfword.
+  *          EE_Init() must keep the newest value of each variable, after an
+  *          interrupted transfer between two legacy pages too, and when it is
+  *          cut by a reset at any point of the migration.
+  ******************************************************************************
+  */
+#include <string.h>
+#include "test_util.h"
+
+/* Legacy page status values */
+#define LEGACY_VALID        ((uint16_t)0x0000)
+#define LEGACY_RECEIVE      ((uint16_t)0xEEEE)
+
+static uint32_t LegacyAddress[PAGE_NUM];
+
+static void Legacy_Page(uint16_t Page, uint16_t Status)
+{
+  uint32_t Base = EEPROM_START_ADDRESS + Page * PAGE_SIZE;
+
+  *(uint16_t*)(uintptr_t)Base = Status;
+  LegacyAddress[Page] = Base + 4;
+}
+
+static void Legacy_Record(uint16_t Page, int Idx, uint16_t Data)
+{
+  *(uint16_t*)(uintptr_t)LegacyAddress[Page] = Data;
+  *(uint16_t*)(uintptr_t)(LegacyAddress[Page] + 2) = (uint16_t)VirtAddVarTab[Idx];
+  LegacyAddress[Page] += 4;
+}
+
+/* The layouts left by the library of that time, on a fresh Flash */
+enum
+{
+  LAYOUT_VALID,               /* a valid page with several records per variable */
+  LAYOUT_EMPTY,               /* a valid page without record, just formatted */
+  LAYOUT_TRANSFER,            /* a reset in the middle of a transfer */
+  LAYOUT_RECEIVE,             /* a reset after the erase of the old page */
+  LAYOUT_COUNT
+};
+
+static void Legacy_Setup(int Layout, uint16_t PageNum)
+{
+  uint16_t Valid = PageNum - 1;
+  uint16_t Receive = 0;
+  int Idx;
+  int n;
+
+  Test_Setup();
+  EmulatedChips[0].page_num = PageNum;
+
+  if (Layout == LAYOUT_RECEIVE)
+  {
+    Valid = Receive;
+  }
+  Legacy_Page(Valid, (Layout == LAYOUT_RECEIVE) ? LEGACY_RECEIVE : LEGACY_VALID);
+  if (Layout == LAYOUT_EMPTY)
+  {
+    return;
+  }
+
+  for (n = 0; n < 3 * NB_OF_VAR; n++)
+  {
+    Idx = (n * 5) % NB_OF_VAR;
+    if (Idx == 3)
+    {
+      /* Never written */
+      continue;
+    }
+    Legacy_Record(Valid, Idx, (uint16_t)(0x100 + n));
+    TestModel[Idx] = 0x100 + n;
+  }
+
+  if (Layout == LAYOUT_TRANSFER)
+  {
+    /* The write which filled the page, then part of the copy */
+    Legacy_Page(Receive, LEGACY_RECEIVE);
+    Legacy_Record(Receive, 7, 0x7777);
+    TestModel[7] = 0x7777;
+    for (Idx = 0; Idx < NB_OF_VAR / 2; Idx++)
+    {
+      if ((Idx != 7) && (TestModel[Idx] != TEST_MISSING))
+      {
+        Legacy_Record(Receive, Idx, (uint16_t)TestModel[Idx]);
+      }
+    }
+    /* A record torn by the reset */
+    *(uint16_t*)(uintptr_t)LegacyAddress[Receive] = 0x1234;
+  }
+}
+
+static void Check_Migrated(const char* Tag)
+{
+  int Page;
+  int Committed = 0;
+
+  for (Page = 0; Page < EmulatedChips[0].page_num; Page++)
+  {
+    uint16_t* Header = (uint16_t*)(uintptr_t)(EEPROM_START_ADDRESS + Page * PAGE_SIZE);
+
+    CHECK(Header[1] != 0xFFFF || Header[0] == 0xFFFF, "%s: page %d in use without erase count", Tag, Page);
+    Committed += (Header[0] == 0) && ((uint16_t)(Header[2] ^ Header[3]) == 0xFFFF);
+  }
+  CHECK(Committed >= 1, "%s: no committed page", Tag);
+  Test_Verify(Tag);
+}
+
+int main(void)
+{
+  static const uint16_t PageNums[] = { 2, 3, PAGE_NUM };
+  volatile long Cut;
+  int Layout;
+  int Num;
+  int Idx;
+  int Status;
+  char Tag[64];
+
+  for (Num = 0; Num < (int)(sizeof(PageNums) / sizeof(PageNums[0])); Num++)
+  {
+    for (Layout = 0; Layout < LAYOUT_COUNT; Layout++)
+    {
+      snprintf(Tag, sizeof(Tag), "layout %d, %u pages", Layout, PageNums[Num]);
+
+      Legacy_Setup(Layout, PageNums[Num]);
+      CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "%s: init", Tag);
+      Check_Migrated(Tag);
+
+      /* The migrated EEPROM is written and transferred as usual */
+      for (Idx = 0; Idx < 40 * NB_OF_VAR; Idx++)
+      {
+        CHECK(EE_WriteVariable(&Eeprom, VirtAddVarTab[Idx % NB_OF_VAR], (ee_data_t)Idx) == EE_SUCCESS, "%s: write", Tag);
+        TestModel[Idx % NB_OF_VAR] = (ee_data_t)Idx;
+      }
+      CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "%s: init after writes", Tag);
+      Check_Migrated(Tag);
+
+      /* A reset at each point of the migration, the next EE_Init() completes it */
+      for (Cut = 0; ; Cut++)
+      {
+        Legacy_Setup(Layout, PageNums[Num]);
+        if (setjmp(SimCutJmp) == 0)
+        {
+          SimCutAfter = Cut;
+          Status = EE_Init(&Eeprom);
+          SimCutAfter = -1;
+          CHECK(Status == EE_SUCCESS, "%s: init", Tag);
+          break;
+        }
+        SimCutAfter = -1;
+        snprintf(Tag, sizeof(Tag), "layout %d, %u pages, cut %ld", Layout, PageNums[Num], Cut);
+        CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "%s: init", Tag);
+        Check_Migrated(Tag);
+      }
+    }
+  }
+
+  return Test_Report("test_legacy");
+}
@@ -0,0 +1,122 @@
+/**
+  ******************************************************************************
+  * @file    test/test_lowpower.c
+  * @brief   Page erases sleeping in WFE, with EE_RAMFUNC_ENABLE and
+  *          EE_LOWPOWER_ENABLE: EE_GET_TICK() runs the FLASH controller, one
+  *          millisecond per read. The erase of a page transfer sleeps until
+  *          EOP, an erase ending on ERR returns FLASH_ERROR_PROGRAM and its
+  *          PGERR does not fail the next write, and one outlasting
+  *          EE_ERASE_TIMEOUT_MS returns FLASH_TIMEOUT, as does a program left
+  *          busy. The next write waits for the erase still in progress, and
+  *          every value reads back after EE_Init().
+  ******************************************************************************
+  */
+#include "test_util.h"
+
+#if !defined(EE_RAMFUNC_ENABLE) || !defined(EE_LOWPOWER_ENABLE)
+  #error("test_lowpower needs EE_RAMFUNC_ENABLE and EE_LOWPOWER_ENABLE")
+#endif
+
+static long Count;
+static long Ticks;
+static int LastIdx;
+
+/* Writes until one of them erases a page or fails, returns its status. Ticks
+   is the duration of the last write */
+static int Write_Transfer(void)
+{
+  long Erases = SimErases;
+  uint32_t Start;
+  int Status;
+
+  do
+  {
+    LastIdx = rand() % NB_OF_VAR;
+    Start = SimTick;
+    Status = EE_WriteVariable(&Eeprom, VirtAddVarTab[LastIdx], (ee_data_t)++Count);
+    Ticks = (long)(SimTick - Start);
+    if (Status == EE_SUCCESS)
+    {
+      TestModel[LastIdx] = (ee_data_t)Count;
+    }
+  } while ((Status == EE_SUCCESS) && (SimErases == Erases));
+
+  return Status;
+}
+
+/* The value of the failed write may be stored or not, its retry stores it */
+static void Retry(const char* Tag)
+{
+  CHECK(EE_WriteVariable(&Eeprom, VirtAddVarTab[LastIdx], (ee_data_t)Count) == EE_SUCCESS, "%s: retry", Tag);
+  TestModel[LastIdx] = (ee_data_t)Count;
+  Test_Verify(Tag);
+}
+
+/* The erase left no trace in the registers */
+static void Check_Registers(const char* Tag)
+{
+  CHECK((FLASH->CR & (FLASH_CR_PER | FLASH_CR_PG | FLASH_CR_EOPIE | FLASH_CR_ERRIE)) == 0,
+        "%s: FLASH->CR 0x%lx", Tag, (unsigned long)FLASH->CR);
+  CHECK((SCB->SCR & SCB_SCR_SEVONPEND_Msk) == 0, "%s: SEVONPEND left set", Tag);
+}
+
+int main(void)
+{
+  uint32_t Start;
+  long Erases;
+  int Status;
+
+  Test_Setup();
+  srand(24);
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "init");
+
+  /* EOP: the erase sleeps for its whole duration */
+  Erases = SimErases;
+  Status = Write_Transfer();
+  CHECK(Status == EE_SUCCESS, "eop: status %d", Status);
+  CHECK(SimErases == Erases + 1, "eop: %ld erases", SimErases - Erases);
+  CHECK(Ticks > SimEraseTicks, "eop: write of %ld ticks", Ticks);
+  Check_Registers("eop");
+  Test_Verify("eop");
+
+  /* ERR: the page stays as it was, the retry clears PGERR and succeeds */
+  SimFailErase = 0;
+  Erases = SimErases;
+  Status = Write_Transfer();
+  CHECK(Status == FLASH_ERROR_PROGRAM, "err: status %d", Status);
+  CHECK(SimErases == Erases, "err: %ld erases", SimErases - Erases);
+  Check_Registers("err");
+  Retry("err");
+
+  /* Timeout: the erase goes on, the next write waits for its end */
+  SimEraseTicks = EE_ERASE_TIMEOUT_MS * 3 / 2;
+  Erases = SimErases;
+  Status = Write_Transfer();
+  CHECK(Status == FLASH_TIMEOUT, "erase timeout: status %d", Status);
+  CHECK(Ticks >= EE_ERASE_TIMEOUT_MS, "erase timeout: write of %ld ticks", Ticks);
+  CHECK(Sim_Tick() && ((FLASH->SR & FLASH_SR_BSY) != 0), "erase timeout: the erase is over");
+  Check_Registers("erase timeout");
+  SimEraseTicks = 40;
+  Retry("erase timeout");
+  CHECK(SimErases == Erases + 1, "erase timeout: %ld erases", SimErases - Erases);
+
+  /* A program busy for too long times out in EE_RamWait() as well */
+  SimProgramTicks = EE_ERASE_TIMEOUT_MS * 2;
+  LastIdx = 0;
+  Start = SimTick;
+  Status = EE_WriteVariable(&Eeprom, VirtAddVarTab[LastIdx], (ee_data_t)++Count);
+  CHECK(Status == FLASH_TIMEOUT, "program timeout: status %d", Status);
+  CHECK((long)(SimTick - Start) < 2 * EE_ERASE_TIMEOUT_MS, "program timeout: write of %ld ticks", (long)(SimTick - Start));
+  SimProgramTicks = 2;
+  while (Sim_Tick())
+  {
+  }
+  Check_Registers("program timeout");
+  Retry("program timeout");
+
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "reinit");
+  Test_Verify("reinit");
+  CHECK(SimStray == 0, "%ld Flash operations outside the EEPROM", SimStray);
+
+  return Test_Report("test_lowpower");
+}
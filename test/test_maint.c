@@ -0,0 +1,80 @@
+/**
+  ******************************************************************************
+  * @file    test/test_maint.c
+  * @brief   EE_Maintenance() called between the writes takes every erase out
+  *          of them: the writes only append. With the page ring, a call per
+  *          page filled is enough, whatever the fill of the page written to
+  *          when it runs. Built once per page layout, see the Makefile.
+  ******************************************************************************
+  */
+#include "test_util.h"
+
+#define WRITES      20000
+
+/* Longest gap between the calls with the page ring, 3/5 of a page of records */
+#define MAX_GAP     (TEST_PAGE_RECORDS * 3 / 5)
+
+#ifdef EE_LOG_ENABLE
+#define TEST_NAME   "test_maint_log"
+#else
+#define TEST_NAME   "test_maint"
+#endif
+
+/* EE_Maintenance() is called after 1 to MaxGap writes */
+static void Run(uint16_t PageNum, int MaxGap)
+{
+  int Gap = 1;
+  long n;
+  int Idx;
+  long Erases;
+  long WriteErases = 0;
+  uint16_t Work;
+
+  Test_Setup();
+  EmulatedChips[0].page_num = PageNum;
+  srand(18);
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "%u pages: init", PageNum);
+
+  for (n = 0; n < WRITES; n++)
+  {
+    /* Bursts of a single variable as well, so that the pages fill with few live records */
+    Idx = (rand() % 4 == 0) ? 0 : rand() % NB_OF_VAR;
+    Erases = SimErases;
+    CHECK(EE_WriteVariable(&Eeprom, VirtAddVarTab[Idx], (ee_data_t)n) == EE_SUCCESS, "%u pages: write %ld", PageNum, n);
+    TestModel[Idx] = (ee_data_t)n;
+    WriteErases += SimErases - Erases;
+
+    if (--Gap > 0)
+    {
+      continue;
+    }
+    Gap = 1 + rand() % MaxGap;
+    Erases = SimErases;
+    CHECK(EE_Maintenance(&Eeprom, &Work) == EE_SUCCESS, "%u pages: maintenance %ld", PageNum, n);
+    CHECK((Work != 0) || (SimErases == Erases), "%u pages: maintenance %ld erased without reporting it", PageNum, n);
+
+    if (n % 997 == 0)
+    {
+      Test_Verify("maintenance");
+    }
+  }
+
+  CHECK(WriteErases == 0, "%u pages, gap %d: %ld erases in the writes", PageNum, MaxGap, WriteErases);
+  CHECK(SimErases > 0, "%u pages: no erase", PageNum);
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "%u pages: final init", PageNum);
+  Test_Verify("final");
+}
+
+int main(void)
+{
+  Run(2, 1);
+  Run(3, 1);
+  Run(PAGE_NUM, 1);
+#ifdef EE_LOG_ENABLE
+  /* Fewer calls than records in a page */
+  Run(3, MAX_GAP);
+  Run(PAGE_NUM, MAX_GAP);
+#endif
+
+  return Test_Report(TEST_NAME);
+}
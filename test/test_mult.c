@@ -0,0 +1,130 @@
+/**
+  ******************************************************************************
+  * @file    test/test_mult.c
+  * @brief   Two EEPROM instances with their own pages, page count and
+  *          variable table, the virtual addresses of the second one shared in
+  *          part with the first: writes and transfers of one instance leave the
+  *          pages and the values of the other untouched, and both read back
+  *          their values after EE_Init().
+  ******************************************************************************
+  */
+#include <string.h>
+#include "test_util.h"
+
+#if (EE_NUM < 2)
+  #error("test_mult needs two allocations, EE_NUM >= 2")
+#endif
+
+#define WRITES      20000
+#define VAR_NUM_2   6
+#define PAGE_NUM_2  3
+#define START_2     (EEPROM_START_ADDRESS + PAGE_NUM * PAGE_SIZE)
+
+static ee_data_t VirtAddVarTab2[VAR_NUM_2];
+static ee_handle_t Eeprom2;
+static long Model2[VAR_NUM_2];
+static uint8_t Snapshot[PAGE_NUM * PAGE_SIZE];
+
+static void Verify2(const char* Tag)
+{
+  ee_data_t Value;
+  int Idx;
+  int Status;
+
+  for (Idx = 0; Idx < VAR_NUM_2; Idx++)
+  {
+    Status = EE_ReadVariable(&Eeprom2, VirtAddVarTab2[Idx], &Value);
+    if (Model2[Idx] == TEST_MISSING)
+    {
+      CHECK(Status == 1, "%s: second variable %d should be missing, status %d", Tag, Idx, Status);
+    }
+    else
+    {
+      CHECK((Status == 0) && (Value == (ee_data_t)Model2[Idx]),
+            "%s: second variable %d expected %ld, status %d", Tag, Idx, Model2[Idx], Status);
+    }
+  }
+}
+
+/* The pages of an instance keep their content while the other one is written */
+static void Write_Alone(ee_handle_t* Handle, long* n)
+{
+  ee_handle_t* Other = (Handle == &Eeprom) ? &Eeprom2 : &Eeprom;
+  uint32_t Start = Other->alloc->start_addr;
+  uint32_t Size = Other->alloc->page_num * PAGE_SIZE;
+  long Erases = SimErases;
+  int Idx;
+
+  memcpy(Snapshot, (void*)(uintptr_t)Start, Size);
+  while (SimErases - Erases < 2 * Handle->alloc->page_num)
+  {
+    Idx = rand() % Handle->alloc->var_num;
+    CHECK(EE_WriteVariable(Handle, Handle->alloc->var_addr_tab[Idx], (ee_data_t)*n) == EE_SUCCESS, "write %ld", *n);
+    if (Handle == &Eeprom)
+    {
+      TestModel[Idx] = (ee_data_t)*n;
+    }
+    else
+    {
+      Model2[Idx] = (ee_data_t)*n;
+    }
+    (*n)++;
+  }
+  CHECK(memcmp(Snapshot, (void*)(uintptr_t)Start, Size) == 0, "pages at 0x%08lx changed", (unsigned long)Start);
+}
+
+int main(void)
+{
+  long n;
+  int Idx;
+
+  Test_Setup();
+  srand(23);
+  for (Idx = 0; Idx < VAR_NUM_2; Idx++)
+  {
+    VirtAddVarTab2[Idx] = (ee_data_t)(0x1000 + (VAR_NUM_2 - 1 - Idx) * 21);
+    Model2[Idx] = TEST_MISSING;
+  }
+  EmulatedChips[1].start_addr = START_2;
+  EmulatedChips[1].page_num = PAGE_NUM_2;
+  EmulatedChips[1].var_num = VAR_NUM_2;
+  EmulatedChips[1].var_addr_tab = VirtAddVarTab2;
+  Eeprom2.alloc = &EmulatedChips[1];
+
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "init");
+  CHECK(EE_Init(&Eeprom2) == EE_SUCCESS, "init second");
+  Test_Verify("init");
+  Verify2("init");
+
+  /* Interleaved writes, each instance transfers its pages several times */
+  for (n = 0; n < WRITES; n++)
+  {
+    if (rand() & 1)
+    {
+      Idx = rand() % NB_OF_VAR;
+      CHECK(EE_WriteVariable(&Eeprom, VirtAddVarTab[Idx], (ee_data_t)n) == EE_SUCCESS, "write %ld", n);
+      TestModel[Idx] = (ee_data_t)n;
+    }
+    else
+    {
+      Idx = rand() % VAR_NUM_2;
+      CHECK(EE_WriteVariable(&Eeprom2, VirtAddVarTab2[Idx], (ee_data_t)n) == EE_SUCCESS, "write second %ld", n);
+      Model2[Idx] = (ee_data_t)n;
+    }
+  }
+  Test_Verify("interleaved");
+  Verify2("interleaved");
+
+  Write_Alone(&Eeprom, &n);
+  Verify2("first alone");
+  Write_Alone(&Eeprom2, &n);
+  Test_Verify("second alone");
+
+  CHECK(EE_Init(&Eeprom2) == EE_SUCCESS, "reinit second");
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "reinit");
+  Test_Verify("reinit");
+  Verify2("reinit");
+  CHECK(SimStray == 0, "%ld Flash operations outside the EEPROM", SimStray);
+
+  return Test_Report("test_mult");
+}
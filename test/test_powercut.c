@@ -0,0 +1,156 @@
+/**
+  ******************************************************************************
+  * @file    test/test_powercut.c
+  * @brief   Power cuts: the Flash operations are cut at random points of the
+  *          writes and of the recovery itself. After EE_Init() every variable
+  *          holds its last value, the one being written when the power was
+  *          cut holds either the old or the new value. Torn programs are
+  *          left in the page headers, and in the seals and the records with
+  *          their CRC.
+  *          Built once per page layout, see the Makefile.
+  ******************************************************************************
+  */
+#include <string.h>
+#include "test_util.h"
+
+#define CUTS        3000
+
+#ifdef EE_LOG_ENABLE
+#define TEST_NAME   "test_powercut_log"
+#elif defined(EE_INCREMENTAL_ENABLE)
+#define TEST_NAME   "test_powercut_incr"
+#elif defined(EE_CRC_ENABLE)
+#define TEST_NAME   "test_powercut_crc"
+#elif (EE_DATA_32BIT == EE_DATA_WIDTH)
+#define TEST_NAME   "test_powercut_32"
+#else
+#define TEST_NAME   "test_powercut"
+#endif
+
+/* Operations allowed before the cut, spanning several page transfers */
+#define CUT_RANGE   600
+
+static long Recoveries;
+
+/* EE_Init(), cut again now and then until it completes */
+static int Recover(void)
+{
+  volatile int Attempts = 0;
+  int Status;
+
+  if (setjmp(SimCutJmp) != 0)
+  {
+    Attempts++;
+  }
+  SimCutAfter = (Attempts < 8) && (rand() % 2 == 0) ? rand() % 16 : -1;
+  Status = EE_Init(&Eeprom);
+  SimCutAfter = -1;
+  Recoveries += Attempts;
+  return Status;
+}
+
+/* A transfer cut while its commit halfword was programmed: a copy of the 
+   valid page of a newer generation, with a bit of the commit left at one. The 
+   recovery must complete the commit, or drop the page with the page ring, 
+   and do so again on the next EE_Init() */
+#define TORN_GENERATION   0x0102
+#define TORN_COMMIT       ((uint16_t)(~TORN_GENERATION | 0x0100))
+
+static void Torn_Commit(void)
+{
+  uint32_t Valid = TEST_PAGE_ADDRESS(Eeprom.read_page);
+  uint32_t Copy;
+  uint16_t Page;
+
+  CHECK(*(uint16_t*)(uintptr_t)(Valid + 4) < TORN_GENERATION, "valid page generation %u",
+        *(uint16_t*)(uintptr_t)(Valid + 4));
+  for (Page = 0; (Page < PAGE_NUM) && (*(uint16_t*)(uintptr_t)TEST_PAGE_ADDRESS(Page) != 0xFFFF); Page++)
+  {
+  }
+  CHECK(Page < PAGE_NUM, "no erased page");
+  if (Page == PAGE_NUM)
+  {
+    return;
+  }
+
+  Copy = TEST_PAGE_ADDRESS(Page);
+  memcpy((void*)(uintptr_t)Copy, (void*)(uintptr_t)Valid, PAGE_SIZE);
+  *(uint16_t*)(uintptr_t)(Copy + 4) = TORN_GENERATION;
+  *(uint16_t*)(uintptr_t)(Copy + 6) = TORN_COMMIT;
+
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "torn commit: init");
+  Test_Verify("torn commit");
+#ifndef EE_LOG_ENABLE
+  CHECK(Eeprom.read_page == Page, "torn commit: page %u valid instead of %u", Eeprom.read_page, Page);
+#endif
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "torn commit: second init");
+  Test_Verify("torn commit, second init");
+}
+
+int main(void)
+{
+  volatile long Cuts = 0;
+  volatile long n;
+  volatile int Idx;
+  volatile ee_data_t NewData;
+  ee_data_t Data;
+  int Status;
+
+  Test_Setup();
+  srand(25);
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "init");
+  for (n = 0; n < 3 * NB_OF_VAR; n++)
+  {
+    Idx = (int)(n % NB_OF_VAR);
+    CHECK(EE_WriteVariable(&Eeprom, VirtAddVarTab[Idx], (ee_data_t)n) == EE_SUCCESS, "write %ld", n);
+    TestModel[Idx] = (ee_data_t)n;
+  }
+  Torn_Commit();
+
+  /* The cut programs leave torn halfwords: the recovery copes with them in 
+     the page header and the seal, the CRC must reject them in the records */
+  SimTearFrom = 0;
+#ifndef EE_CRC_ENABLE
+  SimTearTo = TEST_HEADER_SIZE;
+#endif
+
+  for (n = 0; Cuts < CUTS; n++)
+  {
+    Idx = rand() % NB_OF_VAR;
+    NewData = (ee_data_t)rand();
+
+    if (setjmp(SimCutJmp) == 0)
+    {
+      SimCutAfter = rand() % CUT_RANGE;
+      Status = EE_WriteVariable(&Eeprom, VirtAddVarTab[Idx], NewData);
+      CHECK(Status == EE_SUCCESS, "write %ld status %d", n, Status);
+#ifdef EE_INCREMENTAL_ENABLE
+      /* The pending transfer is advanced between the writes too */
+      if (rand() % 4 == 0)
+      {
+        CHECK(EE_Step(&Eeprom, (uint16_t)(1 + rand() % 8)) == EE_SUCCESS, "step %ld", n);
+      }
+#endif
+      SimCutAfter = -1;
+      TestModel[Idx] = NewData;
+      continue;
+    }
+
+    /* The power was cut during the write of Idx, or right after it */
+    Cuts++;
+    CHECK(Recover() == EE_SUCCESS, "recovery %ld", Cuts);
+    Status = EE_ReadVariable(&Eeprom, VirtAddVarTab[Idx], &Data);
+    if ((Status == 0) && (Data == NewData))
+    {
+      TestModel[Idx] = NewData;
+    }
+    Test_Verify("cut");
+  }
+
+  CHECK(Recoveries > 0, "no recovery was cut");
+  CHECK(SimStray == 0, "%ld operations outside the Flash", SimStray);
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "final init");
+  Test_Verify("final");
+
+  return Test_Report(TEST_NAME);
+}
@@ -0,0 +1,24 @@
+/**
+  ******************************************************************************
+  * @file    test/test_ramfunc.c
+  * @brief   Application linked with EE_RAMFUNC_ENABLE and EE_LOWPOWER_ENABLE
+  *          for check_ramfunc.sh, which reads its map and its code. It is not
+  *          run: the host Flash only changes through the simulated calls.
+  ******************************************************************************
+  */
+#include "test_util.h"
+
+#ifndef EE_RAMFUNC_ENABLE
+  #error("test_ramfunc needs EE_RAMFUNC_ENABLE")
+#endif
+
+int main(void)
+{
+  Test_Setup();
+  EE_RelocateVectorTable();
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "init");
+  CHECK(EE_WriteVariable(&Eeprom, VirtAddVarTab[0], 1) == EE_SUCCESS, "write");
+  Test_Verify("end");
+
+  return Test_Report("test_ramfunc");
+}
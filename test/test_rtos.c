@@ -0,0 +1,157 @@
+/**
+  ******************************************************************************
+  * @file    test/test_rtos.c
+  * @brief   CMSIS-RTOS layer, on the host kernel of sim_os.c: writer threads
+  *          update their own variables while reader threads read them all,
+  *          mostly from the RAM index without the lock, page transfers
+  *          included. A read returns the value of a record of the variable,
+  *          never older than one read before, the programs and erases sleep
+  *          until the FLASH interrupt, and every value reads back once the
+  *          writers are done and after EE_Init(). EE_Init() fails before
+  *          EE_RtosInit(), and the sim_os.c mutex fails the test if a thread
+  *          takes it twice.
+  ******************************************************************************
+  */
+#include "cmsis_os.h"
+#include "test_util.h"
+
+#ifndef EE_RTOS_ENABLE
+  #error("test_rtos needs EE_RTOS_ENABLE")
+#endif
+
+#define WRITERS     2
+#define READERS     2
+#define WRITES      3000
+
+/* Values tag the variable in their low bits, the write count above them */
+#define TAG_BITS    5
+#define VALUE(idx, count)   ((ee_data_t)(((count) << TAG_BITS) | (idx)))
+
+static osThreadId MainThread;
+static volatile int WritersDone;
+static long Counts[NB_OF_VAR];
+static long Reads;
+static long ReadsInTransfer;
+static long Irqs;
+
+static void Irq(void)
+{
+  Irqs++;
+  EE_FLASH_IRQHandler();
+}
+
+/* A value read is a value of the variable, not older than Last */
+static void Check_Read(int Idx, int Status, ee_data_t Value, long* Last)
+{
+  if (Status == 1)
+  {
+    CHECK(*Last < 0, "variable %d missing after it was read", Idx);
+    return;
+  }
+  CHECK(Status == 0, "variable %d read status %d", Idx, Status);
+  CHECK((Value & ((1 << TAG_BITS) - 1)) == Idx, "variable %d read 0x%lx, a value of another one", Idx, (unsigned long)Value);
+  CHECK((long)(Value >> TAG_BITS) >= *Last, "variable %d read count %ld after %ld", Idx, (long)(Value >> TAG_BITS), *Last);
+  *Last = Value >> TAG_BITS;
+}
+
+static void Writer(void const* Argument)
+{
+  int Writer = (int)(intptr_t)Argument;
+  long n;
+  int Idx;
+  int Status;
+
+  for (n = 0; n < WRITES; n++)
+  {
+    Idx = Writer + WRITERS * (rand() % (NB_OF_VAR / WRITERS));
+    Counts[Idx]++;
+    Status = EE_WriteVariable(&Eeprom, VirtAddVarTab[Idx], VALUE(Idx, Counts[Idx]));
+    CHECK(Status == EE_SUCCESS, "writer %d write %ld status %d", Writer, n, Status);
+    TestModel[Idx] = VALUE(Idx, Counts[Idx]);
+  }
+  osSignalSet(MainThread, 1 << Writer);
+}
+
+static void Reader(void const* Argument)
+{
+  int Reader = (int)(intptr_t)Argument;
+  long Last[NB_OF_VAR];
+  ee_data_t Data[NB_OF_VAR];
+  uint8_t Found[NB_OF_VAR];
+  long Erases;
+  int Idx;
+  int Status;
+
+  for (Idx = 0; Idx < NB_OF_VAR; Idx++)
+  {
+    Last[Idx] = -1;
+  }
+  while (!WritersDone)
+  {
+    Erases = SimErases;
+    for (Idx = 0; Idx < NB_OF_VAR; Idx++)
+    {
+      Status = EE_ReadVariable(&Eeprom, VirtAddVarTab[Idx], &Data[Idx]);
+      Check_Read(Idx, Status, Data[Idx], &Last[Idx]);
+    }
+    EE_ReadVariables(&Eeprom, VirtAddVarTab, Data, Found, NB_OF_VAR);
+    for (Idx = 0; Idx < NB_OF_VAR; Idx++)
+    {
+      Check_Read(Idx, Found[Idx] ? 0 : 1, Data[Idx], &Last[Idx]);
+    }
+    Reads++;
+    if ((Eeprom.write_page != Eeprom.read_page) || (SimErases != Erases))
+    {
+      ReadsInTransfer++;
+    }
+  }
+  osSignalSet(MainThread, 1 << (WRITERS + Reader));
+}
+
+osThreadDef(Writer, osPriorityNormal, WRITERS, 0);
+osThreadDef(Reader, osPriorityNormal, READERS, 0);
+
+int main(void)
+{
+  long Programs;
+  long Erases;
+  int Idx;
+
+  Test_Setup();
+  srand(19);
+  SimIrq = Irq;
+  MainThread = osThreadGetId();
+
+  /* Before the kernel runs, the programs and erases are polled */
+  CHECK(EE_Init(&Eeprom) == NO_RTOS, "init before EE_RtosInit()");
+  CHECK(EE_RtosInit() == EE_SUCCESS, "rtos init");
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "init");
+  CHECK(Irqs == 0, "interrupt before the kernel runs");
+  Programs = SimPrograms;
+  Erases = SimErases;
+  osKernelStart();
+
+  for (Idx = 0; Idx < READERS; Idx++)
+  {
+    CHECK(osThreadCreate(osThread(Reader), (void*)(intptr_t)Idx) != NULL, "reader %d", Idx);
+  }
+  for (Idx = 0; Idx < WRITERS; Idx++)
+  {
+    CHECK(osThreadCreate(osThread(Writer), (void*)(intptr_t)Idx) != NULL, "writer %d", Idx);
+  }
+  osSignalWait((1 << WRITERS) - 1, osWaitForever);
+  WritersDone = 1;
+  osSignalWait(((1 << READERS) - 1) << WRITERS, osWaitForever);
+
+  CHECK(Reads > 0, "no read");
+  CHECK(ReadsInTransfer > 0, "no read during a page transfer");
+  CHECK(Irqs == (SimPrograms - Programs) + (SimErases - Erases), "%ld interrupts for %ld programs and %ld erases",
+        Irqs, SimPrograms - Programs, SimErases - Erases);
+  CHECK(SimErases > 2 * PAGE_NUM, "%ld erases", SimErases);
+  Test_Verify("writers done");
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "reinit");
+  Test_Verify("reinit");
+  CHECK(SimStray == 0, "%ld Flash operations outside the EEPROM", SimStray);
+
+  return Test_Report("test_rtos");
+}
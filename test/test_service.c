@@ -0,0 +1,217 @@
+/**
+  ******************************************************************************
+  * @file    test/test_service.c
+  * @brief   Service thread, on the host kernel of sim_os.c: client threads
+  *          queue writes of their own variables with EE_ServiceWrite(), urgent
+  *          or not, and retry when the queue is full. Each write completes
+  *          once through its callback, merged or not, and EE_ServiceRead()
+  *          returns the value the thread wrote last. In a batch, a read sees
+  *          the writes to its variable queued before it and none of the ones
+  *          queued after it, urgent or not. Left idle, the service
+  *          thread runs EE_Maintenance(), and every value reads back after
+  *          EE_Init().
+  ******************************************************************************
+  */
+#include "cmsis_os.h"
+#include "test_util.h"
+
+#if !defined(EE_SERVICE_ENABLE) || !defined(EE_MAINTENANCE_ENABLE)
+  #error("test_service needs EE_SERVICE_ENABLE and EE_MAINTENANCE_ENABLE")
+#endif
+
+#define CLIENTS     2
+#define WRITES      2000
+
+/* Values tag the client in their high bits, the write count below them */
+#define VALUE(client, count)  ((ee_data_t)(((client) << 12) | (count)))
+
+static osThreadId MainThread;
+static long Accepted[CLIENTS];
+static long Completed[CLIENTS];
+static long Full[CLIENTS];
+static long Reads[CLIENTS];
+static long Failed;
+static osSemaphoreId Gate;
+static ee_data_t OrderData;
+static int OrderStatus;
+
+osSemaphoreDef(Gate);
+
+static int VarIndex(ee_data_t VirtAddress)
+{
+  int Idx;
+
+  for (Idx = 0; (Idx < NB_OF_VAR) && (VirtAddVarTab[Idx] != VirtAddress); Idx++)
+  {
+  }
+  return Idx;
+}
+
+/* Write completion, called from the service thread */
+static void Written(ee_data_t VirtAddress, ee_status_t Status)
+{
+  int Idx = VarIndex(VirtAddress);
+
+  if ((Idx == NB_OF_VAR) || (Status != EE_SUCCESS))
+  {
+    Failed++;
+    return;
+  }
+  Completed[Idx % CLIENTS]++;
+}
+
+/* The value of the variable read through the service thread is the model one */
+static void Check_Read(const char* Tag, int Idx)
+{
+  ee_data_t Data = 0;
+  int Status;
+
+  Status = EE_ServiceRead(&Eeprom, VirtAddVarTab[Idx], &Data, EE_SERVICE_NORMAL);
+  if (TestModel[Idx] == TEST_MISSING)
+  {
+    CHECK(Status == 1, "%s: variable %d read status %d, never written", Tag, Idx, Status);
+  }
+  else
+  {
+    CHECK((Status == 0) && (Data == (ee_data_t)TestModel[Idx]), "%s: variable %d read 0x%lx status %d, wrote 0x%lx",
+          Tag, Idx, (unsigned long)Data, Status, (unsigned long)TestModel[Idx]);
+  }
+}
+
+/* Write completion holding the service thread until the Gate is released */
+static void Hold(ee_data_t VirtAddress, ee_status_t Status)
+{
+  osSemaphoreWait(Gate, osWaitForever);
+}
+
+static void Reader(void const* Argument)
+{
+  OrderStatus = EE_ServiceRead(&Eeprom, VirtAddVarTab[0], &OrderData, EE_SERVICE_NORMAL);
+  osSignalSet(MainThread, 1 << CLIENTS);
+}
+
+osThreadDef(Reader, osPriorityNormal, 1, 0);
+
+/* The service thread is held while a write of Before, a read of the first
+   variable and an urgent write of After are queued, they are served in one
+   batch. Before is not written if TEST_MISSING */
+static void Check_Order(const char* Tag, long Before, long After)
+{
+  CHECK(EE_ServiceWrite(&Eeprom, VirtAddVarTab[1], 0, EE_SERVICE_NORMAL, Hold) == EE_SUCCESS, "%s: hold", Tag);
+  osDelay(10);
+  if (Before != TEST_MISSING)
+  {
+    CHECK(EE_ServiceWrite(&Eeprom, VirtAddVarTab[0], (ee_data_t)Before, EE_SERVICE_NORMAL, Written) == EE_SUCCESS,
+          "%s: write before", Tag);
+    TestModel[0] = Before;
+  }
+  CHECK(osThreadCreate(osThread(Reader), NULL) != NULL, "%s: reader", Tag);
+  osDelay(10);
+  CHECK(EE_ServiceWrite(&Eeprom, VirtAddVarTab[0], (ee_data_t)After, EE_SERVICE_URGENT, Written) == EE_SUCCESS,
+        "%s: write after", Tag);
+  osSemaphoreRelease(Gate);
+  osSignalWait(1 << CLIENTS, osWaitForever);
+  CHECK((OrderStatus == 0) && (OrderData == (ee_data_t)TestModel[0]), "%s: read 0x%lx status %d, expected 0x%lx",
+        Tag, (unsigned long)OrderData, OrderStatus, (unsigned long)TestModel[0]);
+  TestModel[0] = After;
+  TestModel[1] = 0;
+  Check_Read(Tag, 0);
+}
+
+static void Client(void const* Argument)
+{
+  int Client = (int)(intptr_t)Argument;
+  uint8_t Priority;
+  long n;
+  int Idx;
+  int Status;
+
+  for (n = 0; n < WRITES; n++)
+  {
+    Idx = Client + CLIENTS * (rand() % (NB_OF_VAR / CLIENTS));
+    Priority = (rand() % 4 == 0) ? EE_SERVICE_URGENT : EE_SERVICE_NORMAL;
+    while ((Status = EE_ServiceWrite(&Eeprom, VirtAddVarTab[Idx], VALUE(Client, n), Priority, Written)) == QUEUE_FULL)
+    {
+      Full[Client]++;
+      osThreadYield();
+    }
+    CHECK(Status == EE_SUCCESS, "client %d write %ld status %d", Client, n, Status);
+    Accepted[Client]++;
+    TestModel[Idx] = VALUE(Client, n);
+
+    /* Read your writes: the ones queued before are complete */
+    if (rand() % 8 == 0)
+    {
+      Check_Read("client", Client + CLIENTS * (rand() % (NB_OF_VAR / CLIENTS)));
+      Reads[Client]++;
+    }
+  }
+  osSignalSet(MainThread, 1 << Client);
+}
+
+osThreadDef(Client, osPriorityNormal, CLIENTS, 0);
+
+int main(void)
+{
+  ee_data_t Data;
+  long Erases;
+  long n = 0;
+  int Idx;
+
+  Test_Setup();
+  srand(20);
+  SimIrq = EE_FLASH_IRQHandler;
+  MainThread = osThreadGetId();
+
+  CHECK(EE_ServiceWrite(&Eeprom, VirtAddVarTab[0], 0, EE_SERVICE_NORMAL, Written) == NO_SERVICE, "write before the start");
+  CHECK(EE_ServiceRead(&Eeprom, VirtAddVarTab[0], &Data, EE_SERVICE_NORMAL) == NO_SERVICE, "read before the start");
+  CHECK(EE_RtosInit() == EE_SUCCESS, "rtos init");
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "init");
+  osKernelStart();
+  CHECK(EE_ServiceStart() == EE_SUCCESS, "start");
+
+  for (Idx = 0; Idx < CLIENTS; Idx++)
+  {
+    CHECK(osThreadCreate(osThread(Client), (void*)(intptr_t)Idx) != NULL, "client %d", Idx);
+  }
+  osSignalWait((1 << CLIENTS) - 1, osWaitForever);
+
+  /* A read after the writes waits for all of them */
+  for (Idx = 0; Idx < NB_OF_VAR; Idx++)
+  {
+    Check_Read("clients done", Idx);
+  }
+  for (Idx = 0; Idx < CLIENTS; Idx++)
+  {
+    CHECK(Completed[Idx] == Accepted[Idx], "client %d: %ld writes completed, %ld queued", Idx, Completed[Idx], Accepted[Idx]);
+    CHECK(Reads[Idx] > 0, "client %d never read", Idx);
+  }
+  CHECK(Failed == 0, "%ld writes failed", Failed);
+  CHECK(Full[0] + Full[1] > 0, "the queue was never full");
+  CHECK(SimErases > 2 * PAGE_NUM, "%ld erases", SimErases);
+  Test_Verify("clients done");
+
+  /* Queue order against the owner merge, then against the priorities */
+  Gate = osSemaphoreCreate(osSemaphore(Gate), 0);
+  Check_Order("merge", 0x111, 0x222);
+  Check_Order("priority", TEST_MISSING, 0x333);
+
+  /* Fill the page written to over the threshold, the idle thread compacts it */
+  do
+  {
+    n++;
+    CHECK(EE_ServiceWrite(&Eeprom, VirtAddVarTab[0], (ee_data_t)n, EE_SERVICE_NORMAL, Written) == EE_SUCCESS, "fill");
+    TestModel[0] = (ee_data_t)n;
+    Check_Read("fill", 0);
+  } while (Test_CountRecords(Eeprom.write_page) * 100 <= EE_MAINTENANCE_THRESHOLD * TEST_PAGE_RECORDS);
+  Erases = SimErases;
+  osDelay(3 * EE_SERVICE_IDLE_MS);
+  CHECK(SimErases > Erases, "no maintenance while idle");
+  Test_Verify("idle");
+
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "reinit");
+  Test_Verify("reinit");
+  CHECK(SimStray == 0, "%ld Flash operations outside the EEPROM", SimStray);
+
+  return Test_Report("test_service");
+}
@@ -0,0 +1,78 @@
+/**
+  ******************************************************************************
+  * @file    test/test_single.c
+  * @brief   Single EEPROM build, without EE_MULT_ENABLE: the public functions
+  *          take no handle and work on the EEPROM of the configuration. Its
+  *          writes, batch writes, transfers, statistics and wear information
+  *          behave like the ones of an instance, the values survive EE_Init().
+  ******************************************************************************
+  */
+#include "test_util.h"
+
+#ifdef EE_MULT_ENABLE
+  #error("test_single is built without EE_MULT_ENABLE, define EE_MULT_DISABLE")
+#endif
+
+#define WRITES      20000
+#define BATCH       4
+
+int main(void)
+{
+  ee_var_t Vars[BATCH];
+  ee_stats_t Stats;
+  uint16_t Counts[PAGE_NUM];
+  long Writes = 0;
+  long Total = 0;
+  long n;
+  int Idx;
+  int Page;
+
+  Test_Setup();
+  srand(13);
+  CHECK(EE_Init() == EE_SUCCESS, "init");
+  Test_Verify("init");
+
+  for (n = 0; n < WRITES; n++)
+  {
+    Idx = rand() % NB_OF_VAR;
+    CHECK(EE_WriteVariable(VirtAddVarTab[Idx], (ee_data_t)n) == EE_SUCCESS, "write %ld", n);
+    TestModel[Idx] = (ee_data_t)n;
+    Writes++;
+
+    if (n % 1000 == 0)
+    {
+      for (Idx = 0; Idx < BATCH; Idx++)
+      {
+        Vars[Idx].addr = VirtAddVarTab[(n + Idx * 5) % NB_OF_VAR];
+        Vars[Idx].data = (ee_data_t)(n + Idx);
+      }
+      CHECK(EE_WriteVariables(Vars, BATCH) == EE_SUCCESS, "batch write at %ld", n);
+      for (Idx = 0; Idx < BATCH; Idx++)
+      {
+        TestModel[(n + Idx * 5) % NB_OF_VAR] = (ee_data_t)(n + Idx);
+      }
+      Writes += BATCH;
+
+      CHECK(EE_Init() == EE_SUCCESS, "init at %ld", n);
+      Test_Verify("init");
+    }
+  }
+  CHECK(SimErases > 10 * PAGE_NUM, "%ld erases", SimErases);
+  Test_Verify("writes");
+
+  EE_GetStats(&Stats);
+  CHECK(Stats.write_count == Writes, "%lu writes counted, %ld done", (unsigned long)Stats.write_count, Writes);
+
+  CHECK(EE_GetWearInfo(Counts, PAGE_NUM) == EE_SUCCESS, "wear info");
+  for (Page = 0; Page < PAGE_NUM; Page++)
+  {
+    Total += Counts[Page];
+  }
+  CHECK(Total == SimErases, "%ld erases counted, %ld done", Total, SimErases);
+
+  CHECK(EE_Init() == EE_SUCCESS, "final init");
+  Test_Verify("final");
+  CHECK(SimStray == 0, "%ld Flash operations outside the EEPROM", SimStray);
+
+  return Test_Report("test_single");
+}
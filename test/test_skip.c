@@ -0,0 +1,177 @@
+/**
+  ******************************************************************************
+  * @file    test/test_skip.c
+  * @brief   Skip of the unchanged writes: a write, single or in a batch, of
+  *          the value the newest record holds programs nothing and counts in
+  *          the elided writes of EE_GetStats(), before and after the page
+  *          transfers and EE_Init(). A value equal to an older record only is
+  *          written. With EE_ASYNC_ENABLE, an asynchronous write of the newest
+  *          value, stored or queued, is not queued and completes at once.
+  ******************************************************************************
+  */
+#include "test_util.h"
+
+#ifndef EE_SKIP_UNCHANGED_ENABLE
+  #error("test_skip needs EE_SKIP_UNCHANGED_ENABLE")
+#endif
+
+#ifdef EE_ASYNC_ENABLE
+#define TEST_NAME   "test_skip_async"
+#else
+#define TEST_NAME   "test_skip"
+#endif
+
+#define WRITES      5000
+
+/* Halfword programs of n records */
+#define PROGRAMS(n)   ((n) * TEST_RECORD_SIZE / 2)
+
+static ee_stats_t Stats;
+static long Programs;
+
+/* Write counts and programs since the previous call */
+static void Check_Counts(const char* Tag, uint32_t Writes, uint32_t Elided, long Records)
+{
+  ee_stats_t Now;
+
+  EE_GetStats(&Eeprom, &Now);
+  CHECK(Now.write_count - Stats.write_count == Writes, "%s: %lu writes counted, expected %lu",
+        Tag, (unsigned long)(Now.write_count - Stats.write_count), (unsigned long)Writes);
+  CHECK(Now.elided_count - Stats.elided_count == Elided, "%s: %lu writes elided, expected %lu",
+        Tag, (unsigned long)(Now.elided_count - Stats.elided_count), (unsigned long)Elided);
+  if (Records >= 0)
+  {
+    CHECK(SimPrograms - Programs == PROGRAMS(Records), "%s: %ld programs, expected %ld",
+          Tag, SimPrograms - Programs, PROGRAMS(Records));
+  }
+  Stats = Now;
+  Programs = SimPrograms;
+}
+
+#ifdef EE_ASYNC_ENABLE
+static long Completed;
+
+static void Done(ee_data_t VirtAddress, ee_status_t Status)
+{
+  CHECK(Status == EE_SUCCESS, "async write of 0x%lx status %d", (unsigned long)VirtAddress, Status);
+  Completed++;
+}
+
+static void Write_Async(int Idx, ee_data_t Data)
+{
+  CHECK(EE_WriteVariableAsync(&Eeprom, VirtAddVarTab[Idx], Data, Done) == EE_SUCCESS, "async write %d", Idx);
+  TestModel[Idx] = Data;
+}
+
+/* Run the controller until the engine is idle */
+static void Drain(void)
+{
+  while (EE_Busy() && Sim_Tick())
+  {
+  }
+}
+#endif
+
+static void Write(int Idx, ee_data_t Data)
+{
+  CHECK(EE_WriteVariable(&Eeprom, VirtAddVarTab[Idx], Data) == EE_SUCCESS, "write %d", Idx);
+  TestModel[Idx] = Data;
+}
+
+/* Every variable rewritten with its value, one by one then in a batch */
+static void Rewrite_All(const char* Tag)
+{
+  ee_var_t Vars[NB_OF_VAR];
+  int Idx;
+
+  for (Idx = 0; Idx < NB_OF_VAR; Idx++)
+  {
+    Write(Idx, (ee_data_t)TestModel[Idx]);
+    Vars[Idx].addr = VirtAddVarTab[Idx];
+    Vars[Idx].data = (ee_data_t)TestModel[Idx];
+  }
+  Check_Counts(Tag, NB_OF_VAR, NB_OF_VAR, 0);
+
+  CHECK(EE_WriteVariables(&Eeprom, Vars, NB_OF_VAR) == EE_SUCCESS, "%s: batch", Tag);
+  Check_Counts(Tag, NB_OF_VAR, NB_OF_VAR, 0);
+}
+
+int main(void)
+{
+  ee_var_t Vars[4];
+  uint32_t Elided = 0;
+  long n;
+  int Idx;
+
+  Test_Setup();
+  srand(11);
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "init");
+  Check_Counts("init", 0, 0, -1);
+
+  for (Idx = 0; Idx < NB_OF_VAR; Idx++)
+  {
+    Write(Idx, (ee_data_t)Idx);
+  }
+  Check_Counts("first writes", NB_OF_VAR, 0, NB_OF_VAR);
+  Rewrite_All("unchanged");
+
+  /* Only the newest record counts */
+  Write(0, 100);
+  Write(0, 0);
+  Check_Counts("older value", 2, 0, 2);
+
+  /* A batch programs its changed variables only */
+  Vars[0].addr = VirtAddVarTab[1];
+  Vars[0].data = (ee_data_t)TestModel[1];
+  Vars[1].addr = VirtAddVarTab[2];
+  Vars[1].data = 200;
+  Vars[2].addr = VirtAddVarTab[3];
+  Vars[2].data = (ee_data_t)TestModel[3];
+  Vars[3].addr = VirtAddVarTab[4];
+  Vars[3].data = 400;
+  CHECK(EE_WriteVariables(&Eeprom, Vars, 4) == EE_SUCCESS, "mixed batch");
+  TestModel[2] = 200;
+  TestModel[4] = 400;
+  Check_Counts("mixed batch", 4, 2, 2);
+  Test_Verify("mixed batch");
+
+  /* Through the page transfers, half of the writes are unchanged */
+  for (n = 0; n < WRITES; n++)
+  {
+    ee_data_t Data;
+
+    Idx = rand() % NB_OF_VAR;
+    Data = (rand() & 1) ? (ee_data_t)TestModel[Idx] : (ee_data_t)n;
+    Elided += (Data == (ee_data_t)TestModel[Idx]);
+    Write(Idx, Data);
+  }
+  Check_Counts("random", WRITES, Elided, -1);
+  CHECK(SimErases > 0, "no page transfer");
+  Test_Verify("random");
+  Rewrite_All("after transfers");
+
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "reinit");
+  Test_Verify("reinit");
+  Check_Counts("reinit", 0, 0, 0);
+  Rewrite_All("after reinit");
+
+#ifdef EE_ASYNC_ENABLE
+  /* The stored value completes before the return, without a program */
+  SimIrq = EE_FLASH_IRQHandler;
+  Write_Async(0, (ee_data_t)TestModel[0]);
+  CHECK(!EE_Busy() && (Completed == 1), "unchanged async write queued");
+  Check_Counts("async stored", 1, 1, 0);
+
+  /* The queued value is the newest one */
+  Write_Async(1, (ee_data_t)(TestModel[1] + 1));
+  Write_Async(1, (ee_data_t)TestModel[1]);
+  CHECK(Completed == 2, "%ld async writes completed before the drain", Completed);
+  Drain();
+  CHECK(Completed == 3, "%ld async writes completed", Completed);
+  Check_Counts("async queued", 2, 1, 1);
+  Test_Verify("async");
+#endif
+  CHECK(SimStray == 0, "%ld Flash operations outside the EEPROM", SimStray);
+
+  return Test_Report(TEST_NAME);
+}
@@ -0,0 +1,56 @@
+/**
+  ******************************************************************************
+  * @file    test/test_transfer.c
+  * @brief   Page transfers: the page a transfer fills holds a single record of
+  *          each variable written so far, with its newest value, and none of
+  *          the variables never written. The values survive EE_Init().
+  ******************************************************************************
+  */
+#include "test_util.h"
+
+#if (EE_DATA_32BIT == EE_DATA_WIDTH)
+#define TEST_NAME   "test_transfer_32"
+#else
+#define TEST_NAME   "test_transfer"
+#endif
+
+#define WRITES      20000
+
+int main(void)
+{
+  long Transfers = 0;
+  long Erases;
+  long n;
+  int Written = 0;
+  int Idx;
+
+  Test_Setup();
+  srand(3);
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "init");
+
+  /* The variables of odd positions are never written */
+  for (n = 0; n < WRITES; n++)
+  {
+    Idx = (rand() % ((NB_OF_VAR + 1) / 2)) * 2;
+    Written += (TestModel[Idx] == TEST_MISSING);
+    Erases = SimErases;
+    CHECK(EE_WriteVariable(&Eeprom, VirtAddVarTab[Idx], (ee_data_t)n) == EE_SUCCESS, "write %ld", n);
+    TestModel[Idx] = (ee_data_t)n;
+    if (SimErases == Erases)
+    {
+      continue;
+    }
+
+    /* The transfer copied each variable once, the one written included */
+    Transfers++;
+    CHECK(Test_CountRecords(Eeprom.read_page) == Written, "transfer %ld: %d records, %d variables written",
+          Transfers, Test_CountRecords(Eeprom.read_page), Written);
+    Test_Verify("transfer");
+  }
+  CHECK(Transfers > 10, "%ld transfers", Transfers);
+
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "reinit");
+  Test_Verify("reinit");
+
+  return Test_Report(TEST_NAME);
+}
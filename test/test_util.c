@@ -0,0 +1,100 @@
+/**
+  ******************************************************************************
+  * @file    test/test_util.c
+  * @brief   Fixture shared by the host tests.
+  ******************************************************************************
+  */
+#include <stdlib.h>
+#include "test_util.h"
+
+/* Symbols the library expects from the application */
+ee_data_t VirtAddVarTab[NB_OF_VAR];
+ee_alloc_t EmulatedChips[EE_NUM];
+
+int TestFailures;
+ee_handle_t Eeprom;
+long TestModel[NB_OF_VAR];
+
+/* Fresh Flash, an unsorted variable table and the first allocation bound to
+   Eeprom, not initialized yet */
+void Test_Setup(void)
+{
+  int Idx;
+
+  Sim_Init();
+  for (Idx = 0; Idx < NB_OF_VAR; Idx++)
+  {
+    VirtAddVarTab[Idx] = (ee_data_t)(0x1000 + ((Idx * 7) % NB_OF_VAR) * 3);
+    TestModel[Idx] = TEST_MISSING;
+  }
+  EmulatedChips[0].start_addr = EEPROM_START_ADDRESS;
+  EmulatedChips[0].page_num = PAGE_NUM;
+  EmulatedChips[0].var_num = NB_OF_VAR;
+  EmulatedChips[0].var_addr_tab = VirtAddVarTab;
+  Eeprom.alloc = &EmulatedChips[0];
+}
+
+/* Every variable reads its model value, one by one and in one batch */
+void Test_Verify(const char* Tag)
+{
+  ee_data_t Data[NB_OF_VAR];
+  uint8_t Found[NB_OF_VAR];
+  ee_data_t Value;
+  int Idx;
+  int Status;
+
+  for (Idx = 0; Idx < NB_OF_VAR; Idx++)
+  {
+    Value = 0;
+    Status = EE_ReadVariable(TEST_HANDLE_FIRST VirtAddVarTab[Idx], &Value);
+    if (TestModel[Idx] == TEST_MISSING)
+    {
+      CHECK(Status == 1, "%s: variable %d should be missing, status %d", Tag, Idx, Status);
+    }
+    else
+    {
+      CHECK((Status == 0) && (Value == (ee_data_t)TestModel[Idx]),
+            "%s: variable %d expected %ld, status %d value %lu", Tag, Idx, TestModel[Idx], Status, (unsigned long)Value);
+    }
+    Found[Idx] = 0;
+  }
+
+  EE_ReadVariables(TEST_HANDLE_FIRST VirtAddVarTab, Data, Found, NB_OF_VAR);
+  for (Idx = 0; Idx < NB_OF_VAR; Idx++)
+  {
+    if (TestModel[Idx] == TEST_MISSING)
+    {
+      CHECK(!Found[Idx], "%s: batch variable %d should be missing", Tag, Idx);
+    }
+    else
+    {
+      CHECK(Found[Idx] && (Data[Idx] == (ee_data_t)TestModel[Idx]), "%s: batch variable %d", Tag, Idx);
+    }
+  }
+}
+
+/* Records programmed in a page, they are followed by erased slots only */
+int Test_CountRecords(uint16_t Page)
+{
+  uint32_t Address = TEST_PAGE_ADDRESS(Page) + TEST_HEADER_SIZE;
+  int Count = 0;
+  int Byte;
+
+  for (; Address < TEST_PAGE_ADDRESS(Page + 1); Address += TEST_RECORD_SIZE, Count++)
+  {
+    for (Byte = 0; (Byte < TEST_RECORD_SIZE) && (*(uint8_t*)(uintptr_t)(Address + Byte) == 0xFF); Byte++)
+    {
+    }
+    if (Byte == TEST_RECORD_SIZE)
+    {
+      break;
+    }
+  }
+  return Count;
+}
+
+int Test_Report(const char* Name)
+{
+  printf("%s: %s (%d failures)\n", Name, TestFailures ? "FAILED" : "passed", TestFailures);
+  return TestFailures != 0;
+}
@@ -0,0 +1,61 @@
+/**
+  ******************************************************************************
+  * @file    test/test_util.h
+  * @brief   Fixture shared by the host tests: the variable table, the EEPROM
+  *          instance under test and a model of the values it must hold.
+  ******************************************************************************
+  */
+#ifndef __TEST_UTIL_H
+#define __TEST_UTIL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "eeprom.h"
+#include "sim_flash.h"
+
+/* The EEPROM under test is Eeprom, the builds without EE_MULT_ENABLE use the 
+   one the configuration describes, their public functions take no handle */
+#ifdef EE_MULT_ENABLE
+#define TEST_HANDLE_ONLY    &Eeprom
+#define TEST_HANDLE_FIRST   &Eeprom,
+#else
+#define TEST_HANDLE_ONLY
+#define TEST_HANDLE_FIRST
+#endif
+
+#define CHECK(cond, ...) do { if (!(cond)) { \
+    printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); \
+    if (++TestFailures > 20) { exit(1); } } } while (0)
+
+/* Page layout of the build under test, see EE_RECORD_SIZE, EE_HEADER_SIZE and 
+   EE_ERASE_CHECK_OFFSET */
+#define TEST_DATA_SIZE      (EE_DATA_WIDTH / 8)
+#ifdef EE_CRC_ENABLE
+#define TEST_RECORD_SIZE    (4 * TEST_DATA_SIZE)
+#define TEST_HEADER_SIZE    16
+#define TEST_ERASE_CHECK_OFFSET 14
+#else
+#define TEST_RECORD_SIZE    (2 * TEST_DATA_SIZE)
+#define TEST_HEADER_SIZE    ((TEST_DATA_SIZE == 4) ? 16 : 12)
+#define TEST_ERASE_CHECK_OFFSET 8
+#endif
+#define TEST_PAGE_RECORDS   ((PAGE_SIZE - TEST_HEADER_SIZE) / TEST_RECORD_SIZE)
+
+/* Flash address of a page of the EEPROM under test */
+#define TEST_PAGE_ADDRESS(page)   (EEPROM_START_ADDRESS + (uint32_t)(page) * PAGE_SIZE)
+
+/* Model value of a variable never written */
+#define TEST_MISSING        (-1L)
+
+extern ee_data_t VirtAddVarTab[NB_OF_VAR];
+extern ee_alloc_t EmulatedChips[EE_NUM];
+extern int TestFailures;
+extern ee_handle_t Eeprom;
+extern long TestModel[NB_OF_VAR];
+
+void Test_Setup(void);
+void Test_Verify(const char* Tag);
+int Test_CountRecords(uint16_t Page);
+int Test_Report(const char* Name);
+
+#endif /* __TEST_UTIL_H */
@@ -0,0 +1,150 @@
+/**
+  ******************************************************************************
+  * @file    test/test_wear.c
+  * @brief   Wear leveling: each transfer goes to the least worn erased page,
+  *          a page worn more than the others by a past use is left aside until
+  *          they catch up, the erase counts of EE_GetWearInfo() add up to the
+  *          erases done and survive a reset. A count cut by a power loss is
+  *          not trusted, its page is erased again.
+  ******************************************************************************
+  */
+#include <string.h>
+#include "test_util.h"
+
+#define WRITES      30000
+
+/* Extra erases of the page worn beforehand */
+#define WORN        5
+
+/* Erase count halfword of the page header and its check, the complement of 
+   the count plus one */
+#define ERASE_COUNT(page)   (*(uint16_t*)(uintptr_t)(TEST_PAGE_ADDRESS(page) + 2))
+#define ERASE_CHECK(page)   (*(uint16_t*)(uintptr_t)(TEST_PAGE_ADDRESS(page) + TEST_ERASE_CHECK_OFFSET))
+#define PAGE_STATUS(page)   (*(uint16_t*)(uintptr_t)TEST_PAGE_ADDRESS(page))
+
+static void Check_Wear(const char* Tag, uint16_t* Counts)
+{
+  long Total = 0;
+  int Page;
+
+  CHECK(EE_GetWearInfo(&Eeprom, Counts, PAGE_NUM) == EE_SUCCESS, "%s: wear info", Tag);
+  CHECK(EE_GetWearInfo(&Eeprom, Counts, PAGE_NUM - 1) == BUFFER_TOO_SMALL, "%s: wear info in a short buffer", Tag);
+  for (Page = 0; Page < PAGE_NUM; Page++)
+  {
+    CHECK(Counts[Page] == ERASE_COUNT(Page), "%s: page %d reported %u erases, header %u", Tag, Page, Counts[Page], ERASE_COUNT(Page));
+    CHECK(ERASE_CHECK(Page) == (uint16_t)~(ERASE_COUNT(Page) + 1), "%s: page %d erase count %04X, check %04X",
+          Tag, Page, ERASE_COUNT(Page), ERASE_CHECK(Page));
+    Total += Counts[Page];
+  }
+  CHECK(Total == SimErases + WORN, "%s: %ld erases counted, %ld done", Tag, Total, SimErases + WORN);
+}
+
+int main(void)
+{
+  uint16_t Counts[PAGE_NUM];
+  uint16_t Before[PAGE_NUM];
+  uint16_t Least;
+  uint16_t Highest;
+  uint16_t Page;
+  long Transfers = 0;
+  long WornSkipped = 0;
+  long n;
+  int Idx;
+  int Worn;
+  int Torn;
+
+  Test_Setup();
+  srand(13);
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "init");
+
+  /* A page erased WORN times before, by a previous use of the Flash */
+  Worn = (Eeprom.read_page + PAGE_NUM / 2) % PAGE_NUM;
+  CHECK(PAGE_STATUS(Worn) == 0xFFFF, "page %d is not erased", Worn);
+  ERASE_COUNT(Worn) = WORN;
+  ERASE_CHECK(Worn) = (uint16_t)~(WORN + 1);
+
+  for (n = 0; n < WRITES; n++)
+  {
+    /* The least worn erased page, the next transfer goes to one of them */
+    Least = 0xFFFF;
+    for (Page = 0; Page < PAGE_NUM; Page++)
+    {
+      if ((PAGE_STATUS(Page) == 0xFFFF) && (ERASE_COUNT(Page) < Least))
+      {
+        Least = ERASE_COUNT(Page);
+      }
+    }
+
+    Page = Eeprom.write_page;
+    Idx = rand() % NB_OF_VAR;
+    CHECK(EE_WriteVariable(&Eeprom, VirtAddVarTab[Idx], (ee_data_t)n) == EE_SUCCESS, "write %ld", n);
+    TestModel[Idx] = (ee_data_t)n;
+    if (Eeprom.write_page == Page)
+    {
+      continue;
+    }
+
+    Transfers++;
+    CHECK(ERASE_COUNT(Eeprom.write_page) == Least, "write %ld: transfer to page %d erased %u times, least %u",
+          n, Eeprom.write_page, ERASE_COUNT(Eeprom.write_page), Least);
+    if ((Eeprom.write_page != Worn) && (PAGE_STATUS(Worn) == 0xFFFF) && (ERASE_COUNT(Worn) > Least))
+    {
+      WornSkipped++;
+    }
+  }
+  CHECK(Transfers > 10 * PAGE_NUM, "%ld transfers", Transfers);
+  CHECK(WornSkipped >= WORN * (PAGE_NUM - 2), "worn page skipped %ld times", WornSkipped);
+  Test_Verify("writes");
+
+  /* The pages are used evenly, the worn one included */
+  Check_Wear("writes", Counts);
+  for (Page = 0; Page < PAGE_NUM; Page++)
+  {
+    CHECK((Counts[Page] + 1 >= Counts[Worn]) && (Counts[Page] <= Counts[Worn] + 1),
+          "page %d erased %u times, worn page %u", Page, Counts[Page], Counts[Worn]);
+  }
+
+  /* The counts are in the page headers, a reset keeps them */
+  memcpy(Before, Counts, sizeof(Before));
+  memset(&Eeprom, 0, sizeof(Eeprom));
+  Eeprom.alloc = &EmulatedChips[0];
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "reinit");
+  Check_Wear("reinit", Counts);
+  CHECK(memcmp(Before, Counts, sizeof(Before)) == 0, "erase counts changed by EE_Init()");
+  Test_Verify("reinit");
+
+  /* A reset cut the erase count program of an erased page short: the torn 
+     count, zero at worst, would make the page the least worn one for good */
+  for (Torn = 0; (Torn < PAGE_NUM) && ((PAGE_STATUS(Torn) != 0xFFFF) || (Torn == Eeprom.write_page)); Torn++)
+  {
+  }
+  CHECK(Torn < PAGE_NUM, "no erased page");
+  memset((void*)(uintptr_t)TEST_PAGE_ADDRESS(Torn), 0xFF, PAGE_SIZE);
+  ERASE_COUNT(Torn) = 0;
+  Highest = 0;
+  for (Page = 0; Page < PAGE_NUM; Page++)
+  {
+    if ((Page != Torn) && (ERASE_COUNT(Page) > Highest))
+    {
+      Highest = ERASE_COUNT(Page);
+    }
+  }
+  CHECK(EE_GetWearInfo(&Eeprom, Counts, PAGE_NUM) == EE_SUCCESS, "torn: wear info");
+  CHECK(Counts[Torn] == Highest, "torn: page %d reported %u erases, highest %u", Torn, Counts[Torn], Highest);
+
+  /* The page is taken in turn, erased again before the transfer to it */
+  for (n = 0; (n < WRITES) && (Eeprom.write_page != Torn); n++)
+  {
+    Idx = rand() % NB_OF_VAR;
+    CHECK(EE_WriteVariable(&Eeprom, VirtAddVarTab[Idx], (ee_data_t)n) == EE_SUCCESS, "torn: write %ld", n);
+    TestModel[Idx] = (ee_data_t)n;
+  }
+  CHECK(Eeprom.write_page == Torn, "torn: page %d never transferred to", Torn);
+  CHECK(ERASE_COUNT(Torn) > Highest, "torn: page %d erased %u times, highest %u", Torn, ERASE_COUNT(Torn), Highest);
+  CHECK(ERASE_CHECK(Torn) == (uint16_t)~(ERASE_COUNT(Torn) + 1), "torn: page %d erase count %04X, check %04X",
+        Torn, ERASE_COUNT(Torn), ERASE_CHECK(Torn));
+  Test_Verify("torn");
+  CHECK(SimStray == 0, "%ld Flash operations outside the EEPROM", SimStray);
+
+  return Test_Report("test_wear");
+}
@@ -0,0 +1,109 @@
+/**
+  ******************************************************************************
+  * @file    test/test_writeback.c
+  * @brief   Write-back cache: the cached writes do not program the Flash and
+  *          read back at once, EE_FlushIfDue() writes them when
+  *          EE_WRITEBACK_MAX_DIRTY variables are dirty or the oldest one is
+  *          EE_WRITEBACK_MAX_AGE ticks old, EE_Flush() at any time, and the
+  *          flushed values survive a reset.
+  ******************************************************************************
+  */
+#include <string.h>
+#include "test_util.h"
+
+#ifndef EE_WRITEBACK_ENABLE
+  #error("test_writeback needs EE_WRITEBACK_ENABLE")
+#endif
+
+/* Halfword programs of n records */
+#define PROGRAMS(n)   ((n) * TEST_RECORD_SIZE / 2)
+
+static long n;
+
+static void Write(int Idx)
+{
+  CHECK(EE_WriteVariable(&Eeprom, VirtAddVarTab[Idx], (ee_data_t)n) == EE_SUCCESS, "write %ld", n);
+  TestModel[Idx] = (ee_data_t)n++;
+}
+
+/* Power on reset: the RAM state is lost, the Flash is read again */
+static void Reset(void)
+{
+  memset(&Eeprom, 0, sizeof(Eeprom));
+  Eeprom.alloc = &EmulatedChips[0];
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "init");
+}
+
+int main(void)
+{
+  long Programs;
+  long Erases;
+  long Lost;
+  int Idx;
+  int Round;
+
+  Test_Setup();
+  CHECK(EE_Init(&Eeprom) == EE_SUCCESS, "init");
+
+  for (Round = 0; Round < 3 * TEST_PAGE_RECORDS / EE_WRITEBACK_MAX_DIRTY; Round++)
+  {
+    /* Up to the dirty threshold, the writes stay in RAM, rewrites included */
+    Programs = SimPrograms;
+    for (Idx = 0; Idx < EE_WRITEBACK_MAX_DIRTY - 1; Idx++)
+    {
+      Write((Round + Idx) % NB_OF_VAR);
+      Write((Round + Idx) % NB_OF_VAR);
+    }
+    CHECK(SimPrograms == Programs, "round %d: %ld programs below the dirty threshold", Round, SimPrograms - Programs);
+    Test_Verify("cached");
+
+    /* The write making one more variable dirty flushes them all */
+    Erases = SimErases;
+    Write((Round + EE_WRITEBACK_MAX_DIRTY - 1) % NB_OF_VAR);
+    CHECK(SimPrograms - Programs >= PROGRAMS(EE_WRITEBACK_MAX_DIRTY), "round %d: no flush at the dirty threshold", Round);
+    if (SimErases == Erases)
+    {
+      CHECK(SimPrograms - Programs == PROGRAMS(EE_WRITEBACK_MAX_DIRTY), "round %d: flush took %ld programs",
+            Round, SimPrograms - Programs);
+    }
+    Test_Verify("flushed");
+  }
+  CHECK(SimErases > 0, "no page transfer");
+
+  /* Age threshold, from the first write making the cache dirty */
+  SimTick = 0xFFFFFF00u;
+  Write(1);
+  SimTick += EE_WRITEBACK_MAX_AGE / 2;
+  Write(2);
+  Programs = SimPrograms;
+  SimTick += EE_WRITEBACK_MAX_AGE / 2 - 1;
+  CHECK(EE_FlushIfDue(&Eeprom) == EE_SUCCESS, "flush if due");
+  CHECK(SimPrograms == Programs, "flushed %ld programs before the age threshold", SimPrograms - Programs);
+  SimTick++;
+  CHECK(EE_FlushIfDue(&Eeprom) == EE_SUCCESS, "flush if due");
+  CHECK(SimPrograms - Programs >= PROGRAMS(2), "no flush at the age threshold");
+  Programs = SimPrograms;
+  CHECK(EE_FlushIfDue(&Eeprom) == EE_SUCCESS, "flush if due");
+  CHECK(SimPrograms == Programs, "clean cache flushed again");
+
+  /* Explicit flush, the values survive a reset */
+  Write(3);
+  Write(4);
+  Write(3);
+  CHECK(EE_Flush(&Eeprom) == EE_SUCCESS, "flush");
+  CHECK(SimPrograms - Programs >= PROGRAMS(2), "flush took %ld programs", SimPrograms - Programs);
+  Reset();
+  Test_Verify("reset after flush");
+
+  /* The writes not flushed are lost on a reset */
+  Lost = TestModel[5];
+  Write(5);
+  Test_Verify("cached before reset");
+  Reset();
+  TestModel[5] = Lost;
+  Test_Verify("reset without flush");
+
+  CHECK(SimStray == 0, "%ld Flash operations outside the EEPROM", SimStray);
+
+  return Test_Report("test_writeback");
+}